@@ -0,0 +1,271 @@
+/*
+ * Shared benchmark support from bench.h
+ */
+
+#include "bench.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include <boost/atomic.hpp>
+
+#include "framer.h"
+#include "packets.h"
+#include "protocol_v2.h"
+
+// count every allocation in the process, so that benchmarks can report
+// how many happen per packet
+static boost::atomic<unsigned long> n_allocations(0);
+
+void * operator new(size_t sz) {
+   n_allocations.fetch_add(1, boost::memory_order_relaxed);
+   void * p = malloc(sz ? sz : 1);
+   if( !p ) {
+      throw std::bad_alloc();
+   }
+   return p;
+}
+
+void * operator new[](size_t sz) {
+   return operator new(sz);
+}
+
+void operator delete(void * p) throw() {
+   free(p);
+}
+
+void operator delete[](void * p) throw() {
+   free(p);
+}
+
+void operator delete(void * p, size_t) throw() {
+   free(p);
+}
+
+void operator delete[](void * p, size_t) throw() {
+   free(p);
+}
+
+unsigned long allocations() {
+   return n_allocations.load(boost::memory_order_relaxed);
+}
+
+void report_packets(benchmark::State & state, unsigned long packets,
+      unsigned long allocs) {
+   state.SetItemsProcessed(packets);
+   // seconds per packet, printed with an SI prefix
+   state.counters["time/packet"] = benchmark::Counter(packets,
+         benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+   state.counters["allocs/packet"] =
+      benchmark::Counter(packets ? (double)allocs / packets : 0.0);
+}
+
+const char * mix_name(int mix) {
+   switch( mix ) {
+      case MIX_ODOMETRY:
+         return "odometry";
+      case MIX_IMU:
+         return "imu";
+      case MIX_IMU_BATCH:
+         return "imu_batch";
+      case MIX_FIELD:
+         return "field";
+   }
+   return "unknown";
+}
+
+// fill in the payload of a packet of type, and append it to p
+template<class P> static void payload(P & p, char type, int seq) {
+   float t = seq * 0.01f;
+   switch( type ) {
+      case 'O': {
+         OdometryPacket o;
+         o.linear = 1.0f;
+         o.angular = 0.1f * sinf(t);
+         o.x = 10.0f * cosf(t);
+         o.y = 10.0f * sinf(t);
+         o.yaw = t;
+         o.bump = 0;
+         o.qcount = 12;
+         o.steer = 30;
+         o.write(p);
+         break;
+      }
+      case 'I': {
+         IdlePacket i;
+         i.idle = 40000 + seq;
+         i.i2c_failures = 0;
+         i.i2c_resets = 0;
+         i.write(p);
+         break;
+      }
+      case 'G': {
+         GpsPacket g;
+         g.lat = 37500000 + seq;
+         g.lon = -122000000 - seq;
+         g.altitude = 1500;
+         g.hdop_100 = 120;
+         g.speed_100 = 200;
+         g.course_100 = 9000;
+         g.write(p);
+         break;
+      }
+      case 'S': {
+         SonarPacket s;
+         s.index = seq % 5;
+         s.range = 40 + seq % 60;
+         s.write(p);
+         break;
+      }
+      case 'U': {
+         HeadingPacket h;
+         h.x = t;
+         h.y = 0.0f;
+         h.z = 0.0f;
+         h.write(p);
+         break;
+      }
+      case 'M': {
+         CompassPacket c;
+         c.x = 0.2f * cosf(t);
+         c.y = 0.2f * sinf(t);
+         c.z = -0.4f;
+         c.write(p);
+         break;
+      }
+      case 'V': {
+         RawImuPacket v;
+         v.gx = 0.01f;
+         v.gy = -0.01f;
+         v.gz = 0.1f * sinf(t);
+         v.ax = 0.1f;
+         v.ay = 0.0f;
+         v.az = 9.8f;
+         v.write(p);
+         break;
+      }
+      case 'W': {
+         // ten samples at 1kHz
+         ImuBatchPacket w;
+         w.n = 10;
+         w.tick = seq * 10;
+         w.gyro_scale = 0.001f;
+         w.accel_scale = 0.01f;
+         w.write(p);
+         for( int i=0; i<w.n; i++ ) {
+            ImuSample s;
+            s.dt = 1;
+            s.gx = 10;
+            s.gy = -10;
+            s.gz = 100 + i;
+            s.ax = 10;
+            s.ay = 0;
+            s.az = 980;
+            s.write(p);
+         }
+         break;
+      }
+      case 'H': {
+         HeartbeatPacket h;
+         h.tick = seq * 500;
+         h.write(p);
+         break;
+      }
+      case 'B': {
+         BatteryPacket b;
+         b.main = 180;
+         b.motor = 170;
+         b.write(p);
+         break;
+      }
+      case 'L': {
+         // append a goal
+         GoalPacket g;
+         g.operation = 1;
+         g.write(p);
+         GoalAppendPacket a;
+         a.lat = 37500000 + seq;
+         a.lon = -122000000;
+         a.write(p);
+         break;
+      }
+   }
+}
+
+void append_packet(std::string & s, char type, int version, int seq) {
+   char buf[FRAME_MAX];
+   OutPacket p(type, sizeof(buf), buf);
+   p.set_version(version);
+   p.reset();
+   payload(p, type, seq);
+   p.finish();
+   s.append(p.outbuf(), p.outsz());
+}
+
+std::string make_frame(char type, int version, int seq) {
+   std::string s;
+   append_packet(s, type, version, seq);
+   if( version == PROTOCOL_V2 ) {
+      return s.substr(V2_HEADER - 1, s.size() - V2_OVERHEAD + 1);
+   }
+   // drop the terminator
+   return s.substr(0, s.size() - 1);
+}
+
+// packets per cycle of the field mix: half a second, with raw IMU at
+// 100Hz, odometry and sonar at 20Hz, and everything else slower. A cycle
+// has to fit in the framer's queue
+static const struct {
+   char type;
+   int count;
+} field_mix[] = {
+   { 'V', 50 },
+   { 'O', 10 },
+   { 'S', 10 },
+   { 'M', 5 },
+   { 'U', 5 },
+   { 'G', 2 },
+   { 'H', 1 },
+   { 'I', 1 },
+   { 'B', 1 },
+};
+
+#define FIELD_TYPES (int)(sizeof(field_mix) / sizeof(field_mix[0]))
+
+std::string make_stream(int mix, int version, int & packets) {
+   std::string s;
+   packets = 0;
+   switch( mix ) {
+      case MIX_ODOMETRY:
+         for( ; packets<100; packets++ ) {
+            append_packet(s, 'O', version, packets);
+         }
+         break;
+      case MIX_IMU:
+         for( ; packets<100; packets++ ) {
+            append_packet(s, 'V', version, packets);
+         }
+         break;
+      case MIX_IMU_BATCH:
+         for( ; packets<10; packets++ ) {
+            append_packet(s, 'W', version, packets);
+         }
+         break;
+      case MIX_FIELD: {
+         // interleave the types, rather than sending them in bursts
+         int sent[FIELD_TYPES] = { 0 };
+         for( int slot=0; slot<50; slot++ ) {
+            for( int i=0; i<FIELD_TYPES; i++ ) {
+               if( sent[i] * 50 < field_mix[i].count * (slot + 1) ) {
+                  append_packet(s, field_mix[i].type, version, packets++);
+                  ++sent[i];
+               }
+            }
+         }
+         break;
+      }
+   }
+   return s;
+}
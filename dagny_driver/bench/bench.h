@@ -0,0 +1,44 @@
+/*
+ * Shared pieces of the driver microbenchmarks: allocation counting, the
+ * per-packet counters every benchmark reports, and synthetic packets and
+ * streams to feed through the driver.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+// calls to operator new so far in this process
+unsigned long allocations();
+
+// report ns/packet and allocs/packet for a benchmark that handled packets
+// packets in total and made allocs allocations doing so
+void report_packets(benchmark::State & state, unsigned long packets,
+      unsigned long allocs);
+
+// synthetic packet mixes, each one cycle of traffic
+enum Mix {
+   MIX_ODOMETRY,  // odometry only
+   MIX_IMU,       // one raw IMU packet per sample
+   MIX_IMU_BATCH, // batched raw IMU
+   MIX_FIELD,     // everything, at the rates seen in the field
+   MIX_COUNT
+};
+
+const char * mix_name(int mix);
+
+// append one packet of type to s, exactly as the AVR would send it.
+// seq varies the contents from packet to packet
+void append_packet(std::string & s, char type, int version, int seq);
+
+// one cycle of mix; packets is set to the number of packets in it
+std::string make_stream(int mix, int version, int & packets);
+
+// one packet of type as the framer hands it out: starting at the type
+// byte, without the framing or the CRC
+std::string make_frame(char type, int version, int seq);
+
+#endif
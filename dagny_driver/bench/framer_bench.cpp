@@ -0,0 +1,71 @@
+/*
+ * Framing benchmarks: synthetic streams written into a pipe and read back
+ * through the framer, the way the receive thread reads the serial port,
+ * with every frame popped and released as the publish thread would.
+ */
+
+#include <unistd.h>
+
+#include "bench.h"
+#include "framer.h"
+#include "protocol_v2.h"
+
+static void BM_Framer(benchmark::State & state) {
+   int mix = state.range(0);
+   int version = state.range(1);
+   state.SetLabel(mix_name(mix));
+
+   int per_stream;
+   std::string stream = make_stream(mix, version, per_stream);
+
+   int fds[2];
+   if( pipe(fds) < 0 ) {
+      state.SkipWithError("pipe failed");
+      return;
+   }
+
+   Framer framer;
+   framer.set_version(version);
+   Framer::Frame frame;
+
+   unsigned long packets = 0;
+   unsigned long allocs = 0;
+   for( auto _ : state ) {
+      // a cycle fits easily in the pipe; writing it isn't the framer's
+      // work, so don't time it
+      state.PauseTiming();
+      if( write(fds[1], stream.data(), stream.size()) !=
+            (ssize_t)stream.size() ) {
+         state.SkipWithError("pipe write failed");
+         break;
+      }
+      unsigned long start = allocations();
+      state.ResumeTiming();
+
+      size_t left = stream.size();
+      while( left > 0 ) {
+         int queued;
+         int cnt = framer.fill(fds[0], queued, 0.0);
+         if( cnt <= 0 ) {
+            break;
+         }
+         left -= cnt;
+         while( framer.pop(frame) ) {
+            benchmark::DoNotOptimize(frame.data[0]);
+            framer.release(frame);
+            ++packets;
+         }
+      }
+      allocs += allocations() - start;
+   }
+   if( framer.dropped() || framer.crc_errors() ) {
+      state.SkipWithError("framer dropped packets");
+   }
+   report_packets(state, packets, allocs);
+
+   close(fds[0]);
+   close(fds[1]);
+}
+BENCHMARK(BM_Framer)->ArgsProduct({
+      { MIX_ODOMETRY, MIX_IMU, MIX_IMU_BATCH, MIX_FIELD },
+      { 1, PROTOCOL_V2 } });
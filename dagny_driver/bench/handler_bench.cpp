@@ -0,0 +1,114 @@
+/*
+ * Handler benchmarks: one packet of each type at a time through the
+ * driver's dispatch table, including building its messages and publishing
+ * them to a local subscriber that never reads them.
+ *
+ * The driver publishes for real, so this needs a roscore. Everything goes
+ * under this node's private namespace, so it won't disturb a running
+ * robot. Set the protocol version with _protocol_version:=2
+ */
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+
+#include <geometry_msgs/Vector3Stamped.h>
+#include <nav_msgs/Odometry.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Range.h>
+#include <std_msgs/Bool.h>
+#include <std_msgs/Float32.h>
+#include <std_msgs/UInt8.h>
+
+#include <dagny_driver/Battery.h>
+#include <dagny_driver/Encoder.h>
+#include <dagny_driver/Goal.h>
+#include <dagny_driver/NavSatFix.h>
+
+#include "bench.h"
+#include "driver.h"
+
+static int protocol_version = 1;
+
+// the subscribers' callbacks pile up here; nothing ever calls them
+static ros::CallbackQueue queue;
+
+static void BM_Handler(benchmark::State & state) {
+   char type = state.range(0);
+   state.SetLabel(std::string(1, type));
+
+   std::string frame = make_frame(type, protocol_version, 1);
+   std::vector<char> buf(frame.begin(), frame.end());
+   double stamp = ros::Time::now().toSec();
+
+   unsigned long packets = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      driver_dispatch(&buf[0], buf.size(), stamp);
+      ++packets;
+      if( (packets & 1023) == 0 ) {
+         queue.clear();
+      }
+   }
+   report_packets(state, packets, allocations() - start);
+   queue.clear();
+}
+BENCHMARK(BM_Handler)->Arg('O')->Arg('I')->Arg('G')->Arg('S')->Arg('U')
+   ->Arg('M')->Arg('V')->Arg('W')->Arg('H')->Arg('B')->Arg('L');
+
+template<class M> static void ignore(const typename M::ConstPtr &) {
+}
+
+template<class M> static ros::Subscriber subscribe(ros::NodeHandle & n,
+      const std::string & topic) {
+   return n.subscribe<M>(topic, 1, ignore<M>);
+}
+
+int main(int argc, char ** argv) {
+   ros::init(argc, argv, "dagny_driver_bench",
+         ros::init_options::AnonymousName |
+         ros::init_options::NoSigintHandler);
+   benchmark::Initialize(&argc, argv);
+
+   if( !ros::master::check() ) {
+      fprintf(stderr, "The handler benchmarks need a roscore\n");
+      return 1;
+   }
+
+   ros::NodeHandle n("~");
+   n.param("protocol_version", protocol_version, 1);
+   if( !driver_start_offline(n, protocol_version) ) {
+      return 1;
+   }
+
+   // a subscriber on every topic, so that every handler builds and
+   // publishes its messages
+   ros::NodeHandle sn("~");
+   sn.setCallbackQueue(&queue);
+   std::vector<ros::Subscriber> subs;
+   subs.push_back(subscribe<nav_msgs::Odometry>(sn, "odom"));
+   subs.push_back(subscribe<dagny_driver::Encoder>(sn, "encoder"));
+   subs.push_back(subscribe<std_msgs::Bool>(sn, "bump"));
+   subs.push_back(subscribe<std_msgs::UInt8>(sn, "i2c_fail"));
+   subs.push_back(subscribe<dagny_driver::NavSatFix>(sn, "gps"));
+   subs.push_back(subscribe<sensor_msgs::Range>(sn, "sonar"));
+   subs.push_back(subscribe<sensor_msgs::PointCloud2>(sn,
+            "sonar_points"));
+   subs.push_back(subscribe<std_msgs::Float32>(sn, "heading"));
+   subs.push_back(subscribe<geometry_msgs::Vector3Stamped>(sn,
+            "magnetic"));
+   subs.push_back(subscribe<sensor_msgs::Imu>(sn, "imu"));
+   subs.push_back(subscribe<dagny_driver::Battery>(sn, "battery"));
+   subs.push_back(subscribe<dagny_driver::Goal>(sn, "goal_input"));
+
+   benchmark::RunSpecifiedBenchmarks();
+   benchmark::Shutdown();
+
+   subs.clear();
+   ros::shutdown();
+   return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Packet encode and decode benchmarks, for both protocol versions: an
+ * odometry packet built the way the AVR sends it, and decoded the way the
+ * handlers decode it, field by field and through its schema.
+ */
+
+#include "bench.h"
+#include "packets.h"
+#include "protocol_v2.h"
+
+static void BM_PacketEncode(benchmark::State & state) {
+   int version = state.range(0);
+   char buf[64];
+   OutPacket p('O', sizeof(buf), buf);
+   p.set_version(version);
+
+   OdometryPacket o;
+   memset(&o, 0, sizeof(o));
+   o.linear = 1.0f;
+   o.x = 10.0f;
+   o.qcount = 12;
+   o.steer = 30;
+
+   unsigned long packets = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      p.reset();
+      o.write(p);
+      p.finish();
+      benchmark::DoNotOptimize(buf);
+      ++packets;
+   }
+   report_packets(state, packets, allocations() - start);
+}
+BENCHMARK(BM_PacketEncode)->Arg(1)->Arg(PROTOCOL_V2);
+
+// decode the way the handlers used to, one read call per field
+template<class P> static void BM_PacketRead(benchmark::State & state) {
+   int version = state.range(0);
+   std::string frame = make_frame('O', version, 1);
+   std::vector<char> buf(frame.begin(), frame.end());
+
+   unsigned long packets = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      P p(&buf[0], buf.size());
+      OdometryPacket o;
+      o.read(p);
+      benchmark::DoNotOptimize(o);
+      ++packets;
+   }
+   report_packets(state, packets, allocations() - start);
+}
+BENCHMARK_TEMPLATE(BM_PacketRead, Packet)->Arg(1);
+BENCHMARK_TEMPLATE(BM_PacketRead, PacketV2)->Arg(PROTOCOL_V2);
+
+// version 2 payloads can also be unpacked in one go
+static void BM_PacketUnpack(benchmark::State & state) {
+   std::string frame = make_frame('O', PROTOCOL_V2, 1);
+   std::vector<char> buf(frame.begin(), frame.end());
+
+   unsigned long packets = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      PacketV2 p(&buf[0], buf.size());
+      OdometryPacket o;
+      const char * b = p.take(OdometryPacket::SIZE);
+      if( b ) {
+         o.unpack(b);
+      }
+      benchmark::DoNotOptimize(o);
+      ++packets;
+   }
+   report_packets(state, packets, allocations() - start);
+}
+BENCHMARK(BM_PacketUnpack);
@@ -0,0 +1,40 @@
+/*
+ * Steering conversion benchmarks, over the whole range of the servo in
+ * both directions and a matching spread of radii.
+ */
+
+#include "bench.h"
+#include "dagny_driver/steer.h"
+
+static void BM_Radius2Steer(benchmark::State & state) {
+   // evenly spread curvatures, from nearly straight to a tighter turn
+   // than the steering can manage
+   float radii[256];
+   for( int i=0; i<256; i++ ) {
+      radii[i] = 0.5f * 256 / (i + 1);
+   }
+
+   unsigned long conversions = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      for( int i=0; i<256; i++ ) {
+         benchmark::DoNotOptimize(radius2steer(radii[i]));
+      }
+      conversions += 256;
+   }
+   report_packets(state, conversions, allocations() - start);
+}
+BENCHMARK(BM_Radius2Steer);
+
+static void BM_Steer2Radius(benchmark::State & state) {
+   unsigned long conversions = 0;
+   unsigned long start = allocations();
+   for( auto _ : state ) {
+      for( int s=-128; s<128; s++ ) {
+         benchmark::DoNotOptimize(steer2radius(s));
+      }
+      conversions += 256;
+   }
+   report_packets(state, conversions, allocations() - start);
+}
+BENCHMARK(BM_Steer2Radius);
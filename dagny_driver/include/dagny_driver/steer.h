@@ -0,0 +1,31 @@
+/*
+ * Abstraction for steering mechanism; converts turning radius to steering
+ * setting and back.
+ *
+ * Both conversions are table lookups; the tables are built from the
+ * compiled-in calibration at startup, and can be rebuilt from a measured
+ * calibration with steer_calibrate().
+ *
+ * Author: Austin Hendrix
+ */
+
+#ifndef STEER_H
+#define STEER_H
+
+#include <stdint.h>
+
+// convert radius to positive steering setting
+int8_t radius2steer(float r);
+
+// convert steering setting (+ or -) to positive radius
+float steer2radius(int8_t s);
+
+// rebuild the lookup tables from a calibration: radii[i] is the turning
+// radius measured at steering setting i*step. Radii must be positive and
+// strictly decreasing. Returns false and keeps the current tables if the
+// calibration is unusable.
+//
+// Not thread safe; call before anything converts steering settings.
+bool steer_calibrate(const float * radii, int n, int step);
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ * Implementation of the simulated AVR from avr_sim.h
+ */
+
+#include "avr_sim.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "dagny_driver/steer.h"
+
+#include "packets.h"
+#include "protocol_v2.h"
+
+// room for the largest packet we send, even fully escaped
+#define SIM_FRAME_MAX 512
+// most samples in one 'W'; the driver drops bigger batches
+#define SIM_BATCH_MAX 16
+// a stream that falls further behind than this skips ahead instead of
+// sending the backlog all at once
+#define SIM_MAX_LAG 0.1
+
+// goal appends from the robot; Goal.msg APPEND
+#define SIM_GOAL_APPEND 1
+
+// meters per degree of latitude
+#define METERS_PER_DEGREE 111320.0
+
+static const char stream_types[SIM_STREAMS] = {
+   'O', 'V', 'M', 'S', 'G', 'B', 'I', 'L'
+};
+
+// the same single length check the driver makes (see DagnyLink::decode);
+// v1 frames are unescaped first, as in DagnyLink::dispatch
+template<class S> static bool decode(PacketV2 & p, S & s) {
+   const char * b = p.take(S::SIZE);
+   if( !b ) {
+      return false;
+   }
+   s.unpack(b);
+   return true;
+}
+
+// rates roughly as the real board sends them
+AvrSimConfig::AvrSimConfig() : version(1), time_sync(false),
+   tick_rate(1000.0), rate_scale(1.0), imu_batch(0), sonars(5),
+   meters_per_count(0.08), latitude(37.0), longitude(-122.0) {
+   rate[SIM_ODOMETRY] = 20.0;
+   rate[SIM_IMU] = 100.0;
+   rate[SIM_COMPASS] = 20.0;
+   rate[SIM_SONAR] = 4.0;
+   rate[SIM_GPS] = 1.0;
+   rate[SIM_BATTERY] = 1.0;
+   rate[SIM_IDLE] = 1.0;
+   rate[SIM_GOAL] = 0.0;
+}
+
+AvrSim::AvrSim() {
+   configure(AvrSimConfig(), 0.0);
+}
+
+void AvrSim::configure(const AvrSimConfig & config, double now) {
+   config_ = config;
+   if( config_.imu_batch > SIM_BATCH_MAX ) {
+      config_.imu_batch = SIM_BATCH_MAX;
+   }
+   if( config_.sonars < 1 ) {
+      config_.sonars = 1;
+   }
+   start_ = now;
+   for( int i=0; i<SIM_STREAMS; i++ ) {
+      double r = config_.rate[i] * config_.rate_scale;
+      if( i == SIM_IMU && config_.imu_batch > 0 ) {
+         r /= config_.imu_batch;
+      } else if( i == SIM_SONAR ) {
+         r *= config_.sonars;
+      }
+      period_[i] = r > 0.0 ? 1.0 / r : 0.0;
+      due_[i] = now + period_[i];
+      seq_[i] = 0;
+   }
+
+   speed_ = 0;
+   steer_ = 0;
+   last_t_ = now;
+   linear_ = 0.0;
+   angular_ = 0.0;
+   x_ = 0.0;
+   y_ = 0.0;
+   yaw_ = 0.0;
+   counts_ = 0.0;
+   goal_version_ = 0;
+
+   memset(sent_, 0, sizeof(sent_));
+   memset(received_, 0, sizeof(received_));
+   packets_sent_ = 0;
+   bytes_sent_ = 0;
+   bad_packets_ = 0;
+
+   replies_.clear();
+   ready();
+}
+
+void AvrSim::ready() {
+   char buf[SIM_FRAME_MAX];
+   OutPacket p('R', sizeof(buf), buf);
+   p.set_version(config_.version);
+   p.reset();
+   // the driver's framer skips version 1 frames that are only a type
+   if( config_.version != PROTOCOL_V2 ) {
+      p.append((uint8_t)0);
+   }
+   p.finish();
+   append(replies_, p);
+}
+
+uint32_t AvrSim::tick(double t) const {
+   return (uint32_t)(int64_t)((t - start_) * config_.tick_rate);
+}
+
+void AvrSim::append(std::string & out, OutPacket & p) {
+   out.append(p.outbuf(), p.outsz());
+   ++sent_[(uint8_t)p.outbuf()[config_.version == PROTOCOL_V2 ?
+      V2_HEADER - 1 : 0]];
+   ++packets_sent_;
+   bytes_sent_ += p.outsz();
+}
+
+void AvrSim::advance(double now) {
+   double dt = now - last_t_;
+   if( dt <= 0.0 ) {
+      return;
+   }
+   last_t_ = now;
+
+   // speed in 0.08 m/s, steering negative to the left; the inverse of the
+   // conversion in the driver's cmd_vel callback
+   linear_ = speed_ * 0.08;
+   angular_ = 0.0;
+   if( steer_ != 0 ) {
+      angular_ = linear_ / steer2radius(steer_);
+      if( steer_ > 0 ) {
+         angular_ = -angular_;
+      }
+   }
+   double heading = yaw_ + angular_ * dt / 2.0;
+   x_ += linear_ * dt * cos(heading);
+   y_ += linear_ * dt * sin(heading);
+   yaw_ = remainder(yaw_ + angular_ * dt, 2.0 * M_PI);
+   counts_ += linear_ * dt / config_.meters_per_count;
+}
+
+double AvrSim::next_due() const {
+   double next = 0.0;
+   bool any = false;
+   for( int i=0; i<SIM_STREAMS; i++ ) {
+      if( period_[i] > 0.0 && (!any || due_[i] < next) ) {
+         next = due_[i];
+         any = true;
+      }
+   }
+   return any ? next : last_t_ + 1.0;
+}
+
+int AvrSim::step(double now, std::string & out) {
+   unsigned long before = packets_sent_;
+   out.append(replies_);
+   replies_.clear();
+
+   advance(now);
+   // oldest first, so that the streams interleave as they would on the
+   // wire
+   while( true ) {
+      int next = -1;
+      for( int i=0; i<SIM_STREAMS; i++ ) {
+         if( period_[i] > 0.0 && due_[i] <= now &&
+               (next < 0 || due_[i] < due_[next]) ) {
+            next = i;
+         }
+      }
+      if( next < 0 ) {
+         break;
+      }
+      send(out, next, due_[next]);
+      ++seq_[next];
+      due_[next] += period_[next];
+      if( now - due_[next] > SIM_MAX_LAG ) {
+         due_[next] = now + period_[next];
+      }
+   }
+   return packets_sent_ - before;
+}
+
+void AvrSim::send(std::string & out, int stream, double t) {
+   char type = stream_types[stream];
+   if( stream == SIM_IMU && config_.imu_batch > 0 ) {
+      type = 'W';
+   }
+   char buf[SIM_FRAME_MAX];
+   OutPacket p(type, sizeof(buf), buf);
+   p.set_version(config_.version);
+   p.reset();
+   payload(p, stream, t);
+   p.finish();
+   append(out, p);
+}
+
+void AvrSim::payload(OutPacket & p, int stream, double t) {
+   unsigned long seq = seq_[stream];
+   switch( stream ) {
+      case SIM_ODOMETRY: {
+         OdometryPacket o;
+         o.linear = linear_;
+         o.angular = angular_;
+         o.x = x_;
+         o.y = y_;
+         o.yaw = yaw_;
+         o.bump = 0;
+         o.qcount = (int16_t)counts_;
+         o.steer = steer_;
+         counts_ -= o.qcount;
+         o.write(p);
+         if( config_.time_sync ) {
+            p.append(tick(t));
+         }
+         break;
+      }
+      case SIM_IMU: {
+         // still, level, and turning at the model's rate. Like the real
+         // board, a level accelerometer reads -g on z
+         if( config_.imu_batch == 0 ) {
+            RawImuPacket v;
+            v.gx = 0.0f;
+            v.gy = 0.0f;
+            v.gz = angular_;
+            v.ax = 0.0f;
+            v.ay = 0.0f;
+            v.az = -9.81f;
+            v.write(p);
+            if( config_.time_sync ) {
+               p.append(tick(t));
+            }
+            break;
+         }
+         double sample_ticks = config_.tick_rate * period_[stream] /
+            config_.imu_batch;
+         if( sample_ticks < 1.0 ) {
+            sample_ticks = 1.0;
+         } else if( sample_ticks > 255.0 ) {
+            sample_ticks = 255.0;
+         }
+         ImuBatchPacket w;
+         w.n = config_.imu_batch;
+         w.gyro_scale = 0.001f;
+         w.accel_scale = 0.01f;
+         w.tick = tick(t) - (uint32_t)sample_ticks * w.n;
+         w.write(p);
+         for( int i=0; i<w.n; i++ ) {
+            ImuSample s;
+            s.dt = (uint8_t)sample_ticks;
+            s.gx = 0;
+            s.gy = 0;
+            s.gz = (int16_t)lrint(angular_ / w.gyro_scale);
+            s.ax = 0;
+            s.ay = 0;
+            s.az = (int16_t)lrint(-9.81 / w.accel_scale);
+            s.write(p);
+         }
+         break;
+      }
+      case SIM_COMPASS: {
+         // the driver takes atan2(x, y) as the heading
+         CompassPacket m;
+         m.x = 0.2f * sin(yaw_);
+         m.y = 0.2f * cos(yaw_);
+         m.z = -0.4f;
+         m.write(p);
+         if( config_.time_sync ) {
+            p.append(tick(t));
+         }
+         break;
+      }
+      case SIM_SONAR: {
+         // a slowly changing pattern, with each sonar seeing something
+         // at a different distance
+         SonarPacket s;
+         s.index = seq % config_.sonars;
+         s.range = 30 + (seq / config_.sonars * 3 + s.index * 17) % 90;
+         s.write(p);
+         break;
+      }
+      case SIM_GPS: {
+         // course is clockwise from north
+         double lat = config_.latitude + y_ / METERS_PER_DEGREE;
+         double lon = config_.longitude + x_ /
+            (METERS_PER_DEGREE * cos(config_.latitude * M_PI / 180.0));
+         double course = 90.0 - yaw_ * 180.0 / M_PI;
+         if( course < 0.0 ) {
+            course += 360.0;
+         }
+         GpsPacket g;
+         g.lat = lrint(lat * 1000000.0);
+         g.lon = lrint(lon * 1000000.0);
+         g.altitude = 1500;
+         g.hdop_100 = 120;
+         g.speed_100 = lrint(fabs(linear_) * 194.384);
+         g.course_100 = lrint(course * 100.0);
+         g.write(p);
+         break;
+      }
+      case SIM_BATTERY: {
+         BatteryPacket b;
+         b.main = 80;
+         b.motor = 78;
+         b.write(p);
+         break;
+      }
+      case SIM_IDLE: {
+         IdlePacket i;
+         i.idle = 20000;
+         i.i2c_failures = 0;
+         i.i2c_resets = 0;
+         i.write(p);
+         break;
+      }
+      case SIM_GOAL: {
+         // a goal a little ahead of where the robot is. The AVR applies
+         // its own edits, so this counts as a version of its list
+         ++goal_version_;
+         GoalPacket op;
+         op.operation = SIM_GOAL_APPEND;
+         op.write(p);
+         GoalAppendPacket a;
+         a.lat = lrint((config_.latitude + (y_ + 10.0) / METERS_PER_DEGREE)
+               * 1000000.0);
+         a.lon = lrint(config_.longitude * 1000000.0) + seq;
+         a.write(p);
+         break;
+      }
+   }
+}
+
+void AvrSim::receive(char * data, int sz, double now) {
+   char type = data[0];
+   ++received_[(uint8_t)type];
+   advance(now);
+   char unescaped[SIM_FRAME_MAX];
+   if( config_.version != PROTOCOL_V2 ) {
+      sz = v1_unescape(data, sz, unescaped, sizeof(unescaped));
+      data = unescaped;
+   }
+   PacketV2 p(data, sz);
+   handle(p, type, now);
+}
+
+void AvrSim::handle(PacketV2 & p, char type, double now) {
+   char buf[SIM_FRAME_MAX];
+   switch( type ) {
+      case 'C': {
+         // int16_t speed, int8_t steer
+         if( p.outsz() - 1 < 3 ) {
+            ++bad_packets_;
+            return;
+         }
+         speed_ = p.reads16();
+         steer_ = p.reads8();
+         break;
+      }
+      case 'H': {
+         OutPacket reply('H', sizeof(buf), buf);
+         reply.set_version(config_.version);
+         reply.reset();
+         HeartbeatPacket h;
+         h.tick = tick(now);
+         h.write(reply);
+         reply.finish();
+         append(replies_, reply);
+         break;
+      }
+      case 'N': {
+         // take whatever rate the driver asks for; a pty doesn't care, and
+         // the driver only asks for rates it can set
+         if( p.outsz() - 1 < 4 ) {
+            ++bad_packets_;
+            return;
+         }
+         uint32_t rate = p.readu32();
+         OutPacket reply('N', sizeof(buf), buf);
+         reply.set_version(config_.version);
+         reply.reset();
+         reply.append(rate);
+         reply.finish();
+         append(replies_, reply);
+         ready();
+         break;
+      }
+      case 'L': {
+         // apply a batch if it's against the version we have, and ack
+         // with the version we have afterwards. The goals themselves
+         // aren't kept
+         GoalPacket op;
+         GoalBatchPacket batch;
+         if( !decode(p, op) || op.operation != GOAL_BATCH ||
+               !decode(p, batch) ) {
+            ++bad_packets_;
+            return;
+         }
+         if( batch.flags & GOAL_RESET ) {
+            goal_version_ = batch.base;
+         }
+         if( batch.base == goal_version_ ) {
+            goal_version_ += batch.n;
+         }
+         OutPacket reply('L', sizeof(buf), buf);
+         reply.set_version(config_.version);
+         reply.reset();
+         GoalPacket ack_op;
+         ack_op.operation = GOAL_ACK;
+         ack_op.write(reply);
+         GoalAckPacket ack;
+         ack.version = goal_version_;
+         ack.flags = batch.flags & GOAL_RESET;
+         ack.write(reply);
+         reply.finish();
+         append(replies_, reply);
+         break;
+      }
+      default:
+         // calibration, steering offset and laser summaries are only
+         // counted
+         break;
+   }
+}
@@ -0,0 +1,138 @@
+/*
+ * Simulated AVR: produces the packet stream the real board sends, and
+ * answers the packets the driver sends to it, so that the driver can be
+ * run and load tested without the robot.
+ *
+ * Each sensor stream goes out at its own configurable rate, which can be
+ * set well past what the real hardware manages. Drive commands are
+ * followed through a simple vehicle model, using the same steering
+ * calibration as the driver (steer.h), so odometry, the gyro, the compass
+ * and GPS all agree with what the robot was told to do.
+ *
+ * Knows nothing about the transport; the caller feeds in framed packets
+ * from the driver and writes out the bytes it is handed. Not thread-safe.
+ */
+
+#ifndef AVR_SIM_H
+#define AVR_SIM_H
+
+#include <stdint.h>
+
+#include <string>
+
+class OutPacket;
+class PacketV2;
+
+// streams the simulated AVR sends on its own
+enum SimStream {
+   SIM_ODOMETRY, // 'O'
+   SIM_IMU,      // 'V', or 'W' when batched; the rate is in samples
+   SIM_COMPASS,  // 'M'
+   SIM_SONAR,    // 'S'; the rate is for each sonar
+   SIM_GPS,      // 'G'
+   SIM_BATTERY,  // 'B'
+   SIM_IDLE,     // 'I'
+   SIM_GOAL,     // 'L' goal appends, as if entered on the robot
+   SIM_STREAMS
+};
+
+struct AvrSimConfig {
+   int version;            // protocol version; 1 or 2
+   bool time_sync;         // append the tick count to 'O', 'V' and 'M'
+   double tick_rate;       // AVR ticks per second
+   double rate[SIM_STREAMS]; // packets per second; 0 turns a stream off
+   double rate_scale;      // multiplies every rate, for load tests
+   int imu_batch;          // samples per 'W' packet, or 0 to send 'V'
+   int sonars;
+   double meters_per_count; // wheel encoder resolution
+   double latitude;        // GPS position of the odometry origin
+   double longitude;
+
+   AvrSimConfig();
+};
+
+class AvrSim {
+   public:
+      AvrSim();
+
+      // start over at time now, as the firmware does at power up; the
+      // first thing sent is a ready packet
+      void configure(const AvrSimConfig & config, double now);
+
+      // handle one complete frame from the driver, as the framer hands it
+      // out: starting at the type byte, without the framing
+      void receive(char * data, int sz, double now);
+
+      // append to out everything that is due by now: replies first, then
+      // any stream packets. Returns the number of stream packets appended
+      int step(double now, std::string & out);
+
+      // when the next stream packet is due
+      double next_due() const;
+
+      // vehicle state
+      double linear() const { return linear_; }
+      double angular() const { return angular_; }
+      double x() const { return x_; }
+      double y() const { return y_; }
+      double yaw() const { return yaw_; }
+
+      // packets and bytes sent, and packets received from the driver
+      unsigned long sent(char type) const { return sent_[(uint8_t)type]; }
+      unsigned long received(char type) const {
+         return received_[(uint8_t)type];
+      }
+      unsigned long packets_sent() const { return packets_sent_; }
+      unsigned long bytes_sent() const { return bytes_sent_; }
+      unsigned long commands() const { return received_[(uint8_t)'C']; }
+      // frames from the driver that were too short to decode
+      unsigned long bad_packets() const { return bad_packets_; }
+
+   private:
+      // move the vehicle model up to now
+      void advance(double now);
+      uint32_t tick(double t) const;
+      // queue a ready packet
+      void ready();
+
+      // build and append the next packet of stream to out
+      void send(std::string & out, int stream, double t);
+      void payload(OutPacket & p, int stream, double t);
+      // append a finished packet to out, and count it
+      void append(std::string & out, OutPacket & p);
+
+      void handle(PacketV2 & p, char type, double now);
+
+      AvrSimConfig config_;
+      double start_;
+      double period_[SIM_STREAMS];
+      double due_[SIM_STREAMS];
+      unsigned long seq_[SIM_STREAMS];
+
+      // replies waiting to go out, in order
+      std::string replies_;
+
+      // last drive command
+      int16_t speed_;
+      int8_t steer_;
+
+      double last_t_;
+      double linear_;
+      double angular_;
+      double x_;
+      double y_;
+      double yaw_;
+      // encoder counts not yet sent, and the fraction of a count travelled
+      double counts_;
+
+      // version of the goal list the AVR has
+      uint16_t goal_version_;
+
+      unsigned long sent_[256];
+      unsigned long received_[256];
+      unsigned long packets_sent_;
+      unsigned long bytes_sent_;
+      unsigned long bad_packets_;
+};
+
+#endif
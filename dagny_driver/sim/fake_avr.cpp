@@ -0,0 +1,288 @@
+/*
+ * fake_avr.cpp
+ *
+ * Simulated AVR on a pseudo-terminal, for running the driver without the
+ * robot and for load testing it (see avr_sim.h). The pty's slave side is
+ * linked at ~port; point the driver's port parameter at the same path.
+ *
+ * Parameters, all private:
+ *   port               where to link the pty (/tmp/dagny_avr)
+ *   protocol_version, time_sync, avr_tick_rate, odom_meters_per_count
+ *                      as for the driver; they must match it
+ *   rate_scale         multiplies every stream rate (1.0)
+ *   odometry_rate, imu_rate, compass_rate, sonar_rate, gps_rate,
+ *   battery_rate, idle_rate, goal_rate
+ *                      packets per second for each stream; imu_rate is in
+ *                      samples, and sonar_rate is for each sonar
+ *   imu_batch          samples per 'W' packet; 0 sends one 'V' per sample
+ *   sonars             number of sonars (5)
+ *   latitude, longitude
+ *                      GPS position of the odometry origin
+ *   backlog            bytes the driver may fall behind by before stream
+ *                      packets are dropped (65536)
+ *   report_period      seconds between throughput reports (5.0)
+ *
+ * The steering calibration (steering_radius and steering_step) is read
+ * from the same public parameters as the driver's, so that the vehicle
+ * model turns the way the driver expects it to.
+ *
+ * The reports give the rate that was offered to the driver and how much
+ * of it didn't fit in the link; compare them with the driver's link_stats
+ * and diagnostics to see how much it kept up with.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include "dagny_driver/steer.h"
+
+#include "avr_sim.h"
+#include "framer.h"
+#include "protocol_v2.h"
+
+#define ROS_PERROR(str) ROS_ERROR("%s: %s", str, strerror(errno))
+
+// set up a pty for raw binary data, and link its slave side at port.
+// Returns the master, or -1. slave is left open, so that the master
+// doesn't see a hangup whenever the driver closes the port
+static int pty_open(const std::string & port, int & slave) {
+   int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if( master < 0 ) {
+      ROS_PERROR("posix_openpt");
+      return -1;
+   }
+   const char * name = 0;
+   if( grantpt(master) < 0 || unlockpt(master) < 0 ||
+         !(name = ptsname(master)) ) {
+      ROS_PERROR("Failed to set up pty");
+      close(master);
+      return -1;
+   }
+
+   slave = open(name, O_RDWR | O_NOCTTY);
+   struct termios t;
+   if( slave < 0 || tcgetattr(slave, &t) < 0 ) {
+      ROS_PERROR("Failed to open pty slave");
+      close(master);
+      return -1;
+   }
+   // no line discipline; '\r' in particular has to get through untouched
+   cfmakeraw(&t);
+   tcsetattr(slave, TCSANOW, &t);
+
+   // only ever replace a link, never a real port or file
+   struct stat st;
+   if( lstat(port.c_str(), &st) == 0 ) {
+      if( !S_ISLNK(st.st_mode) ) {
+         ROS_ERROR("%s exists and isn't a link; not replacing it",
+               port.c_str());
+         close(slave);
+         close(master);
+         return -1;
+      }
+      unlink(port.c_str());
+   }
+   if( symlink(name, port.c_str()) < 0 ) {
+      ROS_ERROR("Failed to link %s to %s: %s", port.c_str(), name,
+            strerror(errno));
+      close(slave);
+      close(master);
+      return -1;
+   }
+   return master;
+}
+
+// the driver's steering calibration, if there is one; see steering_setup()
+// in hardware_interface.cpp
+static void steering_setup(ros::NodeHandle & n) {
+   std::vector<double> radius;
+   if( !n.getParam("steering_radius", radius) ) {
+      return;
+   }
+   int step;
+   n.param("steering_step", step, 10);
+   std::vector<float> r(radius.begin(), radius.end());
+   if( r.empty() || !steer_calibrate(&r[0], r.size(), step) ) {
+      ROS_ERROR("Bad steering calibration; using built-in table");
+   }
+}
+
+// split version 1 frames from the driver out of data. The framer skips
+// frames that are only a type byte, as the driver always has, but that's
+// all the driver's heartbeats are. line holds a partial frame between
+// calls
+static void receive_v1(AvrSim & sim, std::string & line, const char * data,
+      int sz, double now) {
+   for( int i=0; i<sz; i++ ) {
+      if( data[i] != '\r' ) {
+         if( line.size() < FRAME_MAX ) {
+            line.push_back(data[i]);
+         }
+         continue;
+      }
+      if( !line.empty() ) {
+         sim.receive(&line[0], line.size(), now);
+      }
+      line.clear();
+   }
+}
+
+int main(int argc, char ** argv) {
+   ros::init(argc, argv, "fake_avr");
+
+   ros::NodeHandle n;
+   ros::NodeHandle pn("~");
+
+   steering_setup(n);
+
+   AvrSimConfig config;
+   std::string port;
+   pn.param<std::string>("port", port, "/tmp/dagny_avr");
+   pn.param("protocol_version", config.version, 1);
+   if( config.version != 1 && config.version != 2 ) {
+      ROS_FATAL("Unknown protocol version %d", config.version);
+      return 1;
+   }
+   pn.param("time_sync", config.time_sync, false);
+   pn.param("avr_tick_rate", config.tick_rate, 1000.0);
+   pn.param("odom_meters_per_count", config.meters_per_count, 0.08);
+   pn.param("rate_scale", config.rate_scale, 1.0);
+
+   static const char * rate_names[SIM_STREAMS] = {
+      "odometry_rate", "imu_rate", "compass_rate", "sonar_rate", "gps_rate",
+      "battery_rate", "idle_rate", "goal_rate"
+   };
+   for( int i=0; i<SIM_STREAMS; i++ ) {
+      pn.param(rate_names[i], config.rate[i], config.rate[i]);
+   }
+   pn.param("imu_batch", config.imu_batch, 0);
+   pn.param("sonars", config.sonars, 5);
+   pn.param("latitude", config.latitude, config.latitude);
+   pn.param("longitude", config.longitude, config.longitude);
+
+   int backlog;
+   double report_period;
+   pn.param("backlog", backlog, 65536);
+   pn.param("report_period", report_period, 5.0);
+
+   int slave = -1;
+   int master = pty_open(port, slave);
+   if( master < 0 ) {
+      return 1;
+   }
+
+   Framer framer;
+   framer.set_version(config.version);
+   std::string line;
+
+   AvrSim sim;
+   double now = ros::WallTime::now().toSec();
+   sim.configure(config, now);
+   ROS_INFO("Simulated AVR on %s, protocol version %d, rates x%g",
+         port.c_str(), config.version, config.rate_scale);
+
+   // bytes waiting for the pty, and what didn't fit
+   std::string pending;
+   std::string scratch;
+   unsigned long dropped_packets = 0;
+   unsigned long dropped_bytes = 0;
+
+   double last_report = now;
+   unsigned long last_packets = 0;
+   unsigned long last_bytes = 0;
+   unsigned long last_dropped = 0;
+   unsigned long last_commands = 0;
+
+   while( ros::ok() ) {
+      now = ros::WallTime::now().toSec();
+      int timeout = (int)((sim.next_due() - now) * 1000.0);
+      if( timeout < 0 ) {
+         timeout = 0;
+      }
+      if( timeout > 100 ) {
+         timeout = 100;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = master;
+      pfd.events = POLLIN;
+      if( !pending.empty() ) {
+         pfd.events |= POLLOUT;
+      }
+      if( poll(&pfd, 1, timeout) < 0 && errno != EINTR ) {
+         ROS_PERROR("poll");
+         break;
+      }
+      now = ros::WallTime::now().toSec();
+
+      if( (pfd.revents & POLLIN) && config.version == PROTOCOL_V2 ) {
+         int queued = 0;
+         framer.fill(master, queued, now);
+         Framer::Frame frame;
+         while( framer.pop(frame) ) {
+            sim.receive(frame.data, frame.sz, frame.stamp);
+            framer.release(frame);
+         }
+      } else if( pfd.revents & POLLIN ) {
+         char buf[256];
+         ssize_t r = read(master, buf, sizeof(buf));
+         if( r > 0 ) {
+            receive_v1(sim, line, buf, r, now);
+         }
+      }
+
+      // once the driver is too far behind, drop what it can't take, as
+      // a saturated serial port would
+      if( (int)pending.size() < backlog ) {
+         sim.step(now, pending);
+      } else {
+         scratch.clear();
+         dropped_packets += sim.step(now, scratch);
+         dropped_bytes += scratch.size();
+      }
+
+      if( pfd.revents & POLLOUT ) {
+         ssize_t w = write(master, pending.data(), pending.size());
+         if( w > 0 ) {
+            pending.erase(0, w);
+         } else if( w < 0 && errno != EAGAIN && errno != EINTR ) {
+            ROS_PERROR("pty write");
+            break;
+         }
+      }
+
+      if( now - last_report >= report_period ) {
+         double dt = now - last_report;
+         unsigned long packets = sim.packets_sent();
+         unsigned long bytes = sim.bytes_sent();
+         ROS_INFO("Offered %.0f packets/s, %.0f bytes/s; dropped %.0f "
+               "packets/s (%lu bytes in all); %.1f commands/s; at (%.2f, "
+               "%.2f, %.2f) moving %.2f m/s, %.2f rad/s",
+               (packets - last_packets) / dt, (bytes - last_bytes) / dt,
+               (dropped_packets - last_dropped) / dt, dropped_bytes,
+               (sim.commands() - last_commands) / dt, sim.x(), sim.y(),
+               sim.yaw(), sim.linear(), sim.angular());
+         last_report = now;
+         last_packets = packets;
+         last_bytes = bytes;
+         last_dropped = dropped_packets;
+         last_commands = sim.commands();
+      }
+   }
+
+   unlink(port.c_str());
+   close(slave);
+   close(master);
+   return 0;
+}
@@ -0,0 +1,845 @@
+/*
+ * Implementation of the serial link to one AVR board, from dagny_link.h
+ */
+
+#include "dagny_link.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+#include <dagny_driver/LinkStats.h>
+
+#include <boost/bind.hpp>
+
+#include "packets.h"
+#include "serial_port.h"
+
+#define ROS_PERROR(str) ROS_ERROR("%s: %s", str, strerror(errno))
+
+DagnyLink::DagnyLink(const std::string & name) : name_(name), serial_(-1),
+   protocol_version_(1), time_sync_enabled_(false), tick_period_(0.001),
+   heartbeat_packet_('H', sizeof(heartbeat_buf_), heartbeat_buf_),
+   skipped_packets_(0), short_packets_(0), unknown_sample_sz_(0),
+   unknown_sample_len_(0), bandwidth_(0), rx_event_(-1), replaying_(false),
+   replay_rate_(1.0), replay_fd_(-1), running_(false),
+   failed_(false) {
+   memset(unknown_packets_, 0, sizeof(unknown_packets_));
+   memset(last_unknown_packets_, 0, sizeof(last_unknown_packets_));
+   for( int i=0; i<256; i++ ) {
+      set_handler(i, unknown_h<PacketV2>);
+   }
+   set_handler('H', heartbeat_h<PacketV2>);
+}
+
+DagnyLink::~DagnyLink() {
+   stop();
+}
+
+void DagnyLink::set_handler(int type, handler_ptr handle) {
+   PacketHandler & h = handlers_[type];
+   h.handle = handle;
+   h.n_feeds = 0;
+   h.min_size = 0;
+   h.skip = 0;
+}
+
+void DagnyLink::add_feed(int type, TopicPublisher & pub) {
+   PacketHandler & h = handlers_[type];
+   if( h.n_feeds < HANDLER_FEEDS ) {
+      h.feeds[h.n_feeds++] = &pub;
+   }
+}
+
+void DagnyLink::set_min_size(int type, int size) {
+   handlers_[type].min_size = size;
+}
+
+void DagnyLink::set_skip(int type, void (*skip)(DagnyLink & link)) {
+   handlers_[type].skip = skip;
+}
+
+bool DagnyLink::write(TxClass c, const char * buf, int sz) {
+   if( failed_ ) {
+      return false;
+   }
+   return tx_queue_.push(c, frame_type(buf, protocol_version_), buf, sz);
+}
+
+// after a baud glitch the link can be nothing but garbage, so this just
+// counts, and the diagnostics do the reporting
+template<class P> void DagnyLink::unknown_h(DagnyLink & link, P & p) {
+   const char * in = p.outbuf();
+   int l = p.outsz();
+   ++link.unknown_packets_[(unsigned char)in[0]];
+
+   // never wait for the diagnostics; if they're reading the sample, keep
+   // the old one
+   boost::mutex::scoped_try_lock lock(link.unknown_mutex_);
+   if( lock.owns_lock() ) {
+      link.unknown_sample_len_ = l;
+      link.unknown_sample_sz_ = l < UNKNOWN_SAMPLE ? l : UNKNOWN_SAMPLE;
+      memcpy(link.unknown_sample_, in, link.unknown_sample_sz_);
+   }
+}
+
+template<class P> void DagnyLink::heartbeat_h(DagnyLink & link, P & p) {
+   HeartbeatPacket h;
+   if( !link.decode(p, h) ) {
+      return;
+   }
+   link.time_sync_.heartbeat_reply(h.tick, link.packet_time_.toSec());
+}
+
+// does anyone want the data from this packet type?
+bool DagnyLink::handler_wanted(const PacketHandler & h) {
+   if( h.n_feeds == 0 ) {
+      return true;
+   }
+   for( int i=0; i<h.n_feeds; i++ ) {
+      if( h.feeds[i]->subscribed() ) {
+         return true;
+      }
+   }
+   return false;
+}
+
+void DagnyLink::dispatch(char * data, int sz, double stamp) {
+   packet_time_ = ros::Time(stamp);
+   if( protocol_version_ != PROTOCOL_V2 ) {
+      sz = v1_unescape(data, sz, unescaped_, sizeof(unescaped_));
+      data = unescaped_;
+   }
+   const PacketHandler & h = handlers_[(unsigned char)data[0]];
+   if( !handler_wanted(h) ) {
+      ++skipped_packets_;
+      link_stats_.skipped(data[0]);
+      if( sz - 1 < h.min_size ) {
+         ++short_packets_;
+      } else if( h.skip ) {
+         h.skip(*this);
+      }
+   } else {
+      ros::WallTime start = ros::WallTime::now();
+      PacketV2 p(data, sz);
+      h.handle(*this, p);
+      double handler_time = (ros::WallTime::now() - start).toSec();
+      link_stats_.packet(data[0], handler_time,
+            ros::Time::now().toSec() - stamp);
+   }
+}
+
+// receive thread: read from the serial port and split the stream into
+// packets. This does no ROS work, so that a slow publish can never cause us
+// to fall behind the AVR
+void DagnyLink::rx_thread() {
+   struct pollfd pfd;
+   pfd.fd = serial_;
+   pfd.events = POLLIN;
+
+   while( running_ && ros::ok() ) {
+      // wake up as soon as there is serial data; the timeout is only so that
+      // we notice shutdown
+      int r = poll(&pfd, 1, 100);
+      if( r < 0 ) {
+         if( errno != EINTR ) {
+            ROS_PERROR("poll");
+         }
+         continue;
+      }
+      if( r == 0 ) {
+         continue;
+      }
+      if( pfd.revents & (POLLERR | POLLHUP | POLLNVAL) ) {
+         // we can't recover from this, but the other links can carry on
+         // without this one
+         ROS_ERROR("Serial port error on link %s; stopping it",
+               name_.c_str());
+         failed_ = true;
+         break;
+      }
+
+      int queued = 0;
+      double now = ros::Time::now().toSec();
+      int cnt = framer_.fill(serial_, queued, now);
+      if( cnt > 0 ) {
+         link_stats_.rx(cnt);
+         if( capture_.is_open() ) {
+            capture_.data(framer_.last_read(), cnt, now);
+         }
+      } else if( cnt == 0 ) {
+         // the ring is full; give the publisher thread a chance to catch up
+         usleep(1000);
+      }
+
+      if( queued ) {
+         uint64_t n = queued;
+         if( ::write(rx_event_, &n, sizeof(n)) != sizeof(n) ) {
+            ROS_PERROR("Failed to wake publisher thread");
+         }
+      }
+   }
+}
+
+// publisher thread: decode framed packets and publish them
+void DagnyLink::publish_thread() {
+   Framer::Frame frame;
+
+   struct pollfd pfd;
+   pfd.fd = rx_event_;
+   pfd.events = POLLIN;
+
+   while( running_ && ros::ok() ) {
+      if( poll(&pfd, 1, 100) > 0 ) {
+         uint64_t n;
+         if( read(rx_event_, &n, sizeof(n)) < 0 && errno != EAGAIN ) {
+            ROS_PERROR("eventfd read");
+         }
+      }
+      while( framer_.pop(frame) ) {
+         if( capture_.is_open() ) {
+            capture_.frame(frame.end);
+         }
+         dispatch(frame.data, frame.sz, frame.stamp);
+         framer_.release(frame);
+      }
+   }
+}
+
+// write all of buf, a whole number of packets, waiting for the port to
+// drain if the kernel buffer is full. If the port stays full before any of
+// buf has gone out, all of it is dropped; once part of it is on the wire,
+// the rest has to follow, or the AVR would see a torn packet. Returns false
+// on error, or if buf was dropped
+bool DagnyLink::write_all(const char * buf, int sz) {
+   struct pollfd pfd;
+   pfd.fd = serial_;
+   pfd.events = POLLOUT;
+
+   bool started = false;
+   while( sz > 0 ) {
+      int cnt = ::write(serial_, buf, sz);
+      if( cnt > 0 ) {
+         link_stats_.tx(cnt);
+         buf += cnt;
+         sz -= cnt;
+         started = true;
+      } else if( cnt < 0 && errno == EINTR ) {
+         continue;
+      } else if( cnt < 0 && errno != EAGAIN && errno != EWOULDBLOCK ) {
+         ROS_PERROR("Failed to write to serial port");
+         return false;
+      } else if( poll(&pfd, 1, 100) <= 0 ) {
+         if( !started ) {
+            ROS_ERROR("Timed out writing to serial port; %d bytes dropped",
+                  sz);
+            link_stats_.tx_timeout(sz);
+            return false;
+         }
+         if( !running_ || failed_ ) {
+            return false;
+         }
+         ROS_WARN("Serial port is slow to drain; still writing %d bytes", sz);
+      }
+   }
+   return true;
+}
+
+// transmit staging buffer; room for several packets
+#define TX_STAGING 2048
+
+// transmit thread: the only writer on the serial port. Everything that was
+// queued since the last write goes out in one syscall
+void DagnyLink::tx_thread() {
+   char buf[TX_STAGING];
+   while( running_ && !failed_ && ros::ok() ) {
+      bool heartbeat = false;
+      int sz = tx_queue_.drain(buf, sizeof(buf),
+            boost::posix_time::milliseconds(100), 'H', &heartbeat);
+      if( sz > 0 ) {
+         // urgent packets go first, so the heartbeat is near the front of
+         // the write; stamp it once it's in the kernel, not when it was
+         // queued, so that time in the queue doesn't count as link delay
+         if( write_all(buf, sz) && heartbeat && time_sync_enabled_ ) {
+            time_sync_.heartbeat_sent(ros::Time::now().toSec());
+         }
+      }
+   }
+}
+
+// throw away whatever the driver has sent to the replayed AVR
+void DagnyLink::replay_drain() {
+   char buf[256];
+   while( recv(replay_fd_, buf, sizeof(buf), MSG_DONTWAIT) > 0 );
+}
+
+// replay thread: feed the capture to the receive thread at the captured
+// rate, scaled by replay_rate, or as fast as it will take it
+void DagnyLink::replay_thread() {
+   struct pollfd pfd;
+   pfd.fd = replay_fd_;
+   pfd.events = POLLIN;
+
+   ros::WallTime start = ros::WallTime::now();
+   double first = -1.0;
+   unsigned long records = 0;
+   unsigned long bytes = 0;
+   const CaptureRecord * r;
+   const char * data;
+   while( running_ && ros::ok() && replay_.next(r, data) ) {
+      if( first < 0.0 ) {
+         first = r->stamp;
+      }
+      if( replay_rate_ > 0.0 ) {
+         double due = (r->stamp - first) / replay_rate_;
+         double wait;
+         while( running_ &&
+               (wait = due - (ros::WallTime::now() - start).toSec()) > 0.0 ) {
+            int ms = wait < 0.1 ? (int)(wait * 1000.0) + 1 : 100;
+            if( poll(&pfd, 1, ms) > 0 ) {
+               replay_drain();
+            }
+         }
+      }
+
+      // waits when the receive thread falls behind, which is what paces
+      // an as-fast-as-possible replay
+      uint32_t sent = 0;
+      while( running_ && sent < r->len ) {
+         int cnt = send(replay_fd_, data + sent, r->len - sent,
+               MSG_NOSIGNAL | MSG_DONTWAIT);
+         if( cnt > 0 ) {
+            sent += cnt;
+         } else if( cnt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+            struct pollfd wait_pfd;
+            wait_pfd.fd = replay_fd_;
+            wait_pfd.events = POLLIN | POLLOUT;
+            if( poll(&wait_pfd, 1, 100) > 0 &&
+                  (wait_pfd.revents & POLLIN) ) {
+               replay_drain();
+            }
+         } else if( cnt < 0 && errno != EINTR ) {
+            ROS_PERROR("Replay write");
+            return;
+         }
+      }
+      replay_drain();
+      ++records;
+      bytes += r->len;
+   }
+
+   double elapsed = (ros::WallTime::now() - start).toSec();
+   ROS_INFO("Replay finished: %lu records, %lu bytes in %.3f s", records,
+         bytes, elapsed);
+
+   // keep the link open until the driver stops
+   while( running_ && ros::ok() ) {
+      if( poll(&pfd, 1, 100) > 0 ) {
+         replay_drain();
+      }
+   }
+}
+
+// set up a replay of file in place of the serial port
+bool DagnyLink::replay_setup(const std::string & file) {
+   if( !replay_.open(file) ) {
+      ROS_ERROR("Failed to open capture %s", file.c_str());
+      return false;
+   }
+   int fds[2];
+   if( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 ) {
+      ROS_PERROR("socketpair");
+      replay_.close();
+      return false;
+   }
+   serial_ = fds[0];
+   replay_fd_ = fds[1];
+   fcntl(serial_, F_SETFL, fcntl(serial_, F_GETFL) | O_NONBLOCK);
+   ROS_INFO("Replaying %s: %lu frames, protocol version %d, rate %g",
+         file.c_str(), (unsigned long)replay_.frames(),
+         replay_.header().protocol, replay_rate_);
+   return true;
+}
+
+// first uint32 in a frame
+uint32_t DagnyLink::frame_u32(Framer::Frame & f) {
+   if( protocol_version_ == PROTOCOL_V2 ) {
+      PacketV2 p(f.data, f.sz);
+      return p.readu32();
+   }
+   Packet p(f.data, f.sz);
+   return p.readu32();
+}
+
+// wait up to timeout seconds for a packet of the given type, and throw away
+// anything else. This is only for link setup, before the worker threads are
+// running. If value is given, the first uint32 in the packet is stored there
+bool DagnyLink::wait_for_packet(char type, double timeout, uint32_t * value) {
+   ros::WallTime end = ros::WallTime::now() + ros::WallDuration(timeout);
+
+   struct pollfd pfd;
+   pfd.fd = serial_;
+   pfd.events = POLLIN;
+
+   while( ros::ok() ) {
+      double left = (end - ros::WallTime::now()).toSec();
+      if( left <= 0.0 ) {
+         return false;
+      }
+      if( poll(&pfd, 1, (int)(left * 1000.0) + 1) <= 0 ) {
+         continue;
+      }
+      int queued;
+      framer_.fill(serial_, queued, ros::Time::now().toSec());
+
+      bool found = false;
+      Framer::Frame f;
+      while( framer_.pop(f) ) {
+         if( !found && f.data[0] == type ) {
+            found = true;
+            if( value ) {
+               *value = frame_u32(f);
+            }
+         }
+         framer_.release(f);
+      }
+      if( found ) {
+         return true;
+      }
+   }
+   return false;
+}
+
+// open the port, wait for the AVR to come out of its bootloader, and
+// negotiate a faster baud rate if we're allowed to.
+//
+// When its firmware starts, the AVR sends an 'R' packet. To change rates,
+// we send an 'N' packet with the fastest rate we'd like (uint32_t), and the
+// AVR answers with an 'N' packet carrying the rate it picked, then switches
+// to that rate and sends another 'R'. If we don't see that 'R', we go back
+// to the original rate; the AVR does the same if it doesn't hear a
+// heartbeat at the new rate
+bool DagnyLink::link_setup(ros::NodeHandle & n, const std::string & port) {
+   int baud;
+   int max_baud;
+   double ready_timeout;
+   n.param("baud", baud, 115200);
+   n.param("max_baud", max_baud, baud);
+   n.param("ready_timeout", ready_timeout, 2.0);
+
+   serial_ = serial_open(port, baud);
+   if( serial_ < 0 ) {
+      ROS_ERROR("Failed to open %s at %d baud: %s", port.c_str(), baud,
+            strerror(errno));
+      return false;
+   }
+
+   // wait for the bootloader to finish, instead of always sleeping for the
+   // worst case
+   if( wait_for_packet('R', ready_timeout, 0) ) {
+      ROS_INFO("AVR on %s ready", port.c_str());
+   } else {
+      ROS_WARN("No ready packet from AVR on %s after %.1f seconds; "
+            "continuing", port.c_str(), ready_timeout);
+   }
+
+   if( max_baud <= baud ) {
+      return true;
+   }
+
+   char buf[16];
+   OutPacket negotiate('N', sizeof(buf), buf);
+   negotiate.set_version(protocol_version_);
+   negotiate.reset();
+   negotiate.append((uint32_t)max_baud);
+   negotiate.finish();
+   write_all(negotiate.outbuf(), negotiate.outsz());
+
+   uint32_t rate = 0;
+   if( !wait_for_packet('N', 0.5, &rate) ) {
+      ROS_WARN("AVR didn't answer baud rate negotiation; staying at %d",
+            baud);
+      return true;
+   }
+   if( (int)rate == baud ) {
+      ROS_INFO("AVR wants to stay at %d baud", baud);
+      return true;
+   }
+   if( (int)rate > max_baud || !serial_baud_supported(rate) ) {
+      ROS_ERROR("AVR picked unusable baud rate %u", rate);
+      // the AVR will give up on it and go back to the old rate
+      return true;
+   }
+
+   serial_set_baud(serial_, rate);
+   if( wait_for_packet('R', 0.5, 0) ) {
+      ROS_INFO("Serial link on %s running at %u baud", port.c_str(), rate);
+   } else {
+      ROS_WARN("No response from AVR at %u baud; going back to %d", rate,
+            baud);
+      serial_set_baud(serial_, baud);
+   }
+   return true;
+}
+
+bool DagnyLink::open(ros::NodeHandle & n) {
+   // replay a capture instead of talking to the AVR; the capture's
+   // protocol version overrides the parameter
+   std::string replay_file;
+   n.param<std::string>("replay_file", replay_file, "");
+   n.param("replay_rate", replay_rate_, 1.0);
+   replaying_ = !replay_file.empty();
+   if( replaying_ && !replay_setup(replay_file) ) {
+      replaying_ = false;
+      return false;
+   }
+
+   n.param("protocol_version", protocol_version_, 1);
+   if( replaying_ ) {
+      protocol_version_ = replay_.header().protocol;
+   }
+   if( protocol_version_ != 1 && protocol_version_ != PROTOCOL_V2 ) {
+      ROS_ERROR("Unknown protocol version %d", protocol_version_);
+      return false;
+   }
+   if( protocol_version_ == PROTOCOL_V2 ) {
+      framer_.set_version(PROTOCOL_V2);
+      heartbeat_packet_.set_version(PROTOCOL_V2);
+   }
+
+   n.param("time_sync", time_sync_enabled_, false);
+   double tick_rate;
+   n.param("avr_tick_rate", tick_rate, 1000.0);
+   time_sync_.set_tick_rate(tick_rate);
+   tick_period_ = 1.0 / tick_rate;
+
+   // open serial port
+   if( !replaying_ ) {
+      std::string serial_port;
+      n.param<std::string>("port", serial_port, "/dev/ttyACM0");
+      if( !link_setup(n, serial_port) ) {
+         return false;
+      }
+   }
+
+   // record everything from here on
+   std::string capture_file;
+   n.param<std::string>("capture_file", capture_file, "");
+   if( !capture_file.empty() ) {
+      if( capture_.open(capture_file, protocol_version_,
+               ros::Time::now().toSec()) ) {
+         capture_.set_origin(framer_.position());
+         ROS_INFO("Capturing serial data to %s", capture_file.c_str());
+      } else {
+         ROS_ERROR("Failed to open capture file %s: %s",
+               capture_file.c_str(), strerror(errno));
+      }
+   }
+
+   link_stats_pub_ = n.advertise<dagny_driver::LinkStats>("link_stats", 10);
+   return true;
+}
+
+bool DagnyLink::run(ros::NodeHandle & n) {
+   if( running_ ) {
+      return false;
+   }
+   rx_event_ = eventfd(0, EFD_NONBLOCK);
+   if( rx_event_ < 0 ) {
+      ROS_PERROR("Failed to create eventfd");
+      return false;
+   }
+
+   // these only hand packets to the transmit thread
+   timers_.push_back(n.createTimer(ros::Duration(0.5),
+            &DagnyLink::heartbeat_callback, this));
+   timers_.push_back(n.createTimer(ros::Duration(1.0),
+            &DagnyLink::stats_callback, this));
+
+   running_ = true;
+   failed_ = false;
+   threads_.create_thread(boost::bind(&DagnyLink::rx_thread, this));
+   threads_.create_thread(boost::bind(&DagnyLink::publish_thread, this));
+   threads_.create_thread(boost::bind(&DagnyLink::tx_thread, this));
+   if( replaying_ ) {
+      threads_.create_thread(boost::bind(&DagnyLink::replay_thread, this));
+   }
+   return true;
+}
+
+bool DagnyLink::open_offline(ros::NodeHandle & n, int version) {
+   if( version != 1 && version != PROTOCOL_V2 ) {
+      ROS_ERROR("Unknown protocol version %d", version);
+      return false;
+   }
+   protocol_version_ = version;
+   if( version == PROTOCOL_V2 ) {
+      framer_.set_version(PROTOCOL_V2);
+      heartbeat_packet_.set_version(PROTOCOL_V2);
+   }
+   return true;
+}
+
+void DagnyLink::stop() {
+   if( running_ ) {
+      running_ = false;
+      threads_.join_all();
+   }
+   timers_.clear();
+
+   if( rx_event_ >= 0 ) {
+      close(rx_event_);
+      rx_event_ = -1;
+   }
+   if( serial_ >= 0 ) {
+      close(serial_);
+      serial_ = -1;
+   }
+   capture_.close();
+   if( replaying_ ) {
+      close(replay_fd_);
+      replay_fd_ = -1;
+      replay_.close();
+      replaying_ = false;
+   }
+}
+
+void DagnyLink::heartbeat_callback(const ros::TimerEvent & e) {
+   heartbeat_packet_.reset();
+   heartbeat_packet_.finish();
+   // the transmit thread stamps it for time sync once it's gone out
+   write(TX_URGENT, heartbeat_packet_);
+}
+
+// link statistics over the actual elapsed time, instead of assuming that
+// the timer ran at exactly the right rate
+void DagnyLink::stats_callback(const ros::TimerEvent & e) {
+   link_stats_.report(ros::WallTime::now().toSec(), link_report_);
+   if( link_report_.period > 0.0 ) {
+      bandwidth_ = link_report_.rx_rate;
+   }
+
+   if( link_stats_pub_.getNumSubscribers() == 0 ) {
+      return;
+   }
+   dagny_driver::LinkStats msg;
+   msg.header.stamp = ros::Time::now();
+   msg.period = link_report_.period;
+   msg.rx_bytes = link_report_.rx_bytes;
+   msg.tx_bytes = link_report_.tx_bytes;
+   msg.rx_rate = link_report_.rx_rate;
+   msg.tx_rate = link_report_.tx_rate;
+   msg.dropped_frames = framer_.dropped();
+   msg.crc_errors = framer_.crc_errors();
+   msg.short_packets = short_packets_;
+   msg.unknown_packets = 0;
+   for( int i=0; i<256; i++ ) {
+      msg.unknown_packets += unknown_packets_[i];
+      if( link_report_.packets[i] == 0 ) {
+         continue;
+      }
+      const LatencyHistogram & h = link_report_.handler_time[i];
+      msg.types.push_back(i);
+      msg.packets.push_back(link_report_.packets[i]);
+      msg.packet_rates.push_back(link_report_.packet_rate[i]);
+      msg.handler_mean.push_back(h.mean() * 1e6);
+      msg.handler_max.push_back(h.max() * 1e6);
+   }
+   const LatencyHistogram & l = link_report_.latency;
+   for( int i=0; i<LATENCY_BUCKETS; i++ ) {
+      msg.latency_histogram.push_back(l.count(i));
+   }
+   msg.latency_mean = l.mean() * 1000.0;
+   for( int c=0; c<TX_CLASSES; c++ ) {
+      msg.tx_depth.push_back(tx_queue_.depth((TxClass)c));
+      msg.tx_dropped.push_back(tx_queue_.dropped((TxClass)c));
+   }
+   msg.tx_timeouts = link_report_.tx_timeouts;
+   msg.tx_timeout_bytes = link_report_.tx_timeout_bytes;
+   link_stats_pub_.publish(msg);
+}
+
+void DagnyLink::bandwidth_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   if( failed_ ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
+            "ERROR: Serial port failed; link stopped");
+   } else if( bandwidth_ == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
+            "ERROR: No AVR data");
+   } else if( bandwidth_ < 1000 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Low AVR bandwidth");
+   } else if( bandwidth_ > 1500 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: High AVR bandwidth");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: AVR bandwidth normal");
+   }
+   stat.addf("Bandwidth In", "%d bytes/sec", bandwidth_);
+   stat.addf("Bandwidth Out", "%.0f bytes/sec", link_report_.tx_rate);
+   stat.addf("Bytes In", "%lu", link_report_.rx_bytes);
+   stat.addf("Bytes Out", "%lu", link_report_.tx_bytes);
+   stat.addf("Dropped packets", "%lu", framer_.dropped());
+   if( protocol_version_ == PROTOCOL_V2 ) {
+      stat.addf("CRC errors", "%lu", framer_.crc_errors());
+   }
+   stat.addf("Unsubscribed packets", "%lu", skipped_packets_);
+}
+
+void DagnyLink::packet_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   const LatencyHistogram & l = link_report_.latency;
+   if( l.samples() == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: No packets handled");
+   } else {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: %.1f ms mean serial to publish latency",
+            l.mean() * 1000.0);
+   }
+   stat.add("Serial to publish latency", l.str());
+   for( int i=0; i<256; i++ ) {
+      if( link_report_.packets[i] == 0 ) {
+         continue;
+      }
+      const LatencyHistogram & h = link_report_.handler_time[i];
+      char type[16];
+      if( i > ' ' && i < 0x7F ) {
+         snprintf(type, sizeof(type), "'%c'", i);
+      } else {
+         snprintf(type, sizeof(type), "0x%02X", i);
+      }
+      std::string t(type);
+      stat.addf(t + " packets", "%lu (%.1f/sec)",
+            link_report_.packets[i], link_report_.packet_rate[i]);
+      stat.addf(t + " handler time", "%.1f us mean, %.1f us max",
+            h.mean() * 1e6, h.max() * 1e6);
+      stat.add(t + " handler histogram", h.str());
+   }
+}
+
+void DagnyLink::tx_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   const char * names[TX_CLASSES] = { "Urgent", "Control" };
+   unsigned long drops = 0;
+   for( int c=0; c<TX_CLASSES; c++ ) {
+      TxClass tc = (TxClass)c;
+      LatencyHistogram l = tx_queue_.latency(tc);
+      unsigned long d = tx_queue_.dropped(tc);
+      drops += d;
+      std::string q(names[c]);
+      stat.addf(q + " queue depth", "%d", tx_queue_.depth(tc));
+      stat.addf(q + " dropped", "%lu", d);
+      stat.addf(q + " mean latency", "%.2f ms", l.mean() * 1000.0);
+      stat.add(q + " latency", l.str());
+   }
+   stat.addf("Write timeouts", "%lu", link_report_.tx_timeouts);
+   stat.addf("Bytes dropped on timeouts", "%lu",
+         link_report_.tx_timeout_bytes);
+   if( link_report_.tx_timeouts > 0 ) {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: %lu writes timed out", link_report_.tx_timeouts);
+   } else if( drops > 0 ) {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: %lu outbound packets dropped", drops);
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Transmit queues normal");
+   }
+}
+
+void DagnyLink::time_sync_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   if( !time_sync_enabled_ ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Time sync disabled; using receive time");
+      return;
+   }
+   if( !time_sync_.synced() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Not synchronized with AVR clock");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Synchronized with AVR clock");
+   }
+   double offset, drift, rtt, residual;
+   int samples;
+   time_sync_.status(offset, drift, rtt, residual, samples);
+   stat.addf("Clock offset", "%.6f s", offset);
+   stat.addf("Clock drift", "%.1f ppm", drift);
+   stat.addf("Heartbeat round trip", "%.1f ms", rtt * 1000.0);
+   stat.addf("Fit residual", "%.2f ms", residual * 1000.0);
+   stat.addf("Samples", "%d", samples);
+}
+
+void DagnyLink::unknown_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   ros::WallTime now = ros::WallTime::now();
+   double elapsed = (now - last_unknown_report_).toSec();
+   last_unknown_report_ = now;
+
+   unsigned long total = 0;
+   unsigned long recent = 0;
+   int worst = 0;
+   unsigned long worst_count = 0;
+   for( int i=0; i<256; i++ ) {
+      unsigned long c = unknown_packets_[i];
+      unsigned long d = c - last_unknown_packets_[i];
+      last_unknown_packets_[i] = c;
+      total += c;
+      recent += d;
+      if( d > worst_count ) {
+         worst = i;
+         worst_count = d;
+      }
+   }
+
+   if( recent == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: No unknown packets");
+   } else {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: %lu unknown packets in last %.1f s, most of type "
+            "0x%02X", recent, elapsed, worst);
+      ROS_WARN("%lu unknown packets of type 0x%02X in last %.1f s",
+            worst_count, worst, elapsed);
+   }
+   stat.addf("Unknown packets", "%lu", total);
+   stat.addf("Short packets", "%lu", short_packets_);
+
+   char sample[UNKNOWN_SAMPLE];
+   int sz, len;
+   {
+      boost::mutex::scoped_lock lock(unknown_mutex_);
+      sz = unknown_sample_sz_;
+      len = unknown_sample_len_;
+      memcpy(sample, unknown_sample_, sz);
+   }
+   if( sz > 0 ) {
+      char hex[UNKNOWN_SAMPLE * 3 + 1];
+      for( int i=0; i<sz; i++ ) {
+         snprintf(hex + i*3, 4, "%02X ", 0xFF & sample[i]);
+      }
+      hex[sz*3 - 1] = 0;
+      stat.addf("Last unknown packet", "%s (%d bytes)", hex, len);
+   }
+}
+
+void DagnyLink::add_diagnostics(diagnostic_updater::Updater & u) {
+   std::string prefix = name_.empty() ? "" : name_ + " ";
+   u.add(prefix + "AVR Bandwidth", this, &DagnyLink::bandwidth_diagnostics);
+   u.add(prefix + "AVR Packets", this, &DagnyLink::packet_diagnostics);
+   u.add(prefix + "AVR Time Sync", this, &DagnyLink::time_sync_diagnostics);
+   u.add(prefix + "AVR Transmit", this, &DagnyLink::tx_diagnostics);
+   last_unknown_report_ = ros::WallTime::now();
+   u.add(prefix + "AVR Unknown Packets", this,
+         &DagnyLink::unknown_diagnostics);
+}
@@ -0,0 +1,257 @@
+/*
+ * One serial link to an AVR board: the port, the framer, the packet handler
+ * table, the transmit queue, time sync and the link statistics, and the
+ * receive, publish and transmit threads that move packets between them.
+ *
+ * A driver process can run several links, one per board, each with its own
+ * threads. Everything a link publishes or reads parameters from is under
+ * the node handle it was opened with, so each board gets its own
+ * namespace. The link itself only knows about the framing, heartbeats and
+ * time sync; what each packet type means is up to the handlers installed
+ * on it.
+ *
+ * Handlers run on the link's publish thread, and never concurrently with
+ * each other. write() may be called from any thread.
+ */
+
+#ifndef DAGNY_LINK_H
+#define DAGNY_LINK_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "protocol.h"
+#include "protocol_v2.h"
+#include "tx_queue.h"
+#include "framer.h"
+#include "time_sync.h"
+#include "link_stats.h"
+#include "serial_capture.h"
+#include "topic_publisher.h"
+
+class DagnyLink;
+
+// handlers see every frame as a PacketV2; version 1 frames are unescaped
+// before they're dispatched
+typedef void (*handler_ptr)(DagnyLink & link, PacketV2 & p);
+
+// most topics a single packet type can feed
+#define HANDLER_FEEDS 3
+
+// bytes of the most recent unknown packet kept for the diagnostics
+#define UNKNOWN_SAMPLE 32
+
+// dispatch table entry for one packet type. A packet type that declares
+// the topics it feeds is only decoded when one of them has subscribers;
+// otherwise the dispatcher checks its length, calls skip() to keep any
+// state the diagnostics need, and drops it. Packet types that don't
+// declare any topics are always decoded
+struct PacketHandler {
+   handler_ptr handle;
+   TopicPublisher * feeds[HANDLER_FEEDS];
+   int n_feeds;
+   // smallest valid payload, not counting the type byte
+   int min_size;
+   void (*skip)(DagnyLink & link);
+};
+
+class DagnyLink {
+   public:
+      // name is used in log messages and diagnostics; the primary link's
+      // is empty
+      explicit DagnyLink(const std::string & name);
+      virtual ~DagnyLink();
+
+      const std::string & name() const { return name_; }
+
+      // read the link parameters from n, and open the port, or the capture
+      // to replay in place of it. Nothing is handled until run()
+      bool open(ros::NodeHandle & n);
+
+      // start the worker threads, and the heartbeat and statistics timers
+      // on n
+      bool run(ros::NodeHandle & n);
+
+      // use protocol version v without a port or any threads, so that
+      // frames can be fed in by hand with dispatch(). For benchmarks
+      bool open_offline(ros::NodeHandle & n, int version);
+
+      // stop the threads and close the port
+      void stop();
+
+      // install a handler for a packet type; every type starts out counted
+      // as unknown. Heartbeat replies are handled by the link itself
+      void set_handler(int type, handler_ptr handle);
+      // declare a topic that a packet type feeds
+      void add_feed(int type, TopicPublisher & pub);
+      void set_min_size(int type, int size);
+      void set_skip(int type, void (*skip)(DagnyLink & link));
+
+      // decode one frame and publish it, as the publish thread does. data
+      // starts at the type byte, as the framer hands frames out, and stamp
+      // is the time it arrived
+      void dispatch(char * data, int sz, double stamp);
+
+      // queue a finished packet for the serial port. Returns false if the
+      // transmit queue for its class is full
+      bool write(TxClass c, const char * buf, int sz);
+      bool write(TxClass c, OutPacket & p) {
+         return write(c, p.outbuf(), p.outsz());
+      }
+
+      // serial protocol version; 1 or 2
+      int protocol_version() const { return protocol_version_; }
+
+      // time that the packet currently being handled was received
+      const ros::Time & packet_time() const { return packet_time_; }
+
+      // when enabled, the AVR appends its tick count to 'O', 'V' and 'M'
+      // packets and answers heartbeats with its tick count, and we stamp
+      // messages with the reconstructed time that the data was acquired
+      bool time_sync_enabled() const { return time_sync_enabled_; }
+      // seconds per AVR tick
+      double tick_period() const { return tick_period_; }
+      // host time of an AVR tick, for a packet that arrived at
+      // packet_time(). Only with time sync
+      ros::Time tick_time(uint32_t tick) {
+         return ros::Time(time_sync_.to_host(tick, packet_time_.toSec()));
+      }
+
+      // acquisition time of the packet being handled. With time sync, this
+      // reads the tick count from the end of the packet
+      template<class P> ros::Time acquisition_time(P & p) {
+         if( !time_sync_enabled_ ) {
+            return packet_time_;
+         }
+         return tick_time(p.readu32());
+      }
+
+      // decode the next part of a payload into a packet schema, with a
+      // single length check. Payloads are copied straight out of the
+      // frame, which is already unescaped in either protocol version
+      template<class S> bool decode(PacketV2 & p, S & s) {
+         const char * b = p.take(S::SIZE);
+         if( !b ) {
+            ++short_packets_;
+            return false;
+         }
+         s.unpack(b);
+         return true;
+      }
+
+      // add this link's diagnostics to u; their names start with the link
+      // name, if it has one
+      void add_diagnostics(diagnostic_updater::Updater & u);
+
+   private:
+      void rx_thread();
+      void publish_thread();
+      void tx_thread();
+      void replay_thread();
+      void replay_drain();
+      bool replay_setup(const std::string & file);
+
+      bool write_all(const char * buf, int sz);
+      uint32_t frame_u32(Framer::Frame & f);
+      bool wait_for_packet(char type, double timeout, uint32_t * value);
+      bool link_setup(ros::NodeHandle & n, const std::string & port);
+
+      bool handler_wanted(const PacketHandler & h);
+
+      void heartbeat_callback(const ros::TimerEvent & e);
+      void stats_callback(const ros::TimerEvent & e);
+
+      void bandwidth_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void packet_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void tx_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void time_sync_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void unknown_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+      template<class P> static void unknown_h(DagnyLink & link, P & p);
+      template<class P> static void heartbeat_h(DagnyLink & link, P & p);
+
+      std::string name_;
+
+      // serial port. Only read by the receive thread and only written by
+      // the transmit thread
+      int serial_;
+      int protocol_version_;
+
+      // outbound packets, waiting for the transmit thread
+      TxQueue tx_queue_;
+
+      // splits the serial stream into packets; filled by the receive
+      // thread and drained by the publisher thread
+      Framer framer_;
+
+      PacketHandler handlers_[256];
+      ros::Time packet_time_;
+
+      // v1 frames are unescaped here before dispatch; publisher thread only
+      char unescaped_[FRAME_MAX];
+
+      bool time_sync_enabled_;
+      TimeSync time_sync_;
+      double tick_period_;
+      char heartbeat_buf_[8];
+      OutPacket heartbeat_packet_;
+
+      // packets dropped without decoding, and packets too short for their
+      // layout; only touched by the publish thread
+      unsigned long skipped_packets_;
+      unsigned long short_packets_;
+
+      // unknown packets by type; only written by the publish thread
+      unsigned long unknown_packets_[256];
+      boost::mutex unknown_mutex_;
+      char unknown_sample_[UNKNOWN_SAMPLE];
+      int unknown_sample_sz_;
+      int unknown_sample_len_;
+      // counts at the last report, to turn the totals into a rate
+      unsigned long last_unknown_packets_[256];
+      ros::WallTime last_unknown_report_;
+
+      // serial link statistics, fed by the worker threads, and the most
+      // recent report from them for the diagnostics. The report is only
+      // used from the timer callbacks
+      LinkStats link_stats_;
+      LinkReport link_report_;
+      int bandwidth_;
+      ros::Publisher link_stats_pub_;
+
+      // eventfd used by the receive thread to wake the publisher thread
+      int rx_event_;
+
+      // raw capture of everything the receive thread reads, if enabled
+      CaptureWriter capture_;
+
+      // replay of a capture in place of the serial port: the replay thread
+      // writes the captured stream into one end of a socket pair, and the
+      // rest of the link uses the other end as its serial port
+      CaptureReader replay_;
+      bool replaying_;
+      double replay_rate_; // 1 is real time; 0 is as fast as possible
+      int replay_fd_;
+
+      // cleared by stop() to shut down the worker threads
+      boost::atomic<bool> running_;
+      // set when the port reports an error; the failed link stops reading
+      // and writing, and the rest of the node carries on without it
+      boost::atomic<bool> failed_;
+      boost::thread_group threads_;
+      std::vector<ros::Timer> timers_;
+};
+
+#endif
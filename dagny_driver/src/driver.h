@@ -0,0 +1,31 @@
+/*
+ * Entry points for the Dagny hardware driver, shared by the standalone node
+ * and the nodelet.
+ */
+
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <ros/ros.h>
+
+// open the serial port, set up publishers and subscribers on n, and start
+// the serial threads. Each name in the links parameter is another board,
+// with its own port, parameters and topics in that namespace under n.
+// Subscriber callbacks and timers run on n's callback queue. Only one
+// driver can run per process. Returns false on failure
+bool driver_start(ros::NodeHandle & n);
+
+// stop the serial threads and close the ports
+void driver_stop();
+
+// set up the packet handlers and their publishers on n for protocol
+// version 1 or 2, without a serial port or any threads, so that frames
+// can be fed in by hand with driver_dispatch(). For benchmarks
+bool driver_start_offline(ros::NodeHandle & n, int version);
+
+// decode one frame and publish it, as the publish thread does. data starts
+// at the type byte, as the framer hands frames out, and stamp is the time
+// it arrived
+void driver_dispatch(char * data, int sz, double stamp);
+
+#endif
@@ -0,0 +1,22 @@
+/* Standalone dagny_driver node; a thin wrapper around the driver that is
+ * also available as a nodelet.
+ */
+
+#include <ros/ros.h>
+
+#include "driver.h"
+
+int main(int argc, char ** argv) {
+   ros::init(argc, argv, "dagny_driver");
+
+   ros::NodeHandle n;
+
+   if( !driver_start(n) ) {
+      return -1;
+   }
+
+   ros::spin();
+
+   driver_stop();
+   return 0;
+}
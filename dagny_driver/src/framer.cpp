@@ -0,0 +1,187 @@
+/*
+ * Implementation of the ring-buffer packet framer from framer.h
+ */
+
+#include "framer.h"
+#include "protocol_v2.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT((FRAMER_RING_SIZE & (FRAMER_RING_SIZE - 1)) == 0);
+BOOST_STATIC_ASSERT(FRAME_MAX <= FRAMER_RING_SIZE);
+BOOST_STATIC_ASSERT(V2_OVERHEAD + V2_PAYLOAD_MAX <= FRAME_MAX);
+
+#define RING_MASK (FRAMER_RING_SIZE - 1)
+
+Framer::Framer() : version(1), head(0), last_read_(buf), scan(0), start(0),
+   discard(false), pushed(0), dropped_(0), crc_errors_(0), tail(0),
+   released(0) {
+}
+
+uint8_t Framer::at(uint32_t i) const {
+   return buf[i & RING_MASK];
+}
+
+bool Framer::push(char * data, int sz, uint32_t end, double now) {
+   Frame f;
+   f.data = data;
+   f.sz = sz;
+   f.end = end;
+   f.stamp = now;
+   if( frames.push(f) ) {
+      ++pushed;
+      return true;
+   }
+   ++dropped_;
+   return false;
+}
+
+int Framer::fill(int fd, int & n_frames, double now) {
+   n_frames = 0;
+
+   // everything before reclaim is free. If the consumer has released every
+   // frame we gave it, that's everything before the partial frame;
+   // otherwise it's only what the consumer has released so far
+   uint32_t reclaim;
+   if( released.load(boost::memory_order_acquire) == pushed ) {
+      reclaim = start;
+   } else {
+      reclaim = tail.load(boost::memory_order_acquire);
+   }
+
+   uint32_t w = head & RING_MASK;
+   uint32_t space = FRAMER_RING_SIZE - (head - reclaim);
+   if( space > FRAMER_RING_SIZE - w ) {
+      space = FRAMER_RING_SIZE - w;
+   }
+   if( space == 0 ) {
+      return 0;
+   }
+
+   int cnt = read(fd, buf + w, space);
+   if( cnt <= 0 ) {
+      return cnt;
+   }
+   last_read_ = buf + w;
+
+   // keep the mirror of the start of the ring up to date
+   if( w < FRAME_MAX ) {
+      uint32_t m = FRAME_MAX - w;
+      if( m > (uint32_t)cnt ) m = cnt;
+      memcpy(buf + FRAMER_RING_SIZE + w, buf + w, m);
+   }
+
+   head += cnt;
+   if( version == PROTOCOL_V2 ) {
+      n_frames = scan_frames_v2(now);
+   } else {
+      n_frames = scan_frames(now);
+   }
+   return cnt;
+}
+
+int Framer::scan_frames(double now) {
+   int n = 0;
+   while( scan != head ) {
+      // search the contiguous part of the new data for a terminator
+      uint32_t s = scan & RING_MASK;
+      uint32_t len = head - scan;
+      if( len > FRAMER_RING_SIZE - s ) {
+         len = FRAMER_RING_SIZE - s;
+      }
+      char * t = (char*)memchr(buf + s, '\r', len);
+      if( !t ) {
+         scan += len;
+         continue;
+      }
+      scan += (t - (buf + s));
+
+      // scan is now at the terminator
+      uint32_t sz = scan - start;
+      // check that our string isn't just the terminating character
+      if( !discard && sz > FRAME_MAX ) {
+         ++dropped_;
+      } else if( !discard && sz > 1 ) {
+         if( push(buf + (start & RING_MASK), sz, scan + 1, now) ) {
+            ++n;
+         }
+      }
+      ++scan;
+      start = scan;
+      discard = false;
+   }
+
+   // drop frames that have grown too long without a terminator
+   if( !discard && head - start > FRAME_MAX ) {
+      discard = true;
+      ++dropped_;
+   }
+   if( discard ) {
+      start = scan;
+   }
+   return n;
+}
+
+int Framer::scan_frames_v2(double now) {
+   int n = 0;
+   while( start != head ) {
+      // look for the first sync byte
+      if( at(start) != V2_SYNC0 ) {
+         uint32_t s = start & RING_MASK;
+         uint32_t len = head - start;
+         if( len > FRAMER_RING_SIZE - s ) {
+            len = FRAMER_RING_SIZE - s;
+         }
+         char * t = (char*)memchr(buf + s, V2_SYNC0, len);
+         start += t ? (uint32_t)(t - (buf + s)) : len;
+         continue;
+      }
+
+      uint32_t avail = head - start;
+      if( avail < 2 ) break;
+      if( at(start + 1) != V2_SYNC1 ) {
+         ++start;
+         continue;
+      }
+      if( avail < V2_HEADER ) break;
+      if( at(start + 2) != PROTOCOL_V2 ) {
+         ++start;
+         continue;
+      }
+
+      // we have a header; wait for the whole frame
+      uint32_t len = at(start + 3);
+      uint32_t total = V2_OVERHEAD + len;
+      if( avail < total ) break;
+
+      // thanks to the mirror, the whole frame is contiguous
+      char * f = buf + (start & RING_MASK);
+      uint16_t crc = crc16(f + 2, len + 3);
+      uint16_t got = (uint8_t)f[total - 2] | ((uint8_t)f[total - 1] << 8);
+      if( crc == got ) {
+         if( push(f + 4, len + 1, start + total, now) ) {
+            ++n;
+         }
+         start += total;
+      } else {
+         // maybe that wasn't really a sync word; resynchronize from the
+         // next byte
+         ++crc_errors_;
+         ++start;
+      }
+   }
+   scan = start;
+   return n;
+}
+
+bool Framer::pop(Frame & f) {
+   return frames.pop(f);
+}
+
+void Framer::release(const Frame & f) {
+   tail.store(f.end, boost::memory_order_release);
+   released.fetch_add(1, boost::memory_order_release);
+}
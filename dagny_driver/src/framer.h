@@ -0,0 +1,116 @@
+/*
+ * Receive-side packet framer. Bytes from the serial port are read straight
+ * into a power-of-two ring buffer, and the framer scans only the newly
+ * arrived bytes for the '\r' terminator. Complete frames are handed to the
+ * consumer as pointers into the ring, so packets are never copied or
+ * shifted around.
+ *
+ * The first FRAME_MAX bytes of the ring are mirrored just past its end, so
+ * that a frame which wraps around the end of the ring is still contiguous
+ * in memory.
+ *
+ * With version 2 framing (protocol_v2.h) the framer looks for the sync
+ * word, reads the length from the header, skips straight to the end of the
+ * frame and checks the CRC, instead of scanning for a terminator. Frames
+ * still start at the type byte in either version.
+ *
+ * The receive thread is the only producer and the publisher thread is the
+ * only consumer; they communicate through a lock-free queue of frames.
+ */
+
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+// ring size; must be a power of two
+#define FRAMER_RING_SIZE 4096
+// longest frame we will hand out; longer frames are dropped
+#define FRAME_MAX 512
+// maximum number of frames waiting for the consumer
+#define FRAMER_QUEUE_SIZE 128
+
+class Framer {
+   public:
+      // a complete frame, not including the terminating '\r'. data points
+      // into the ring, and stays valid until the frame is released
+      struct Frame {
+         char * data;
+         int sz;
+         uint32_t end; // ring position just after the terminator
+         double stamp; // time that the terminator was read
+      };
+
+      Framer();
+
+      // set the protocol version; 1 or 2. Call this before any data
+      // arrives
+      void set_version(int v) { version = v; }
+
+      // Producer side; only call these from the receive thread
+
+      // read whatever is available from fd into the ring and queue any
+      // complete frames, stamped with now. Returns the result of read(), or
+      // 0 if the ring is full. frames is set to the number of frames queued
+      int fill(int fd, int & frames, double now);
+
+      // the bytes read by the last successful fill(); valid until the
+      // next fill()
+      const char * last_read() const { return last_read_; }
+
+      // total bytes received, modulo 2^32; the same count as Frame::end
+      uint32_t position() const { return head; }
+
+      // frames dropped because they were too long or the consumer fell
+      // behind
+      unsigned long dropped() const { return dropped_; }
+
+      // version 2 frames that failed the CRC check
+      unsigned long crc_errors() const { return crc_errors_; }
+
+      // Consumer side; only call these from the publisher thread
+
+      // get the next complete frame. Returns false if there isn't one
+      bool pop(Frame & f);
+
+      // done with a frame; its space in the ring may be reused. Frames must
+      // be released in the order they were popped
+      void release(const Frame & f);
+
+   private:
+      // scan the bytes between scan and head for terminators
+      int scan_frames(double now);
+      // find version 2 frames between start and head
+      int scan_frames_v2(double now);
+
+      // queue a complete frame
+      bool push(char * data, int sz, uint32_t end, double now);
+
+      uint8_t at(uint32_t i) const;
+
+      int version;
+
+      char buf[FRAMER_RING_SIZE + FRAME_MAX];
+
+      // producer state
+      uint32_t head;  // next byte to be written
+      const char * last_read_;
+      uint32_t scan;  // next byte to be scanned for a terminator
+      uint32_t start; // start of the frame being received
+      bool discard;   // current frame is too long; drop it
+      uint32_t pushed;
+      unsigned long dropped_;
+      unsigned long crc_errors_;
+
+      // consumer state, read by the producer to find free space
+      boost::atomic<uint32_t> tail;     // end of the last released frame
+      boost::atomic<uint32_t> released; // number of frames released
+
+      boost::lockfree::spsc_queue<Frame,
+         boost::lockfree::capacity<FRAMER_QUEUE_SIZE> > frames;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Implementation of the goal store from goal_store.h
+ */
+
+#include "goal_store.h"
+
+#include <dagny_driver/Goal.h>
+
+// longest change log to keep for an AVR that has fallen behind; past this
+// it gets a snapshot instead
+#define GOAL_LOG_MAX 1024
+
+GoalStore::GoalStore() : next_id_(1), current_(0), version_(0),
+   log_base_(0) {
+}
+
+int GoalStore::find(int32_t id) const {
+   std::map<int32_t, size_t>::const_iterator i = by_id_.find(id);
+   return i == by_id_.end() ? -1 : (int)i->second;
+}
+
+void GoalStore::reindex(size_t i) {
+   for( ; i<goals_.size(); i++ ) {
+      by_id_[goals_[i].id] = i;
+   }
+}
+
+void GoalStore::log(int8_t operation, int32_t id, int32_t before,
+      int32_t lat, int32_t lon, bool from_avr) {
+   GoalChange c;
+   c.operation = operation;
+   c.id = id;
+   c.before = before;
+   c.lat = lat;
+   c.lon = lon;
+   c.from_avr = from_avr;
+   log_.push_back(c);
+   ++version_;
+   if( log_.size() > GOAL_LOG_MAX ) {
+      log_.pop_front();
+      ++log_base_;
+   }
+}
+
+int32_t GoalStore::append(int32_t lat, int32_t lon, bool from_avr) {
+   Goal g;
+   g.id = next_id_++;
+   g.lat = lat;
+   g.lon = lon;
+   goals_.push_back(g);
+   by_id_[g.id] = goals_.size() - 1;
+   log(dagny_driver::Goal::APPEND, g.id, 0, lat, lon, from_avr);
+   return g.id;
+}
+
+int32_t GoalStore::insert(int32_t before, int32_t lat, int32_t lon) {
+   int i = find(before);
+   if( i < 0 ) {
+      return 0;
+   }
+   Goal g;
+   g.id = next_id_++;
+   g.lat = lat;
+   g.lon = lon;
+   goals_.insert(goals_.begin() + i, g);
+   reindex(i);
+   log(dagny_driver::Goal::INSERT, g.id, before, lat, lon);
+   return g.id;
+}
+
+bool GoalStore::update(int32_t id, int32_t lat, int32_t lon) {
+   int i = find(id);
+   if( i < 0 ) {
+      return false;
+   }
+   goals_[i].lat = lat;
+   goals_[i].lon = lon;
+   log(dagny_driver::Goal::UPDATE, id, 0, lat, lon);
+   return true;
+}
+
+bool GoalStore::remove(int32_t id, bool from_avr) {
+   int i = find(id);
+   if( i < 0 ) {
+      return false;
+   }
+   goals_.erase(goals_.begin() + i);
+   by_id_.erase(id);
+   reindex(i);
+   if( current_ == id ) {
+      current_ = 0;
+   }
+   log(dagny_driver::Goal::DELETE, id, 0, 0, 0, from_avr);
+   return true;
+}
+
+bool GoalStore::set_current(int32_t id) {
+   if( find(id) < 0 ) {
+      return false;
+   }
+   current_ = id;
+   log(dagny_driver::Goal::SET_CURRENT, id, 0, 0, 0);
+   return true;
+}
+
+int GoalStore::changes(uint16_t v, GoalChange * out, int max) const {
+   // how far v is behind, and how far back the log goes; both modulo 2^16
+   uint16_t behind = version_ - v;
+   uint16_t kept = version_ - log_base_;
+   if( behind > kept ) {
+      return -1;
+   }
+   int n = behind < max ? behind : max;
+   size_t start = log_.size() - behind;
+   for( int i=0; i<n; i++ ) {
+      out[i] = log_[start + i];
+   }
+   return n;
+}
+
+std::vector<GoalChange> GoalStore::snapshot() const {
+   std::vector<GoalChange> s;
+   for( size_t i=0; i<goals_.size(); i++ ) {
+      GoalChange c;
+      c.operation = dagny_driver::Goal::APPEND;
+      c.id = goals_[i].id;
+      c.before = 0;
+      c.lat = goals_[i].lat;
+      c.lon = goals_[i].lon;
+      c.from_avr = false;
+      s.push_back(c);
+   }
+   if( current_ ) {
+      GoalChange c;
+      c.operation = dagny_driver::Goal::SET_CURRENT;
+      c.id = current_;
+      c.before = c.lat = c.lon = 0;
+      c.from_avr = false;
+      s.push_back(c);
+   }
+   return s;
+}
+
+void GoalStore::trim(uint16_t v) {
+   uint16_t drop = v - log_base_;
+   if( drop > log_.size() ) {
+      return;
+   }
+   log_.erase(log_.begin(), log_.begin() + drop);
+   log_base_ = v;
+}
@@ -0,0 +1,103 @@
+/*
+ * The driver's list of navigation goals, and the history needed to keep
+ * the AVR's copy in sync with it.
+ *
+ * Goals are kept in order and looked up by id. Ids are assigned by the
+ * store when goals are added, and never reused. Every change bumps the
+ * version by one and is kept in a change log, so that the AVR can be
+ * brought up to date from any version it has acknowledged with just the
+ * changes since then. If the log doesn't reach back that far, a snapshot
+ * of the whole list, as a series of appends, does the same job.
+ *
+ * Versions are 16 bits, as they go over the link, and wrap.
+ *
+ * Changes made on the AVR are marked as such in the log; the AVR has
+ * already applied those to its own copy, so they're never sent back to it.
+ *
+ * Not thread-safe.
+ */
+
+#ifndef GOAL_STORE_H
+#define GOAL_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+struct Goal {
+   int32_t id;
+   int32_t lat; // millionths of a degree
+   int32_t lon; // millionths of a degree
+};
+
+// one change to the list. The operations are those from Goal.msg
+struct GoalChange {
+   int8_t operation;
+   int32_t id;
+   int32_t before; // insert: the goal to insert in front of
+   int32_t lat;
+   int32_t lon;
+   bool from_avr; // made on the AVR, which already has it
+};
+
+class GoalStore {
+   public:
+      GoalStore();
+
+      // the operations from Goal.msg. Each returns false, and changes
+      // nothing, if the goal it refers to doesn't exist. from_avr marks
+      // changes that were made on the AVR
+
+      // add a goal at the end of the list; returns its id
+      int32_t append(int32_t lat, int32_t lon, bool from_avr = false);
+      // add a goal in front of goal before; returns its id, or 0
+      int32_t insert(int32_t before, int32_t lat, int32_t lon);
+      bool update(int32_t id, int32_t lat, int32_t lon);
+      bool remove(int32_t id, bool from_avr = false);
+      bool set_current(int32_t id);
+
+      uint16_t version() const { return version_; }
+      int32_t current() const { return current_; }
+
+      // the goals, in order
+      const std::vector<Goal> & goals() const { return goals_; }
+
+      // up to max changes since version v, oldest first. Returns how many
+      // there were, or -1 if v is older than the change log
+      int changes(uint16_t v, GoalChange * out, int max) const;
+
+      // the whole list as changes that build it from an empty one: an
+      // append per goal, then the current goal if there is one. Applying
+      // all of them to an empty list at version() - size() brings it to
+      // version()
+      std::vector<GoalChange> snapshot() const;
+
+      // changes up to version v are no longer needed
+      void trim(uint16_t v);
+
+   private:
+      // position of a goal in the list, or -1
+      int find(int32_t id) const;
+
+      void log(int8_t operation, int32_t id, int32_t before, int32_t lat,
+            int32_t lon, bool from_avr = false);
+
+      // renumber the index from position i on
+      void reindex(size_t i);
+
+      std::vector<Goal> goals_;
+      // position of each goal in goals_
+      std::map<int32_t, size_t> by_id_;
+      int32_t next_id_;
+      int32_t current_;
+      uint16_t version_;
+
+      // changes after log_base_, up to version_
+      std::deque<GoalChange> log_;
+      uint16_t log_base_;
+};
+
+#endif
@@ -4,20 +4,18 @@
  * Author: Austin Hendrix
  */
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <termios.h>
 #include <math.h>
 #include <errno.h>
 
+#include <algorithm>
+#include <deque>
 #include <set>
 
 #include <ros/ros.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/LaserScan.h>
 #include <sensor_msgs/Range.h>
+#include <sensor_msgs/PointCloud2.h>
 #include <dagny_driver/NavSatFix.h>
 #include <nav_msgs/Odometry.h>
 #include <geometry_msgs/Twist.h>
@@ -30,48 +28,113 @@
 #include <std_msgs/UInt8.h>
 #include <diagnostic_msgs/DiagnosticArray.h>
 #include <dagny_driver/Goal.h>
+#include <dagny_driver/GoalList.h>
 #include <dagny_driver/Encoder.h>
 #include <dagny_driver/Battery.h>
 
 #include <diagnostic_updater/diagnostic_updater.h>
 
+#include <boost/thread.hpp>
+#include <boost/static_assert.hpp>
 
 #include "protocol.h"
-#include "steer.h"
+#include "protocol_v2.h"
+#include "dagny_driver/steer.h"
+#include "dagny_link.h"
+#include "message_pool.h"
+#include "driver.h"
+#include "latency_histogram.h"
+#include "odometry.h"
+#include "topic_publisher.h"
+#include "packets.h"
+#include "scan_summary.h"
+#include "goal_store.h"
+#include "imu_calibration.h"
+#include "heading_filter.h"
+#include "sonar_sweep.h"
+#include "watchdog.h"
 
 using namespace std;
 
-char laser_data[512];
-int laser_ready;
-
 // for publishing odometry and compass data
+// latest heading from the AVR; 'U' is always decoded, so this stays current
+// whether or not anyone is subscribed to heading
 float heading;
-ros::Publisher odo_pub;
-ros::Publisher sonar_pub;
-ros::Publisher gps_pub;
-ros::Publisher heading_pub;
-ros::Publisher bump_pub;
+TopicPublisher odo_pub;
+TopicPublisher gps_pub;
+TopicPublisher heading_pub;
+TopicPublisher bump_pub;
 
-ros::Publisher encoder_pub;
+TopicPublisher encoder_pub;
 
 // for publishing raw compass and IMU data
-ros::Publisher compass_pub;
-ros::Publisher imu_pub;
-ros::Publisher i2c_fail_pub;
-
-ros::Publisher battery_pub;
+TopicPublisher compass_pub;
+TopicPublisher imu_pub;
 
 // for publishing user input about goals
 ros::Publisher goal_input_pub;
 
 ros::Publisher diagnostics_pub;
 
-#define ROS_PERROR(str) ROS_ERROR("%s: %s", str, strerror(errno))
+#define NUM_SONARS 5
+
+// one AVR board. The sonars, battery monitor and I2C bus are on every
+// board; everything else is only on the main board, and lives in globals
+// below, fed by the handlers on the primary link
+class BoardLink : public DagnyLink {
+   public:
+      explicit BoardLink(const std::string & name) : DagnyLink(name),
+         idle_cnt(0), i2c_resets(0) {}
+
+      TopicPublisher sonar_pub;
+      // one pool per sonar, so that the frame_id never changes
+      MessagePool<sensor_msgs::Range> sonar_msgs[NUM_SONARS];
+      // all of the sonars at once, as points, once per sweep
+      SonarSweep sonar_sweep;
+      TopicPublisher sonar_points_pub;
+      MessagePool<sensor_msgs::PointCloud2> sonar_points_msgs;
+      ros::Publisher battery_pub;
+      TopicPublisher i2c_fail_pub;
+
+      uint16_t idle_cnt;
+      uint8_t i2c_resets;
+
+      void idle_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void i2c_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+      void sonar_diagnostics(
+            diagnostic_updater::DiagnosticStatusWrapper & stat);
+};
+
+// every link the driver runs. The first is the main board, on the
+// driver's own namespace; the others come from the links parameter, each
+// on a namespace of its own
+std::vector<BoardLink *> links;
+BoardLink * primary = 0;
+
+// time between acquisition and publish, per topic
+LatencyHistogram odom_latency;
+LatencyHistogram imu_latency;
+LatencyHistogram compass_latency;
+
+// queue a finished packet for the main board. Returns false if the
+// transmit queue for its class is full
+bool serial_write(TxClass c, const char * buf, int sz) {
+   return primary && primary->write(c, buf, sz);
+}
+
+bool serial_write(TxClass c, OutPacket & p) {
+   return serial_write(c, p.outbuf(), p.outsz());
+}
 
-int cmd_ready = 0;
 char cmd_buf[12];
-Packet cmd_packet('C', 12, cmd_buf);
-ros::Time last_cmd_t;
+OutPacket cmd_packet('C', 12, cmd_buf);
+
+// stops the robot if cmd_vel goes quiet, or on a bump
+CommandWatchdog cmd_watchdog;
+// stop when the bump switch closes, and stay stopped while it's closed
+// and until a stop command comes in
+bool bump_stop = true;
 
 // TODO: subscribe to ackermann_msgs::AckermannDrive too/instead
 void cmdCallback( const geometry_msgs::Twist::ConstPtr & cmd_vel ) {
@@ -110,100 +173,723 @@ void cmdCallback( const geometry_msgs::Twist::ConstPtr & cmd_vel ) {
       }
    }
 
-   last_cmd_t = ros::Time::now();
+   // after a bump, the watchdog holds the robot stopped until it's told
+   // to stop
+   if( !cmd_watchdog.allow(target_speed == 0) ) {
+      return;
+   }
 
    cmd_packet.reset();
    cmd_packet.append(target_speed);
    cmd_packet.append(steer);
    cmd_packet.finish();
-   cmd_ready = 1;
+   if( !serial_write(TX_URGENT, cmd_packet) ) {
+      ROS_ERROR("Failed to send cmd_vel data");
+      return;
+   }
+   cmd_watchdog.feed();
 }
 
-int goal_ready = 0;
-char goal_buf[32];
-Packet goal_packet('L', sizeof(goal_buf), goal_buf);
+// start the command watchdog on the main board, with a stop command for
+// the current protocol version
+bool watchdog_setup(ros::NodeHandle & n) {
+   int timeout_ms, priority;
+   n.param("cmd_timeout_ms", timeout_ms, 1000);
+   n.param("watchdog_priority", priority, 20);
+   n.param("bump_stop", bump_stop, true);
+   if( timeout_ms <= 0 ) {
+      ROS_ERROR("cmd_timeout_ms must be positive");
+      return false;
+   }
 
-void goalUpdateCallback( const dagny_driver::Goal::ConstPtr & goal) {
-   switch( goal->operation ) {
+   char buf[12];
+   OutPacket stop('C', sizeof(buf), buf);
+   stop.set_version(primary->protocol_version());
+   stop.reset();
+   stop.append(int16_t(0));
+   stop.append(int8_t(0));
+   stop.finish();
+   return cmd_watchdog.start(*primary, stop.outbuf(), stop.outsz(),
+         timeout_ms / 1000.0, priority);
+}
+
+// load a measured steering calibration, if there is one: steering_radius
+// is the turning radius at steering settings 0, steering_step, 2 *
+// steering_step, ...
+void steering_setup(ros::NodeHandle & n) {
+   std::vector<double> radius;
+   if( !n.getParam("steering_radius", radius) ) {
+      ROS_INFO("No steering calibration; using built-in table");
+      return;
+   }
+   int step;
+   n.param("steering_step", step, 10);
+   std::vector<float> r(radius.begin(), radius.end());
+   if( r.empty() || !steer_calibrate(&r[0], r.size(), step) ) {
+      ROS_ERROR("Bad steering calibration; using built-in table");
+      return;
+   }
+   ROS_INFO("Loaded steering calibration with %d points", (int)r.size());
+}
+
+// batched goal sync, from the goal_sync parameter. Without it the AVR owns
+// its goal list, as it always has: goal_updates only forwards SET_CURRENT,
+// and the AVR's edits are only relayed on goal_input
+bool goal_sync_enabled = false;
+
+// the goal list. The driver owns it; goal_updates and the AVR's own goal
+// input both edit it here, and the AVR's copy follows it through batches
+// of changes, acknowledged by version. Guarded by goal_mutex, since it's
+// edited from the subscriber, timer and publisher threads
+boost::mutex goal_mutex;
+GoalStore goals;
+
+// room for a batch header and a full batch of entries, all escaped
+char goal_buf[2 * (GoalPacket::SIZE + GoalBatchPacket::SIZE +
+      GOAL_BATCH_MAX * GoalEntryPacket::SIZE) + 8];
+OutPacket goal_packet('L', sizeof(goal_buf), goal_buf);
+BOOST_STATIC_ASSERT(sizeof(goal_buf) <= TX_FRAME_MAX);
+
+// batches in flight before waiting for an ack, and how long to wait for
+// one before sending everything since the last ack again
+#define GOAL_WINDOW 4
+#define GOAL_TIMEOUT 0.5
+
+// last version the AVR acked, and the version the batches sent so far
+// bring it to
+uint16_t goal_acked = 0;
+uint16_t goal_sent = 0;
+double goal_sent_time = 0.0;
+
+// the version each unacked batch brings the AVR to. An ack has to match
+// one of these; resent batches can end at different versions than the
+// first time round, so an ack for either counts
+std::deque<uint16_t> goal_batches;
+unsigned long goal_late_acks = 0;
+
+// while resetting, the AVR is sent a snapshot of the whole list, covering
+// the versions from goal_snap_base on, and then the changes since it. The
+// AVR has to ack the reset batch before any of its acks count
+bool goal_resetting = false;
+bool goal_reset_acked = false;
+bool goal_reset_sent = false;
+std::vector<GoalChange> goal_snapshot;
+uint16_t goal_snap_base = 0;
+unsigned long goal_resets = 0;
+
+ros::Publisher goal_list_pub;
+
+// start over with a snapshot. Call with goal_mutex held
+void goal_reset() {
+   goal_snapshot = goals.snapshot();
+   goal_snap_base = goals.version() - goal_snapshot.size();
+   goal_acked = goal_sent = goal_snap_base;
+   goal_batches.clear();
+   goal_resetting = true;
+   goal_reset_acked = false;
+   goal_reset_sent = false;
+   goals.trim(goals.version());
+   ++goal_resets;
+}
+
+// send whatever the window allows. Call with goal_mutex held
+void goal_sync(double now) {
+   if( goal_sent != goal_acked || (goal_resetting && !goal_reset_acked) ) {
+      if( now - goal_sent_time > GOAL_TIMEOUT ) {
+         goal_sent = goal_acked;
+         goal_reset_sent = false;
+      }
+   }
+
+   GoalChange batch[GOAL_BATCH_MAX];
+   while( (uint16_t)(goal_sent - goal_acked) <=
+         (GOAL_WINDOW - 1) * GOAL_BATCH_MAX ) {
+      GoalBatchPacket h;
+      h.flags = 0;
+      h.base = goal_sent;
+      int n;
+      uint16_t pos = goal_sent - goal_snap_base;
+      if( goal_resetting && pos < goal_snapshot.size() ) {
+         n = std::min((int)(goal_snapshot.size() - pos), GOAL_BATCH_MAX);
+         std::copy(goal_snapshot.begin() + pos,
+               goal_snapshot.begin() + pos + n, batch);
+      } else {
+         n = goals.changes(goal_sent, batch, GOAL_BATCH_MAX);
+         if( n < 0 ) {
+            // the log no longer reaches back to what the AVR has
+            ROS_WARN("AVR goal list fell behind; resending all goals");
+            goal_reset();
+            continue;
+         }
+
+         // the AVR made these changes itself, and counted them in its own
+         // version, so step over them. If it had everything before them,
+         // it has them too
+         int avr = 0;
+         while( avr < n && batch[avr].from_avr ) {
+            ++avr;
+         }
+         if( avr > 0 ) {
+            if( goal_acked == goal_sent ) {
+               goal_acked += avr;
+               goals.trim(goal_acked);
+            }
+            goal_sent += avr;
+            continue;
+         }
+         // and end the batch at the next of them
+         int ours = 1;
+         while( ours < n && !batch[ours].from_avr ) {
+            ++ours;
+         }
+         n = std::min(n, ours);
+      }
+      bool reset = goal_resetting && !goal_reset_sent &&
+         goal_sent == goal_snap_base;
+      if( n == 0 && !reset ) {
+         break;
+      }
+      if( reset ) {
+         h.flags |= GOAL_RESET;
+      }
+      h.n = n;
+
+      goal_packet.reset();
+      goal_packet.append((int8_t)GOAL_BATCH);
+      h.write(goal_packet);
+      for( int i=0; i<n; i++ ) {
+         GoalEntryPacket e;
+         e.operation = batch[i].operation;
+         e.id = batch[i].id;
+         e.before = batch[i].before;
+         e.lat = batch[i].lat;
+         e.lon = batch[i].lon;
+         e.write(goal_packet);
+      }
+      goal_packet.finish();
+      if( !serial_write(TX_CONTROL, goal_packet) ) {
+         // try again on the next sync
+         break;
+      }
+      if( reset ) {
+         goal_reset_sent = true;
+      }
+      goal_sent += n;
+      goal_sent_time = now;
+      if( std::find(goal_batches.begin(), goal_batches.end(), goal_sent) ==
+            goal_batches.end() ) {
+         goal_batches.push_back(goal_sent);
+      }
+   }
+}
+
+// the AVR has everything up to version, which should be where one of the
+// batches sent to it ends
+void goal_ack(uint16_t version, bool reset, double now) {
+   if( goal_resetting && !goal_reset_acked ) {
+      if( !reset ) {
+         // left over from before the reset
+         ++goal_late_acks;
+         return;
+      }
+      goal_reset_acked = true;
+   }
+   if( std::find(goal_batches.begin(), goal_batches.end(), version) ==
+         goal_batches.end() ) {
+      if( (uint16_t)(goal_acked - version) < 0x8000 ) {
+         // for a batch that has already been acked, or covered by a later
+         // ack; it was only slow getting here
+         ++goal_late_acks;
+         return;
+      }
+      ROS_WARN("AVR acked unknown goal version %d; resending all goals",
+            version);
+      goal_reset();
+      goal_sync(now);
+      return;
+   }
+
+   // everything up to version is done with
+   uint16_t acked = version - goal_acked;
+   std::deque<uint16_t> waiting;
+   for( size_t i=0; i<goal_batches.size(); i++ ) {
+      if( (uint16_t)(goal_batches[i] - goal_acked) > acked ) {
+         waiting.push_back(goal_batches[i]);
+      }
+   }
+   goal_batches.swap(waiting);
+   goal_acked = version;
+   goal_sent_time = now;
+   if( goal_resetting &&
+         (uint16_t)(goal_acked - goal_snap_base) >= goal_snapshot.size() ) {
+      goal_resetting = false;
+      goal_snapshot.clear();
+   }
+   if( !goal_resetting ) {
+      goals.trim(goal_acked);
+   }
+   goal_sync(now);
+}
+
+// the whole list, for the latched goals topic. Call with goal_mutex held
+dagny_driver::GoalList::Ptr goal_list() {
+   dagny_driver::GoalList::Ptr list(new dagny_driver::GoalList());
+   list->header.stamp = ros::Time::now();
+   list->version = goals.version();
+   list->current = goals.current();
+   const std::vector<Goal> & g = goals.goals();
+   list->ids.resize(g.size());
+   list->goals.resize(g.size());
+   for( size_t i=0; i<g.size(); i++ ) {
+      list->ids[i] = g[i].id;
+      list->goals[i].latitude = g[i].lat / 1000000.0;
+      list->goals[i].longitude = g[i].lon / 1000000.0;
+   }
+   return list;
+}
+
+// without goal sync, only the current goal goes to the AVR
+void goal_forward(const dagny_driver::Goal & goal) {
+   switch( goal.operation ) {
       case dagny_driver::Goal::SET_CURRENT:
          goal_packet.reset();
-         goal_packet.append(goal->operation);
-         goal_packet.append(goal->id);
+         goal_packet.append(goal.operation);
+         goal_packet.append(goal.id);
          goal_packet.finish();
-         goal_ready = 1;
+         if( !serial_write(TX_CONTROL, goal_packet) ) {
+            ROS_ERROR("Failed to send goal update");
+         }
          break;
       default:
-         ROS_ERROR("Unknown goal update: %d", goal->operation);
+         ROS_ERROR("Unknown goal update: %d", goal.operation);
          break;
    }
-   return;
 }
 
-int compass_cal_ready = 0;
+void goalUpdateCallback( const dagny_driver::Goal::ConstPtr & goal) {
+   if( !goal_sync_enabled ) {
+      goal_forward(*goal);
+      return;
+   }
+
+   int32_t lat = lround(goal->goal.latitude * 1000000.0);
+   int32_t lon = lround(goal->goal.longitude * 1000000.0);
+   dagny_driver::GoalList::Ptr list;
+   {
+      boost::mutex::scoped_lock lock(goal_mutex);
+      bool ok;
+      switch( goal->operation ) {
+         case dagny_driver::Goal::APPEND:
+            ok = goals.append(lat, lon) != 0;
+            break;
+         case dagny_driver::Goal::INSERT:
+            // id is the goal to insert in front of
+            ok = goals.insert(goal->id, lat, lon) != 0;
+            break;
+         case dagny_driver::Goal::UPDATE:
+            ok = goals.update(goal->id, lat, lon);
+            break;
+         case dagny_driver::Goal::DELETE:
+            ok = goals.remove(goal->id);
+            break;
+         case dagny_driver::Goal::SET_CURRENT:
+            ok = goals.set_current(goal->id);
+            break;
+         default:
+            ROS_ERROR("Unknown goal update: %d", goal->operation);
+            return;
+      }
+      if( !ok ) {
+         ROS_ERROR("Goal update %d: no goal %d", goal->operation, goal->id);
+         return;
+      }
+      goal_sync(ros::WallTime::now().toSec());
+      list = goal_list();
+   }
+   goal_list_pub.publish(list);
+}
+
+// after a change made on the AVR. If the AVR is in the middle of a reset,
+// that change was made to a list it's throwing away, so the reset has to
+// start over and include it. Call with goal_mutex held
+void goal_avr_change(double now) {
+   if( goal_resetting ) {
+      goal_reset();
+   }
+   goal_sync(now);
+}
+
+void goalSyncCallback( const ros::TimerEvent & e ) {
+   boost::mutex::scoped_lock lock(goal_mutex);
+   goal_sync(ros::WallTime::now().toSec());
+}
+
+// IMU and compass offsets for the AVR, which it subtracts from every
+// sample: gyro x, y, z and accelerometer x, y, z, and compass x, y, z.
+// These come from parameters, the imu_cal and compass_cal topics, or the
+// online calibration, and are what the AVR was last sent; the calibration
+// results are residuals on top of them. Until one of those sets them we
+// don't know what the AVR is applying, and nothing is sent, so that the
+// calibration stored on the board is kept. Guarded by cal_mutex, along
+// with the packets
+boost::mutex cal_mutex;
+double imu_offsets[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+double compass_offsets[3] = { 0.0, 0.0, 0.0 };
+bool imu_offsets_known = false;
+bool compass_offsets_known = false;
+
 char compass_cal_buf[128];
-Packet compass_cal_packet('O', sizeof(compass_cal_buf), compass_cal_buf);
+OutPacket compass_cal_packet('O', sizeof(compass_cal_buf), compass_cal_buf);
 
-void compassCalCallback( const geometry_msgs::Vector3::ConstPtr & msg ) {
+// send compass_offsets. Call with cal_mutex held
+void send_compass_cal() {
    compass_cal_packet.reset();
-   compass_cal_packet.append((float)msg->x);
-   compass_cal_packet.append((float)msg->y);
-   compass_cal_packet.append((float)msg->z);
+   compass_cal_packet.append((float)compass_offsets[0]);
+   compass_cal_packet.append((float)compass_offsets[1]);
+   compass_cal_packet.append((float)compass_offsets[2]);
    compass_cal_packet.finish();
-   compass_cal_ready = 1;
+   if( !serial_write(TX_CONTROL, compass_cal_packet) ) {
+      ROS_ERROR("Failed to send compass update");
+   }
+}
+
+void compassCalCallback( const geometry_msgs::Vector3::ConstPtr & msg ) {
+   boost::mutex::scoped_lock lock(cal_mutex);
+   compass_offsets[0] = msg->x;
+   compass_offsets[1] = msg->y;
+   compass_offsets[2] = msg->z;
+   compass_offsets_known = true;
+   send_compass_cal();
 }
 
-int imu_cal_ready = 0;
 char imu_cal_buf[128]; // 6 * 4(float) * 2(escape) = 48 bytes max
-Packet imu_cal_packet('I', sizeof(imu_cal_buf), imu_cal_buf);
+OutPacket imu_cal_packet('I', sizeof(imu_cal_buf), imu_cal_buf);
 
-void imuCalCallback( const geometry_msgs::Twist::ConstPtr & msg ) {
+// send imu_offsets. Call with cal_mutex held
+void send_imu_cal() {
    imu_cal_packet.reset();
-   imu_cal_packet.append((float)msg->angular.x);
-   imu_cal_packet.append((float)msg->angular.y);
-   imu_cal_packet.append((float)msg->angular.z);
-   imu_cal_packet.append((float)msg->linear.x);
-   imu_cal_packet.append((float)msg->linear.y);
-   imu_cal_packet.append((float)msg->linear.z);
+   for( int i=0; i<6; i++ ) {
+      imu_cal_packet.append((float)imu_offsets[i]);
+   }
    imu_cal_packet.finish();
-   imu_cal_ready = 1;
+   if( !serial_write(TX_CONTROL, imu_cal_packet) ) {
+      ROS_ERROR("Failed to send imu update");
+   }
+}
+
+void imuCalCallback( const geometry_msgs::Twist::ConstPtr & msg ) {
+   boost::mutex::scoped_lock lock(cal_mutex);
+   imu_offsets[0] = msg->angular.x;
+   imu_offsets[1] = msg->angular.y;
+   imu_offsets[2] = msg->angular.z;
+   imu_offsets[3] = msg->linear.x;
+   imu_offsets[4] = msg->linear.y;
+   imu_offsets[5] = msg->linear.z;
+   imu_offsets_known = true;
+   send_imu_cal();
+}
+
+// online calibration (see imu_calibration.h). The calibrators themselves
+// are only touched by the publish thread; the diagnostics get copies of
+// what they need, and the update counts, under cal_mutex
+bool imu_calibrate = false;
+bool imu_cal_accel = false;
+double imu_cal_gyro_threshold = 0.0005;
+double imu_cal_accel_threshold = 0.05;
+ImuCalibrator imu_cal;
+unsigned long imu_cal_windows = 0;
+unsigned long imu_cal_updates = 0;
+// noise from the last window, for the IMU messages; read by the publish
+// thread only
+bool imu_cov_known = false;
+double gyro_cov[9];
+double accel_cov[9];
+
+bool compass_calibrate = false;
+double compass_cal_threshold = 0.02;
+CompassCalibrator compass_cal;
+unsigned long compass_fits = 0;
+unsigned long compass_cal_updates = 0;
+double compass_axis_ratio = 0.0;
+// soft iron correction for the published compass readings; identity until
+// the first fit
+double compass_soft[4] = { 1.0, 0.0, 0.0, 1.0 };
+// hard iron center taken out on the host, on top of whatever the AVR's own
+// offsets take out; from compass_center until the first fit, and then the
+// center of any fit that isn't sent to the AVR. Only touched by the
+// publish thread once the driver is running
+double compass_center[2] = { 0.0, 0.0 };
+// ignore readings until then, while new offsets reach the AVR
+double compass_settle = 0.0;
+
+#define GRAVITY 9.81
+
+// whether the wheels were standing still as of the last odometry packet
+bool wheels_stopped = false;
+
+// calibration parameters; before the handlers are set up, since the
+// calibration needs every sample
+void calibration_config(ros::NodeHandle & n) {
+   n.param("imu_calibrate", imu_calibrate, true);
+   n.param("imu_cal_accel", imu_cal_accel, false);
+   int samples;
+   double still;
+   n.param("imu_cal_samples", samples, 500);
+   n.param("imu_cal_still", still, 0.2);
+   n.param("imu_cal_gyro_threshold", imu_cal_gyro_threshold, 0.0005);
+   n.param("imu_cal_accel_threshold", imu_cal_accel_threshold, 0.05);
+   imu_cal.configure(samples, still);
+
+   n.param("compass_calibrate", compass_calibrate, true);
+   int bins;
+   double ratio;
+   n.param("compass_cal_samples", samples, 200);
+   n.param("compass_cal_bins", bins, 12);
+   n.param("compass_cal_ratio", ratio, 2.0);
+   n.param("compass_cal_threshold", compass_cal_threshold, 0.02);
+   compass_cal.configure(samples, bins, ratio);
+   compass_cal.reset();
+
+   std::vector<double> center;
+   if( n.getParam("compass_center", center) ) {
+      if( center.size() == 2 ) {
+         compass_center[0] = center[0];
+         compass_center[1] = center[1];
+      } else {
+         ROS_ERROR("compass_center needs 2 values; ignoring it");
+      }
+   }
+}
+
+// starting offsets, if they're set; they replace whatever the AVR had, so
+// that we know what it's applying
+void calibration_setup(ros::NodeHandle & n) {
+   std::vector<double> offsets;
+   boost::mutex::scoped_lock lock(cal_mutex);
+   if( n.getParam("imu_offsets", offsets) ) {
+      if( offsets.size() == 6 ) {
+         std::copy(offsets.begin(), offsets.end(), imu_offsets);
+         imu_offsets_known = true;
+         send_imu_cal();
+      } else {
+         ROS_ERROR("imu_offsets needs 6 values; keeping the AVR's");
+      }
+   }
+   if( n.getParam("compass_offsets", offsets) ) {
+      if( offsets.size() == 3 ) {
+         std::copy(offsets.begin(), offsets.end(), compass_offsets);
+         compass_offsets_known = true;
+         send_compass_cal();
+      } else {
+         ROS_ERROR("compass_offsets needs 3 values; keeping the AVR's");
+      }
+   }
+}
+
+// feed one IMU sample to the calibration, and send new offsets when a
+// window gives biases that are different enough
+void imu_calibration(float gx, float gy, float gz, float ax, float ay,
+      float az) {
+   double g[3] = { gx, gy, gz };
+   double a[3] = { ax, ay, az };
+   if( !imu_cal.update(g, a, wheels_stopped) ) {
+      return;
+   }
+   memcpy(gyro_cov, imu_cal.gyro_covariance(), sizeof(gyro_cov));
+   memcpy(accel_cov, imu_cal.accel_covariance(), sizeof(accel_cov));
+   imu_cov_known = true;
+
+   // the accelerometer should read gravity straight down; anything else
+   // is bias, as long as the ground is level
+   const double * bias = imu_cal.gyro_bias();
+   double accel[3];
+   memcpy(accel, imu_cal.accel_mean(), sizeof(accel));
+   accel[2] += GRAVITY;
+   bool gyro_changed = false;
+   bool accel_changed = false;
+   for( int i=0; i<3; i++ ) {
+      gyro_changed |= fabs(bias[i]) > imu_cal_gyro_threshold;
+      accel_changed |= fabs(accel[i]) > imu_cal_accel_threshold;
+   }
+   accel_changed &= imu_cal_accel;
+
+   boost::mutex::scoped_lock lock(cal_mutex);
+   imu_cal_windows = imu_cal.windows();
+   if( !gyro_changed && !accel_changed ) {
+      return;
+   }
+   if( !imu_offsets_known ) {
+      // a residual on top of offsets we don't know can't be sent
+      ROS_WARN_ONCE("IMU biases found, but the AVR's offsets are unknown; "
+            "set imu_offsets to let the driver correct them");
+      return;
+   }
+   for( int i=0; i<3; i++ ) {
+      if( gyro_changed ) {
+         imu_offsets[i] += bias[i];
+      }
+      if( accel_changed ) {
+         imu_offsets[i + 3] += accel[i];
+      }
+   }
+   ROS_INFO("IMU calibration: gyro bias %f %f %f, accel bias %f %f %f",
+         imu_offsets[0], imu_offsets[1], imu_offsets[2], imu_offsets[3],
+         imu_offsets[4], imu_offsets[5]);
+   send_imu_cal();
+   ++imu_cal_updates;
+}
+
+// how often to try a compass fit, in samples
+#define COMPASS_FIT_INTERVAL 50
+// give up on a fit that hasn't come together after this many intervals,
+// so that stale readings don't pile up
+#define COMPASS_FIT_MAX 40
+
+// feed one compass reading to the calibration, and send new hard iron
+// offsets when a fit moves the center far enough
+void compass_calibration(float x, float y, double now) {
+   if( now < compass_settle ) {
+      return;
+   }
+   compass_cal.update(x, y);
+   unsigned long n = compass_cal.samples();
+   if( n % COMPASS_FIT_INTERVAL != 0 ) {
+      return;
+   }
+   if( !compass_cal.solve() ) {
+      if( n >= COMPASS_FIT_INTERVAL * COMPASS_FIT_MAX ) {
+         // measure directions around the middle of what we've seen, in
+         // case the last center was too far off to tell a full turn
+         compass_cal.reset(compass_cal.mean_x(), compass_cal.mean_y());
+      }
+      return;
+   }
+   // the soft iron fit is about the fit's center, so that has to come out
+   // of the readings before it's applied: on the host unless it's sent to
+   // the AVR below. The readings are the AVR's, so the center replaces
+   // compass_center instead of adding to it
+   memcpy(compass_soft, compass_cal.soft_iron(), sizeof(compass_soft));
+   double cx = compass_cal.center_x();
+   double cy = compass_cal.center_y();
+   compass_center[0] = cx;
+   compass_center[1] = cy;
+   {
+      boost::mutex::scoped_lock lock(cal_mutex);
+      ++compass_fits;
+      compass_axis_ratio = compass_cal.axis_ratio();
+      if( hypot(cx, cy) < compass_cal_threshold * compass_cal.radius() ) {
+         compass_cal.reset(cx, cy);
+         return;
+      }
+      if( !compass_offsets_known ) {
+         ROS_WARN_ONCE("Compass hard iron offset found, but the AVR's "
+               "offsets are unknown; set compass_offsets to let the driver "
+               "correct them");
+         compass_cal.reset(cx, cy);
+         return;
+      }
+      compass_offsets[0] += cx;
+      compass_offsets[1] += cy;
+      ROS_INFO("Compass calibration: hard iron %f %f, axis ratio %f",
+            compass_offsets[0], compass_offsets[1], compass_axis_ratio);
+      send_compass_cal();
+      ++compass_cal_updates;
+   }
+   // readings are centered from here on, once the AVR has the offsets
+   compass_center[0] = compass_center[1] = 0.0;
+   compass_cal.reset();
+   compass_settle = now + 0.5;
 }
 
-int steering_offset_ready = 0;
 char steering_offset_buf[128]; // 6 * 4(float) * 2(escape) = 48 bytes max
-Packet steering_offset_packet('S', sizeof(steering_offset_buf), steering_offset_buf);
+OutPacket steering_offset_packet('S', sizeof(steering_offset_buf), steering_offset_buf);
 
 void steeringOffsetCallback( const std_msgs::Int8::ConstPtr & msg ) {
    steering_offset_packet.reset();
    steering_offset_packet.append(msg->data);
    steering_offset_packet.finish();
-   steering_offset_ready = 1;
+   if( !serial_write(TX_CONTROL, steering_offset_packet) ) {
+      ROS_ERROR("Failed to send steering offset");
+   }
+}
+
+// laser obstacle summaries for the AVR; room for the header and the
+// longest encoding, all escaped
+ScanSummary scan_summary;
+char laser_buf[2 * (LaserSummaryPacket::SIZE + SCAN_ENCODED_MAX) + 8];
+OutPacket laser_packet('A', sizeof(laser_buf), laser_buf);
+BOOST_STATIC_ASSERT(sizeof(laser_buf) <= TX_FRAME_MAX);
+
+// scans received, and summaries sent; only touched by the callbacks
+unsigned long laser_scans = 0;
+unsigned long laser_summaries = 0;
+
+void laser_setup(ros::NodeHandle & n) {
+   int sectors, threshold;
+   double resolution, keepalive;
+   n.param("laser_sectors", sectors, 32);
+   n.param("laser_resolution", resolution, 0.05);
+   n.param("laser_threshold", threshold, 2);
+   n.param("laser_keepalive", keepalive, 1.0);
+   if( sectors < 1 || sectors > SCAN_SECTORS_MAX ) {
+      ROS_WARN("laser_sectors must be between 1 and %d; using 32",
+            SCAN_SECTORS_MAX);
+      sectors = 32;
+   }
+   // the AVR gets the resolution in whole centimeters
+   if( resolution < 0.01 || resolution > 2.55 ) {
+      ROS_WARN("laser_resolution must be between 0.01 and 2.55; using 0.05");
+      resolution = 0.05;
+   }
+   resolution = round(resolution * 100.0) / 100.0;
+   scan_summary.configure(sectors, resolution, threshold, keepalive);
 }
 
-#define handler(foo) void foo(Packet & p)
-typedef void (*handler_ptr)(Packet & p);
+void laserCallback( const sensor_msgs::LaserScan::ConstPtr & scan ) {
+   ++laser_scans;
+   if( scan->ranges.empty() ||
+         !scan_summary.update(&scan->ranges[0], scan->ranges.size(),
+            scan->range_min, scan->range_max, scan->angle_min,
+            scan->angle_increment, scan->header.stamp.toSec()) ) {
+      return;
+   }
 
-handler_ptr handlers[256];
+   LaserSummaryPacket h;
+   h.sectors = scan_summary.n_sectors();
+   h.resolution_cm = lround(scan_summary.resolution() * 100.0f);
+   h.angle_min = lround(scan_summary.angle_min() * 1000.0f);
+   h.sector_width = lround(scan_summary.sector_width() * 1000.0f);
 
-handler(no_handler) {
-   int l = p.outsz();
-   const char * in = p.outbuf();
-   char * buf = (char*)malloc(l + 1);
-   memcpy(buf, in, l);
-   buf[l] = 0;
+   uint8_t encoded[SCAN_ENCODED_MAX];
+   int len = scan_summary.encode(encoded);
 
-   char * tmpbuf = (char*)malloc(5*l + 1);
-   int i;
-   for( i=0; i<l; i++ ) {
-      sprintf(tmpbuf + (i*5), "0x%02X ", 0xFF & buf[i+1]);
+   laser_packet.reset();
+   h.write(laser_packet);
+   for( int i=0; i<len; i++ ) {
+      laser_packet.append(encoded[i]);
+   }
+   laser_packet.finish();
+   if( !serial_write(TX_CONTROL, laser_packet) ) {
+      ROS_ERROR("Failed to send laser summary");
+      return;
    }
-   tmpbuf[i*5] = 0;
+   ++laser_summaries;
+}
 
-   ROS_INFO("No handler for message: %02X(%d) %s", buf[0], l, tmpbuf);
+// handlers are templates over the packet reader; the link only installs the
+// PacketV2 form, since it unescapes v1 frames before dispatch
+#define handler(foo) template<class P> void foo(BoardLink & link, P & p)
 
-   free(buf);
-   free(tmpbuf);
+// adapts a handler to the link's handler table
+template<class P, void (*F)(BoardLink &, P &)>
+void board_handler(DagnyLink & link, P & p) {
+   F(static_cast<BoardLink &>(link), p);
 }
 
+// install a handler; the one PacketV2 form serves both protocol versions
+#define set_handler(link, type, foo) \
+   (link).set_handler(type, board_handler<PacketV2, foo<PacketV2> >)
+
 handler(shutdown_h) {
    int l = p.outsz();
    const char * in = p.outbuf();
@@ -230,22 +916,30 @@ handler(shutdown_h) {
 
 ros::Time last_gps;
 
+// gps packets that nobody is subscribed to still count as a fix
+void gps_skip(DagnyLink & link) {
+   last_gps = link.packet_time();
+}
+
 handler(gps_h) {
-   // message format
-   // int32_t lat
-   // int32_t lon
-   int32_t lat = p.reads32();
-   int32_t lon = p.reads32();
-   //ROS_INFO("GPS lat: %d lon: %d", lat, lon);
+   GpsPacket g;
+   if( !link.decode(p, g) ) {
+      return;
+   }
+   last_gps = link.packet_time();
+   if( !gps_pub.wanted(link.packet_time()) ) {
+      return;
+   }
+
+   //ROS_INFO("GPS lat: %d lon: %d", g.lat, g.lon);
    dagny_driver::NavSatFix gps;
-   gps.header.stamp = ros::Time::now();
+   gps.header.stamp = link.packet_time();
    gps.header.frame_id = "gps";
-   gps.latitude = lat / 1000000.0;
-   gps.longitude = lon / 1000000.0;
+   gps.latitude = g.lat / 1000000.0;
+   gps.longitude = g.lon / 1000000.0;
 
    // pass altitude up from driver
-   int32_t altitude = p.reads32(); // altitude in centimeters
-   gps.altitude = altitude / 100.0;
+   gps.altitude = g.altitude / 100.0;
 
 
    // fill in static data
@@ -254,13 +948,12 @@ handler(gps_h) {
       dagny_driver::NavSatFix::COVARIANCE_TYPE_UNKNOWN;
 
    // pass HDOP up from driver
-   uint32_t hdop_100 = p.readu32(); // HDOP * 100
-   double hdop = hdop_100 / 100.0;
+   double hdop = g.hdop_100 / 100.0;
    // covariance from HDOP calculation borrowd from nmea_navsat driver
    gps.position_covariance[0] = hdop*hdop;
    gps.position_covariance[4] = hdop*hdop;
    gps.position_covariance[8] = (2*hdop)*(2*hdop); // FIXME
-   if( hdop_100 == 0 ) {
+   if( g.hdop_100 == 0 ) {
       gps.position_covariance_type =
          dagny_driver::NavSatFix::COVARIANCE_TYPE_UNKNOWN;
    } else {
@@ -268,15 +961,11 @@ handler(gps_h) {
          dagny_driver::NavSatFix::COVARIANCE_TYPE_APPROXIMATED;
    }
 
-   // pass speed and course
-   uint32_t speed_knots_100 = p.readu32(); // speed in hundreths of a knot
-   uint32_t course_100 = p.readu32(); // course in hundredths of a degree
-
    // convert course to radians
    // course is NED (north: 0deg, East: 90deg)
-   double course = (course_100 / 100.0) * M_PI / 180.0;
+   double course = (g.course_100 / 100.0) * M_PI / 180.0;
    // convert knots to m/s
-   double speed = (speed_knots_100 / 100.0) * 0.514444;
+   double speed = (g.speed_100 / 100.0) * 0.514444;
 
    gps.speed = speed;
    double speed_cov = 1.0; // speed within 1m/s
@@ -301,136 +990,378 @@ handler(gps_h) {
 
    // publish
    gps_pub.publish(gps);
-   last_gps = ros::Time::now();
 }
 
-// set up odometry handling
-void odometry_setup(void) {
-}
+MessagePool<nav_msgs::Odometry> odo_msgs;
+MessagePool<std_msgs::Bool> bump_msgs;
+MessagePool<dagny_driver::Encoder> encoder_msgs;
+tf::TransformBroadcaster * odom_tf = 0;
+std::vector<geometry_msgs::TransformStamped> odom_transform(1);
 
-// squares per encoder count
-#define Q_SCALE 0.29
+// integrate odometry here instead of forwarding the AVR's pose
+bool host_odometry = false;
+OdometryIntegrator odometry;
+
+// variance for the pose and twist dimensions we don't estimate
+#define ODOM_UNKNOWN_VAR 1e6
+
+// set up odometry handling
+void odometry_setup(ros::NodeHandle & n) {
+   n.param("host_odometry", host_odometry, false);
+   double meters_per_count, distance_var, curvature_var;
+   n.param("odom_meters_per_count", meters_per_count, 0.08);
+   n.param("odom_distance_var", distance_var, 0.01);
+   n.param("odom_curvature_var", curvature_var, 0.01);
+   odometry.configure(meters_per_count, distance_var, curvature_var);
+   odometry.reset();
 
-handler(odometry_h) {
-   static tf::TransformBroadcaster odom_tf;
-   // message format:
-   // float linear
-   // float angular
-   // float x
-   // float y
-   // float yaw
    nav_msgs::Odometry odo_msg;
-   odo_msg.header.stamp = ros::Time::now();
    odo_msg.header.frame_id = "odom";
    odo_msg.child_frame_id = "base_link";
-   odo_msg.twist.twist.linear.x = p.readfloat();
-   odo_msg.twist.twist.angular.z = p.readfloat();
-   odo_msg.pose.pose.position.x = p.readfloat();
-   odo_msg.pose.pose.position.y = p.readfloat();
-   float yaw = p.readfloat();
-   odo_msg.pose.pose.orientation = tf::createQuaternionMsgFromYaw(yaw);
-
-   odo_pub.publish(odo_msg);
-
-   // tf transform
-   geometry_msgs::TransformStamped transform;
-   transform.header = odo_msg.header;
-   transform.child_frame_id = odo_msg.child_frame_id;
-   transform.transform.translation.x = odo_msg.pose.pose.position.x;
-   transform.transform.translation.y = odo_msg.pose.pose.position.y;
-   transform.transform.translation.z = odo_msg.pose.pose.position.z;
-   transform.transform.rotation = odo_msg.pose.pose.orientation;
-   odom_tf.sendTransform(transform);
-
-   uint8_t b = p.readu8();
-   std_msgs::Bool bump;
-   bump.data = (b != 0);
-   bump_pub.publish(bump);
-
-   int16_t qcount = p.reads16();
-   int8_t steer = p.reads8();
+   if( host_odometry ) {
+      // z, roll and pitch in the pose; y, z, roll and pitch in the twist
+      for( int i=2; i<5; ++i ) {
+         odo_msg.pose.covariance[i*6 + i] = ODOM_UNKNOWN_VAR;
+      }
+      for( int i=1; i<5; ++i ) {
+         odo_msg.twist.covariance[i*6 + i] = ODOM_UNKNOWN_VAR;
+      }
+   }
+   odo_msgs.init(odo_msg);
 
    dagny_driver::Encoder enc_msg;
-   enc_msg.header = odo_msg.header;
-   enc_msg.count = qcount;
-   enc_msg.steer = steer;
-   encoder_pub.publish(enc_msg);
+   enc_msg.header.frame_id = "odom";
+   encoder_msgs.init(enc_msg);
+
+   odom_transform[0].header.frame_id = "odom";
+   odom_transform[0].child_frame_id = "base_link";
+   // the broadcaster advertises a topic, so it can't be created before
+   // ros::init()
+   if( !odom_tf ) {
+      odom_tf = new tf::TransformBroadcaster();
+   }
 }
 
-uint16_t idle_cnt;
-uint8_t i2c_resets;
+// squares per encoder count
+#define Q_SCALE 0.29
+
+handler(odometry_h) {
+   // OdometryPacket, then
+   // uint32_t tick (with time sync)
+   OdometryPacket o;
+   if( !link.decode(p, o) ) {
+      return;
+   }
+   double linear = o.linear;
+   double angular = o.angular;
+   double x = o.x;
+   double y = o.y;
+   double yaw = o.yaw;
+   uint8_t b = o.bump;
+   int16_t qcount = o.qcount;
+   int8_t steer = o.steer;
+
+   ros::Time now = link.acquisition_time(p);
+
+   if( host_odometry ) {
+      odometry.update(qcount, steer, now.toSec());
+      linear = odometry.linear();
+      angular = odometry.angular();
+      x = odometry.x();
+      y = odometry.y();
+      yaw = odometry.yaw();
+   }
+   wheels_stopped = fabs(linear) < 1e-3;
+
+   // stop before anything else, so that the stop is queued within this
+   // packet
+   if( bump_stop ) {
+      cmd_watchdog.hold(b != 0);
+   }
+   geometry_msgs::Quaternion orientation =
+      tf::createQuaternionMsgFromYaw(yaw);
+
+   // tf goes out for every packet, whether or not anyone wants odom
+   geometry_msgs::TransformStamped & transform = odom_transform[0];
+   transform.header.stamp = now;
+   transform.transform.translation.x = x;
+   transform.transform.translation.y = y;
+   transform.transform.translation.z = 0.0;
+   transform.transform.rotation = orientation;
+   odom_tf->sendTransform(odom_transform);
+
+   if( odo_pub.wanted(now) ) {
+      nav_msgs::Odometry::Ptr odo_msg = odo_msgs.get();
+      odo_msg->header.stamp = now;
+      odo_msg->twist.twist.linear.x = linear;
+      odo_msg->twist.twist.angular.z = angular;
+      odo_msg->pose.pose.position.x = x;
+      odo_msg->pose.pose.position.y = y;
+      odo_msg->pose.pose.orientation = orientation;
+
+      if( host_odometry ) {
+         // (x, y, yaw) are rows and columns 0, 1 and 5 of the 6x6
+         // covariance
+         static const int index[3] = { 0, 1, 5 };
+         const double * cov = odometry.covariance();
+         for( int i=0; i<3; ++i ) {
+            for( int j=0; j<3; ++j ) {
+               odo_msg->pose.covariance[index[i]*6 + index[j]] =
+                  cov[i*3 + j];
+            }
+         }
+         odo_msg->twist.covariance[0] = odometry.linear_var();
+         odo_msg->twist.covariance[35] = odometry.angular_var();
+      }
+
+      odo_pub.publish(odo_msg);
+      odom_latency.record((ros::Time::now() - now).toSec());
+   }
+
+   if( bump_pub.wanted(now) ) {
+      std_msgs::Bool::Ptr bump = bump_msgs.get();
+      bump->data = (b != 0);
+      bump_pub.publish(bump);
+   }
+
+   if( encoder_pub.wanted(now) ) {
+      dagny_driver::Encoder::Ptr enc_msg = encoder_msgs.get();
+      enc_msg->header.stamp = now;
+      enc_msg->count = qcount;
+      enc_msg->steer = steer;
+      encoder_pub.publish(enc_msg);
+   }
+}
 
 handler(idle_h) {
-   // idle message format:
-   // uint16_t idle
-   // uint8_t i2c_failures
-   // uint8_t i2c_resets
-   idle_cnt = p.readu16();
-   std_msgs::UInt8 i2c_fail;
-   i2c_fail.data = p.readu8();
-   i2c_resets = p.readu8();
-   //ROS_INFO("I2C state: %d", p.readu8());
-   i2c_fail_pub.publish(i2c_fail);
+   IdlePacket idle;
+   if( !link.decode(p, idle) ) {
+      return;
+   }
+   link.idle_cnt = idle.idle;
+   link.i2c_resets = idle.i2c_resets;
+   if( link.i2c_fail_pub.wanted(link.packet_time()) ) {
+      std_msgs::UInt8 i2c_fail;
+      i2c_fail.data = idle.i2c_failures;
+      link.i2c_fail_pub.publish(i2c_fail);
+   }
 }
 
-#define NUM_SONARS 5
-handler(sonar_h) {
-   // sonar message format:
-   // uint8_t[5] sonars
-   char sonar_frames[5][8] = { "sonar_1", "sonar_2", "sonar_3", "sonar_4", "sonar_5" };
-   uint8_t s;
-   ros::Time n = ros::Time::now();
+// sonar mountings on base_link, from dagny.urdf: x, y, z and yaw
+const SonarMount default_sonar_mounts[NUM_SONARS] = {
+   {  0.38f, -0.06f, 0.10f, -0.7854f }, // front right
+   {  0.40f,  0.00f, 0.10f,  0.0f },    // front center
+   {  0.38f,  0.06f, 0.10f,  0.7854f }, // front left
+   { -0.12f,  0.05f, 0.10f,  2.74f },   // rear left
+   { -0.12f, -0.05f, 0.10f, -2.74f },   // rear right
+};
+
+void sonar_setup(BoardLink & link, ros::NodeHandle & n) {
+   const char * sonar_frames[NUM_SONARS] = { "sonar_1", "sonar_2", "sonar_3",
+      "sonar_4", "sonar_5" };
    sensor_msgs::Range sonar;
-   int i = p.readu8();
-   s = p.readu8();
-   sonar.range = s * 0.0254; // convert inches to m
    sonar.min_range = 6 * 0.0254;
    sonar.max_range = 255 * 0.0254;
    sonar.field_of_view = 45 * M_PI / 180.0; // approx 45-degree FOV
    sonar.radiation_type = sensor_msgs::Range::ULTRASOUND;
+   for( int i=0; i<NUM_SONARS; i++ ) {
+      sonar.header.frame_id = sonar_frames[i];
+      link.sonar_msgs[i].init(sonar);
+   }
 
-   sonar.header.stamp = n;
-   sonar.header.frame_id = sonar_frames[i];
+   // sonar_mounts overrides the mountings, as x, y, z, yaw for each sonar
+   SonarMount mounts[NUM_SONARS];
+   std::copy(default_sonar_mounts, default_sonar_mounts + NUM_SONARS,
+         mounts);
+   std::vector<double> m;
+   if( n.getParam("sonar_mounts", m) ) {
+      if( m.size() == NUM_SONARS * 4 ) {
+         for( int i=0; i<NUM_SONARS; i++ ) {
+            mounts[i].x = m[i*4];
+            mounts[i].y = m[i*4 + 1];
+            mounts[i].z = m[i*4 + 2];
+            mounts[i].yaw = m[i*4 + 3];
+         }
+      } else {
+         ROS_ERROR("sonar_mounts needs %d values; using defaults",
+               NUM_SONARS * 4);
+      }
+   }
+   double timeout;
+   n.param("sonar_sweep_timeout", timeout, 0.5);
+   link.sonar_sweep.configure(NUM_SONARS, mounts, sonar.min_range,
+         sonar.max_range, timeout);
+
+   sensor_msgs::PointCloud2 cloud;
+   cloud.header.frame_id = "base_link";
+   cloud.height = 1;
+   cloud.is_bigendian = false;
+   cloud.is_dense = true;
+   cloud.point_step = 3 * sizeof(float);
+   const char * axes[3] = { "x", "y", "z" };
+   cloud.fields.resize(3);
+   for( int i=0; i<3; i++ ) {
+      cloud.fields[i].name = axes[i];
+      cloud.fields[i].offset = i * sizeof(float);
+      cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+      cloud.fields[i].count = 1;
+   }
+   cloud.data.reserve(NUM_SONARS * cloud.point_step);
+   link.sonar_points_msgs.init(cloud);
+}
+
+// the last sweep, as one cloud; readings with nothing in range are left
+// out
+void publish_sonar_points(BoardLink & link) {
+   sensor_msgs::PointCloud2::Ptr cloud = link.sonar_points_msgs.get();
+   float xyz[NUM_SONARS * 3];
+   int n = link.sonar_sweep.points(xyz);
+   cloud->header.stamp = link.packet_time();
+   cloud->width = n;
+   cloud->row_step = n * cloud->point_step;
+   cloud->data.resize(cloud->row_step);
+   if( n > 0 ) {
+      memcpy(&cloud->data[0], xyz, cloud->row_step);
+   }
+   link.sonar_points_pub.publish(cloud);
+}
+
+handler(sonar_h) {
+   SonarPacket s;
+   if( !link.decode(p, s) ) {
+      return;
+   }
+   if( s.index >= NUM_SONARS ) {
+      ROS_ERROR("Bad sonar index %d", s.index);
+      return;
+   }
+   float range = s.range * 0.0254; // convert inches to m
+   if( link.sonar_sweep.update(s.index, range, link.packet_time().toSec()) &&
+         link.sonar_points_pub.wanted(link.packet_time()) ) {
+      publish_sonar_points(link);
+   }
+   if( !link.sonar_pub.wanted(link.packet_time()) ) {
+      return;
+   }
+   sensor_msgs::Range::Ptr sonar = link.sonar_msgs[s.index].get();
+   sonar->range = range;
+   sonar->header.stamp = link.packet_time();
 
-   sonar_pub.publish(sonar);
+   link.sonar_pub.publish(sonar);
 }
 
 handler(imu_h) {
-   // imu message format:
-   // float[3]
-   //float x, y, z;
-   float z;
-   /* x = */ p.readfloat();
-   /* y = */ p.readfloat();
-   z = p.readfloat();
-   //ROS_INFO("IMU data: (% 03.7f, % 03.7f, % 03.7f)", x, y, z);
-   heading = z;
-   std_msgs::Float32 h;
-   h.data = z;
-   heading_pub.publish(h);
+   HeadingPacket imu;
+   if( !link.decode(p, imu) ) {
+      return;
+   }
+   //ROS_INFO("IMU data: (% 03.7f, % 03.7f, % 03.7f)", imu.x, imu.y, imu.z);
+   heading = imu.z;
+   if( heading_pub.wanted(link.packet_time()) ) {
+      std_msgs::Float32 h;
+      h.data = imu.z;
+      heading_pub.publish(h);
+   }
 }
 
-handler(raw_imu_h) {
-   // gyro: xyz, accel: xyz
-   float gx, gy, gz, ax, ay, az;
-   gx = p.readfloat();
-   gy = p.readfloat();
-   gz = p.readfloat();
-   ax = p.readfloat();
-   ay = p.readfloat();
-   az = p.readfloat();
+// big enough to absorb a whole batched packet at once
+MessagePool<sensor_msgs::Imu, 48> imu_msgs;
+
+// optional fused heading from the gyro and compass, published as a full
+// IMU message for every gyro sample
+bool heading_filter_enabled = false;
+HeadingFilter heading_filter;
+TopicPublisher fused_pub;
+MessagePool<sensor_msgs::Imu, 48> fused_msgs;
+// added to the compass heading; magnetic declination and mounting
+double compass_heading_offset = 0.0;
+
+void raw_imu_setup(ros::NodeHandle & n) {
    sensor_msgs::Imu imu;
-   imu.header.stamp = ros::Time::now();
    imu.header.frame_id = "base_link";
+   // no orientation data
+   imu.orientation_covariance[0] = -1;
+   imu_msgs.init(imu);
+
+   n.param("heading_filter", heading_filter_enabled, false);
+   double gyro_sd, bias_sd, compass_sd, gate;
+   n.param("heading_gyro_sd", gyro_sd, 0.001);
+   n.param("heading_bias_sd", bias_sd, 0.0001);
+   n.param("heading_compass_sd", compass_sd, 2.0 * M_PI / 180.0);
+   n.param("heading_gate", gate, 5.0);
+   n.param("compass_heading_offset", compass_heading_offset, 0.0);
+   heading_filter.configure(gyro_sd * gyro_sd, bias_sd * bias_sd,
+         compass_sd * compass_sd, gate);
+
+   // the robot stays level; roll and pitch are there, but not estimated
+   imu.orientation_covariance[0] = ODOM_UNKNOWN_VAR;
+   imu.orientation_covariance[4] = ODOM_UNKNOWN_VAR;
+   fused_msgs.init(imu);
+}
+
+// one gyro sample through the heading filter, and out as a fused message
+void publish_fused(float gx, float gy, float gz, float ax, float ay,
+      float az, const ros::Time & stamp) {
+   heading_filter.predict(gz, stamp.toSec());
+   if( !heading_filter.ready() || !fused_pub.wanted(stamp) ) {
+      return;
+   }
+   sensor_msgs::Imu::Ptr imu = fused_msgs.get();
+   imu->header.stamp = stamp;
+   imu->orientation = tf::createQuaternionMsgFromYaw(heading_filter.yaw());
+   imu->orientation_covariance[8] = heading_filter.yaw_var();
+
+   imu->angular_velocity.x = gx;
+   imu->angular_velocity.y = gy;
+   imu->angular_velocity.z = gz - heading_filter.bias();
+   imu->linear_acceleration.x = ax;
+   imu->linear_acceleration.y = ay;
+   imu->linear_acceleration.z = az;
+   // pooled messages keep whatever they last had, so set all of it
+   if( imu_cov_known ) {
+      std::copy(gyro_cov, gyro_cov + 9,
+            imu->angular_velocity_covariance.begin());
+      std::copy(accel_cov, accel_cov + 9,
+            imu->linear_acceleration_covariance.begin());
+   } else {
+      std::fill(imu->angular_velocity_covariance.begin(),
+            imu->angular_velocity_covariance.end(), 0.0);
+      std::fill(imu->linear_acceleration_covariance.begin(),
+            imu->linear_acceleration_covariance.end(), 0.0);
+   }
+   imu->angular_velocity_covariance[8] =
+      (imu_cov_known ? gyro_cov[8] : 0.0) + heading_filter.bias_var();
+   fused_pub.publish(imu);
+}
 
-   // we are providing gyro and accel data
-   // don't know covariances yet
-   imu.angular_velocity.x = gx;
-   imu.angular_velocity.y = gy;
-   imu.angular_velocity.z = gz;
-   imu.linear_acceleration.x = ax;
-   imu.linear_acceleration.y = ay;
-   imu.linear_acceleration.z = az;
+void publish_imu(float gx, float gy, float gz, float ax, float ay, float az,
+      const ros::Time & stamp) {
+   if( imu_calibrate ) {
+      imu_calibration(gx, gy, gz, ax, ay, az);
+   }
+   if( heading_filter_enabled ) {
+      publish_fused(gx, gy, gz, ax, ay, az, stamp);
+   }
+   if( !imu_pub.wanted(stamp) ) {
+      return;
+   }
+   sensor_msgs::Imu::Ptr imu = imu_msgs.get();
+   imu->header.stamp = stamp;
+
+   // we are providing gyro and accel data, with the noise from the last
+   // calibration window if there's been one
+   if( imu_cov_known ) {
+      std::copy(gyro_cov, gyro_cov + 9,
+            imu->angular_velocity_covariance.begin());
+      std::copy(accel_cov, accel_cov + 9,
+            imu->linear_acceleration_covariance.begin());
+   }
+   imu->angular_velocity.x = gx;
+   imu->angular_velocity.y = gy;
+   imu->angular_velocity.z = gz;
+   imu->linear_acceleration.x = ax;
+   imu->linear_acceleration.y = ay;
+   imu->linear_acceleration.z = az;
 
    /* Analysis of gyro and accelerometer bias
 Analyzing 10019 samples
@@ -494,51 +1425,210 @@ Accelerometer covaraince
  [-0.06066546 -0.08171402  0.26964842]]
 */
 
-   // no orientation data
-   imu.orientation_covariance[0] = -1;
-
    imu_pub.publish(imu);
+   imu_latency.record((ros::Time::now() - imu->header.stamp).toSec());
 }
 
+handler(raw_imu_h) {
+   // RawImuPacket, then
+   // uint32_t tick (with time sync)
+   RawImuPacket imu;
+   if( !link.decode(p, imu) ) {
+      return;
+   }
+   publish_imu(imu.gx, imu.gy, imu.gz, imu.ax, imu.ay, imu.az,
+         link.acquisition_time(p));
+}
+
+// most samples we'll take from a single batched IMU packet. A full batch
+// still fits in FRAME_MAX even if every byte has to be escaped
+#define IMU_BATCH_MAX 16
+// batches thrown away for claiming more samples than that
+unsigned long imu_batch_drops = 0;
+
+handler(raw_imu_batch_h) {
+   // ImuBatchPacket, then n ImuSamples
+   //
+   // 13 bytes per sample instead of 24, before escaping, and only one
+   // header and terminator per batch
+   ImuBatchPacket batch;
+   if( !link.decode(p, batch) ) {
+      return;
+   }
+   int n = batch.n;
+   uint32_t tick = batch.tick;
+   float gyro_scale = batch.gyro_scale;
+   float accel_scale = batch.accel_scale;
+   if( n > IMU_BATCH_MAX ) {
+      ++imu_batch_drops;
+      ROS_ERROR_THROTTLE(10, "IMU batch too big: %d samples", n);
+      return;
+   }
+
+   // decode everything first, so that we know the tick of the last sample
+   int16_t raw[IMU_BATCH_MAX][6];
+   uint32_t ticks[IMU_BATCH_MAX];
+   for( int i=0; i<n; i++ ) {
+      ImuSample sample;
+      if( !link.decode(p, sample) ) {
+         return;
+      }
+      tick += sample.dt;
+      ticks[i] = tick;
+      raw[i][0] = sample.gx;
+      raw[i][1] = sample.gy;
+      raw[i][2] = sample.gz;
+      raw[i][3] = sample.ax;
+      raw[i][4] = sample.ay;
+      raw[i][5] = sample.az;
+   }
+
+   for( int i=0; i<n; i++ ) {
+      ros::Time stamp;
+      if( link.time_sync_enabled() ) {
+         stamp = link.tick_time(ticks[i]);
+      } else {
+         // without a clock estimate, assume the last sample was taken just
+         // before the packet was sent, and space the others out by tick
+         stamp = link.packet_time() -
+            ros::Duration((uint32_t)(tick - ticks[i]) * link.tick_period());
+      }
+      publish_imu(raw[i][0] * gyro_scale, raw[i][1] * gyro_scale,
+            raw[i][2] * gyro_scale, raw[i][3] * accel_scale,
+            raw[i][4] * accel_scale, raw[i][5] * accel_scale, stamp);
+   }
+}
+
+MessagePool<geometry_msgs::Vector3Stamped> compass_msgs;
+
 handler(compass_h) {
-   float mx, my, mz;
-   mx = p.readfloat();
-   my = p.readfloat();
-   mz = p.readfloat();
-   geometry_msgs::Vector3Stamped compass;
-   compass.header.stamp = ros::Time::now();
-   compass.vector.x = mx;
-   compass.vector.y = my;
-   compass.vector.z = mz;
+   CompassPacket m;
+   if( !link.decode(p, m) ) {
+      return;
+   }
+   if( compass_calibrate ) {
+      compass_calibration(m.x, m.y, link.packet_time().toSec());
+   }
+   ros::Time stamp = link.acquisition_time(p);
+   double cx = m.x - compass_center[0];
+   double cy = m.y - compass_center[1];
+   double x = compass_soft[0] * cx + compass_soft[1] * cy;
+   double y = compass_soft[2] * cx + compass_soft[3] * cy;
+   if( heading_filter_enabled ) {
+      // same convention as raw_compass.py
+      heading_filter.correct(atan2(x, y) + compass_heading_offset,
+            stamp.toSec());
+   }
+   if( !compass_pub.wanted(link.packet_time()) ) {
+      return;
+   }
+   geometry_msgs::Vector3Stamped::Ptr compass = compass_msgs.get();
+   compass->header.stamp = stamp;
+   compass->vector.x = x;
+   compass->vector.y = y;
+   compass->vector.z = m.z;
    compass_pub.publish(compass);
+   compass_latency.record((ros::Time::now() - compass->header.stamp).toSec());
 }
 
+handler(ready_h) {
+   if( &link != primary ) {
+      ROS_WARN("AVR on link %s reset", link.name().c_str());
+      return;
+   }
+   // the AVR only sends this when its firmware starts, so it has lost its
+   // goal list
+   ROS_WARN("AVR reset");
+   if( goal_sync_enabled ) {
+      boost::mutex::scoped_lock lock(goal_mutex);
+      goal_reset();
+      goal_sync(ros::WallTime::now().toSec());
+   }
+   // and its calibration
+   boost::mutex::scoped_lock lock(cal_mutex);
+   if( imu_offsets_known ) {
+      send_imu_cal();
+   }
+   if( compass_offsets_known ) {
+      send_compass_cal();
+   }
+}
+
+// goal input from the AVR. With goal sync, edits made there are applied
+// here too; the AVR has already made them itself, so they aren't sent back
+// to it
 handler(goal_h) {
-   int8_t op;
-   op = p.reads8();
+   GoalPacket op;
+   if( !link.decode(p, op) ) {
+      return;
+   }
+   double now = ros::WallTime::now().toSec();
+   if( op.operation == GOAL_ACK && goal_sync_enabled ) {
+      GoalAckPacket ack;
+      if( !link.decode(p, ack) ) {
+         return;
+      }
+      boost::mutex::scoped_lock lock(goal_mutex);
+      goal_ack(ack.version, ack.flags & GOAL_RESET, now);
+      return;
+   }
+
    dagny_driver::Goal g;
-   g.operation = op;
-   switch(op) {
-      case dagny_driver::Goal::APPEND:
-         g.goal.latitude = p.reads32() / 1000000.0;
-         g.goal.longitude = p.reads32() / 1000000.0;
+   g.operation = op.operation;
+   dagny_driver::GoalList::Ptr list;
+   switch(op.operation) {
+      case dagny_driver::Goal::APPEND: {
+         GoalAppendPacket append;
+         if( !link.decode(p, append) ) {
+            return;
+         }
+         g.goal.latitude = append.lat / 1000000.0;
+         g.goal.longitude = append.lon / 1000000.0;
          ROS_INFO("Add goal at lat %lf, lon %lf", g.goal.latitude, 
                g.goal.longitude);
+         if( goal_sync_enabled ) {
+            boost::mutex::scoped_lock lock(goal_mutex);
+            g.id = goals.append(append.lat, append.lon, true);
+            goal_avr_change(now);
+            list = goal_list();
+         }
          break;
-      case dagny_driver::Goal::DELETE:
-         g.id = p.reads32();
+      }
+      case dagny_driver::Goal::DELETE: {
+         GoalDeletePacket del;
+         if( !link.decode(p, del) ) {
+            return;
+         }
+         g.id = del.id;
          ROS_INFO("Remove goal at %d", g.id);
+         if( goal_sync_enabled ) {
+            boost::mutex::scoped_lock lock(goal_mutex);
+            if( !goals.remove(del.id, true) ) {
+               ROS_WARN("AVR removed unknown goal %d", del.id);
+               return;
+            }
+            goal_avr_change(now);
+            list = goal_list();
+         }
          break;
+      }
       default:
-         ROS_ERROR("Got unknown goal update %d", op);
+         ROS_ERROR("Got unknown goal update %d", op.operation);
          return;
    }
    goal_input_pub.publish(g);
+   if( list ) {
+      goal_list_pub.publish(list);
+   }
 }
 
 handler(battery_h) {
-   uint8_t main = p.readu8();
-   uint8_t motor = p.readu8();
+   BatteryPacket raw;
+   if( !link.decode(p, raw) ) {
+      return;
+   }
+   uint8_t main = raw.main;
+   uint8_t motor = raw.motor;
    const uint8_t battery_max = 84;
    const uint8_t battery_min = 70;
    // below this, we assume we're on wall power
@@ -547,23 +1637,24 @@ handler(battery_h) {
    // motor power switch is OFF
    const uint8_t motor_cutoff = 4;
    dagny_driver::Battery battery_msg;
-   battery_msg.header.stamp = ros::Time::now();
+   battery_msg.header.stamp = link.packet_time();
    battery_msg.main_raw = main;
    battery_msg.motor_raw = motor;
 
-   // bounds checking
+   // bounds checking. Battery packets are always decoded, since the topic
+   // is latched, so only complain once a minute
    if( main > battery_max ) {
-      ROS_WARN("Main battery is above maximum: %d", main);
+      ROS_WARN_THROTTLE(60, "Main battery is above maximum: %d", main);
    }
    if( main < battery_min && main > main_cutoff ) {
-      ROS_WARN("Main battery is low: %d", main);
+      ROS_WARN_THROTTLE(60, "Main battery is low: %d", main);
    }
 
    if( motor > battery_max ) {
-      ROS_WARN("Motor battery is above maximum: %d", motor);
+      ROS_WARN_THROTTLE(60, "Motor battery is above maximum: %d", motor);
    }
    if( motor < battery_min && motor > motor_cutoff ) {
-      ROS_WARN("Motor battery is low: %d", motor);
+      ROS_WARN_THROTTLE(60, "Motor battery is low: %d", motor);
    }
 
    // compute very rough and wrong battery level
@@ -578,12 +1669,11 @@ handler(battery_h) {
    battery_msg.motor = float(motor - battery_min)/(battery_max - battery_min);
    battery_msg.motor = min(max(battery_msg.motor, 0.0f), 1.0f);
 
-   battery_pub.publish(battery_msg);
+   link.battery_pub.publish(battery_msg);
 }
 
-int bandwidth = 0;
-
-void idle_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+void BoardLink::idle_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
    // Idle Count
    if( idle_cnt < 200 ) {
       // error
@@ -601,24 +1691,8 @@ void idle_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
    stat.addf("Idle Count", "%d", idle_cnt);
 }
 
-void bandwidth_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
-   if( bandwidth == 0 ) {
-      stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
-            "ERROR: No AVR data");
-   } else if( bandwidth < 1000 ) {
-      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
-            "Warning: Low AVR bandwidth");
-   } else if( bandwidth > 1500 ) {
-      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
-            "Warning: High AVR bandwidth");
-   } else {
-      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
-            "OK: AVR bandwidth normal");
-   }
-   stat.addf("Bandwidth", "%d bytes/sec", bandwidth);
-}
-
-void i2c_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+void BoardLink::i2c_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
    if( i2c_resets == 0 ) {
       stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
             "OK: No I2C resets");
@@ -631,251 +1705,441 @@ void i2c_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
    }
 }
 
-void gps_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
-   double gps_diff = (ros::Time::now() - last_gps).toSec();
-   if( gps_diff < 1.1 ) {
-      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
-            "OK: GPS fix good");
+void BoardLink::sonar_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   stat.addf("Sweeps", "%lu", sonar_sweep.sweeps());
+   stat.addf("Incomplete sweeps", "%lu", sonar_sweep.timeouts());
+   const float * r = sonar_sweep.ranges();
+   for( int i=0; i<sonar_sweep.n_sonars(); i++ ) {
+      char name[32];
+      snprintf(name, sizeof(name), "Sonar %d range", i + 1);
+      stat.addf(name, "%.2f m", r[i]);
+   }
+   if( sonar_sweep.sweeps() == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: No sonar sweeps");
+   } else if( !sonar_sweep.complete() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Sonars missing from the last sweep");
    } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Sonar sweeps complete");
+   }
+}
+
+void latency_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   if( odom_latency.samples() == 0 ) {
       stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
-            "Warning: GPS out of date");
+            "Warning: No odometry published");
+   } else {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: %.1f ms mean odometry latency",
+            odom_latency.mean() * 1000.0);
    }
+   stat.add("odom latency", odom_latency.str());
+   stat.add("imu latency", imu_latency.str());
+   stat.add("magnetic latency", compass_latency.str());
+   stat.addf("odom mean latency", "%.2f ms", odom_latency.mean() * 1000.0);
+   stat.addf("imu mean latency", "%.2f ms", imu_latency.mean() * 1000.0);
+   stat.addf("magnetic mean latency", "%.2f ms",
+         compass_latency.mean() * 1000.0);
+   stat.addf("IMU batches dropped", "%lu", imu_batch_drops);
 }
 
-#define IN_BUFSZ 1024
+void laser_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   stat.addf("Laser scans", "%lu", laser_scans);
+   stat.addf("Laser summaries sent", "%lu", laser_summaries);
+   if( laser_scans == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: No laser scans");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Sending laser summaries");
+   }
+}
 
-int main(int argc, char ** argv) {
-   unsigned char in_buffer[IN_BUFSZ];
-   int in_cnt = 0;
-   int cnt = 0;
-   int i;
+void calibration_diagnostics(
+      diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   boost::mutex::scoped_lock lock(cal_mutex);
+   if( imu_offsets_known ) {
+      stat.addf("Gyro offsets", "%f %f %f", imu_offsets[0], imu_offsets[1],
+            imu_offsets[2]);
+      stat.addf("Accel offsets", "%f %f %f", imu_offsets[3], imu_offsets[4],
+            imu_offsets[5]);
+   } else {
+      stat.add("IMU offsets", "AVR's own");
+   }
+   if( compass_offsets_known ) {
+      stat.addf("Compass offsets", "%f %f %f", compass_offsets[0],
+            compass_offsets[1], compass_offsets[2]);
+   } else {
+      stat.add("Compass offsets", "AVR's own");
+   }
+   stat.addf("IMU windows", "%lu", imu_cal_windows);
+   stat.addf("IMU updates sent", "%lu", imu_cal_updates);
+   stat.addf("Compass fits", "%lu", compass_fits);
+   stat.addf("Compass updates sent", "%lu", compass_cal_updates);
+   stat.addf("Compass axis ratio", "%.3f", compass_axis_ratio);
+   if( !imu_calibrate && !compass_calibrate ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Online calibration disabled");
+   } else if( imu_calibrate && imu_cal_windows == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: IMU not calibrated yet; stand still to calibrate");
+   } else if( compass_calibrate && compass_fits == 0 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Compass not calibrated yet; turn a circle to calibrate");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Calibrated");
+   }
+}
 
-   char heartbeat_buf[8];
-   Packet heartbeat_packet('H', 8, heartbeat_buf);
+void heading_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   if( !heading_filter_enabled ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Heading filter disabled");
+      return;
+   }
+   stat.addf("Heading", "%.2f deg", heading_filter.yaw() * 180.0 / M_PI);
+   stat.addf("Heading std dev", "%.2f deg",
+         sqrt(heading_filter.yaw_var()) * 180.0 / M_PI);
+   stat.addf("Gyro z bias", "%f rad/s", heading_filter.bias());
+   stat.addf("Compass headings rejected", "%lu", heading_filter.rejected());
+   if( !heading_filter.ready() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Waiting for the compass");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Heading filter running");
+   }
+}
 
-   laser_ready = 0;
+void goal_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   boost::mutex::scoped_lock lock(goal_mutex);
+   stat.addf("Goals", "%d", (int)goals.goals().size());
+   stat.addf("Current goal", "%d", goals.current());
+   stat.addf("Version", "%d", goals.version());
+   stat.addf("Acked version", "%d", goal_acked);
+   stat.addf("Batches awaiting ack", "%d", (int)goal_batches.size());
+   stat.addf("Late acks", "%lu", goal_late_acks);
+   stat.addf("Resets", "%lu", goal_resets);
+   if( goal_resetting ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Resending all goals to the AVR");
+   } else if( goal_acked != goals.version() ) {
+      stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: AVR is %d goal changes behind",
+            (uint16_t)(goals.version() - goal_acked));
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: AVR goals up to date");
+   }
+}
 
-   for( i=0; i<512; i++ ) {
-      laser_data[i] = 64;
+void gps_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   double gps_diff = (ros::Time::now() - last_gps).toSec();
+   if( gps_diff < 1.1 ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: GPS fix good");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: GPS out of date");
    }
+}
 
-   // Set up message handler array
-   for( i=0; i<256; i++ ) {
-      handlers[i] = no_handler;
+void watchdog_diagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat) {
+   stat.addf("Timeout", "%.0f ms", cmd_watchdog.timeout() * 1000.0);
+   stat.addf("Time since last command", "%.3f s", cmd_watchdog.since_feed());
+   stat.addf("Timeouts", "%lu", cmd_watchdog.timeouts());
+   stat.addf("Bump stops", "%lu", cmd_watchdog.trips());
+   stat.addf("Stops sent", "%lu", cmd_watchdog.stops());
+   stat.add("Real-time", cmd_watchdog.realtime() ? "yes" : "no");
+   if( cmd_watchdog.held() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Bumped; holding stopped");
+   } else if( cmd_watchdog.latched() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+            "Warning: Stopped after a bump; waiting for a stop command");
+   } else if( cmd_watchdog.stopped() ) {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Stopped; waiting for commands");
+   } else {
+      stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+            "OK: Receiving commands");
    }
+}
 
-   odometry_setup();
-   handlers['O'] = odometry_h;
-   handlers['I'] = idle_h;
+diagnostic_updater::Updater * updater = 0;
 
-   //gps_setup();
-   handlers['G'] = gps_h;
-   handlers['S'] = sonar_h;
-   handlers['U'] = imu_h;
-   
-   // raw IMU handlers
-   handlers['M'] = compass_h;
-   handlers['V'] = raw_imu_h;
+void diagnosticsCallback( const ros::TimerEvent & e ) {
+   // the updater rate-limits itself; we just need to call it often enough
+   updater->update();
+}
 
-   // goal hander
-   handlers['L'] = goal_h;
+// ROS interfaces owned by the driver; these live between driver_start() and
+// driver_stop()
+std::vector<ros::Subscriber> subscribers;
+std::vector<ros::Timer> timers;
+
+// handlers common to every board, and the modules behind them, with their
+// parameters from n
+void board_setup(BoardLink & link, ros::NodeHandle & n) {
+   // idle packets feed the diagnostics, so they're always decoded
+   set_handler(link, 'I', idle_h);
+   set_handler(link, 'S', sonar_h);
+   link.add_feed('S', link.sonar_pub);
+   link.add_feed('S', link.sonar_points_pub);
+   link.set_min_size('S', SonarPacket::SIZE);
 
    // battery handler
-   handlers['B'] = battery_h;
-
-   ros::init(argc, argv, "dagny_driver");
+   set_handler(link, 'B', battery_h);
 
-   ros::NodeHandle n;
+   // link setup
+   set_handler(link, 'R', ready_h);
 
-   last_cmd_t = ros::Time::now();
+   sonar_setup(link, n);
+}
 
-   // I'm going to hardcode the port and settings because this is hardware-
-   // specific anyway
-   // open serial port
-   string serial_port;
-   n.param<std::string>("port", serial_port, "/dev/ttyACM0");
-   int serial = open(serial_port.c_str(), O_RDWR | O_NOCTTY);
-   if( serial < 0 ) {
-      perror(("Failed to open " + serial_port).c_str());
-      // die. ungracefully.
-      return -1;
-   }
+void board_publishers_setup(BoardLink & link, ros::NodeHandle & n) {
+   link.sonar_pub.advertise<sensor_msgs::Range>(n, "sonar", 10);
+   link.sonar_points_pub.advertise<sensor_msgs::PointCloud2>(n,
+         "sonar_points", 10);
+   link.i2c_fail_pub.advertise<std_msgs::UInt8>(n, "i2c_fail", 10);
 
-   struct termios tio;
-   tcgetattr(serial, &tio);
+   // latched, so we can always pick up the most recent data
+   link.battery_pub = n.advertise<dagny_driver::Battery>("battery", 1, true);
+}
 
-   // set non-blocking input mode
-   tio.c_lflag = 0; // raw input
-   tio.c_cc[VMIN] = 0;
-   tio.c_cc[VTIME] = 0;
+// set up the main board's handler table and the modules behind the
+// handlers
+void handlers_setup(BoardLink & link, ros::NodeHandle & n) {
+   board_setup(link, n);
 
-   // no input options, just normal input
-   tio.c_iflag = 0;
+   // odometry always feeds tf, so it's always decoded
+   set_handler(link, 'O', odometry_h);
 
-   // set baud rate
-   cfsetospeed(&tio, B115200);
-   cfsetispeed(&tio, B115200);
+   //gps_setup();
+   set_handler(link, 'G', gps_h);
+   link.add_feed('G', gps_pub);
+   link.set_min_size('G', GpsPacket::SIZE);
+   link.set_skip('G', gps_skip);
+   // no feed for 'U'; it's tiny, and the cached heading has to follow it
+   set_handler(link, 'U', imu_h);
+   link.set_min_size('U', HeadingPacket::SIZE);
    
-   tcsetattr(serial, TCSANOW, &tio);
+   // raw IMU handlers. The heading filter and the online calibration
+   // need every sample, whether or not anyone wants the raw topics
+   raw_imu_setup(n);
+   calibration_config(n);
+   set_handler(link, 'M', compass_h);
+   if( !heading_filter_enabled && !compass_calibrate ) {
+      link.add_feed('M', compass_pub);
+   }
+   link.set_min_size('M', CompassPacket::SIZE);
+   set_handler(link, 'V', raw_imu_h);
+   if( !heading_filter_enabled && !imu_calibrate ) {
+      link.add_feed('V', imu_pub);
+   }
+   link.set_min_size('V', RawImuPacket::SIZE);
+   set_handler(link, 'W', raw_imu_batch_h);
+   if( !heading_filter_enabled && !imu_calibrate ) {
+      link.add_feed('W', imu_pub);
+   }
+   link.set_min_size('W', ImuBatchPacket::SIZE);
 
-   sleep(2); // sleep for two seconds while bootloader runs
+   // goal hander
+   set_handler(link, 'L', goal_h);
 
-   ros::Subscriber cmd_sub = n.subscribe("cmd_vel", 1, cmdCallback);
+   steering_setup(n);
+   odometry_setup(n);
+}
 
-   ros::Subscriber goal_updates_sub = n.subscribe("goal_updates", 10, goalUpdateCallback);
-   ros::Subscriber compass_offset_sub = n.subscribe("compass_cal", 2, compassCalCallback);
-   ros::Subscriber imu_offset_sub = n.subscribe("imu_cal", 2, imuCalCallback);
-   ros::Subscriber steering_offset_sub = n.subscribe("steering_offset",
-         2, steeringOffsetCallback);
+// switch the outbound packets to the main board's protocol version
+void set_protocol_version(int v) {
+   if( v == PROTOCOL_V2 ) {
+      cmd_packet.set_version(PROTOCOL_V2);
+      goal_packet.set_version(PROTOCOL_V2);
+      laser_packet.set_version(PROTOCOL_V2);
+      compass_cal_packet.set_version(PROTOCOL_V2);
+      imu_cal_packet.set_version(PROTOCOL_V2);
+      steering_offset_packet.set_version(PROTOCOL_V2);
+   }
+}
 
-   odo_pub = n.advertise<nav_msgs::Odometry>("odom", 10);
-   sonar_pub = n.advertise<sensor_msgs::Range>("sonar", 10);
-   gps_pub = n.advertise<dagny_driver::NavSatFix>("gps", 10);
-   heading_pub = n.advertise<std_msgs::Float32>("heading", 10);
-   bump_pub = n.advertise<std_msgs::Bool>("bump", 10);
-   encoder_pub = n.advertise<dagny_driver::Encoder>("encoder", 10);
+// advertise everything the main board's handlers publish
+void publishers_setup(ros::NodeHandle & n) {
+   board_publishers_setup(*primary, n);
 
-   compass_pub = n.advertise<geometry_msgs::Vector3Stamped>("magnetic", 10);
-   imu_pub = n.advertise<sensor_msgs::Imu>("imu", 10);
-   i2c_fail_pub = n.advertise<std_msgs::UInt8>("i2c_fail", 10);
+   odo_pub.advertise<nav_msgs::Odometry>(n, "odom", 10);
+   gps_pub.advertise<dagny_driver::NavSatFix>(n, "gps", 10);
+   heading_pub.advertise<std_msgs::Float32>(n, "heading", 10);
+   bump_pub.advertise<std_msgs::Bool>(n, "bump", 10);
+   encoder_pub.advertise<dagny_driver::Encoder>(n, "encoder", 10);
 
-   // latched, so we can always pick up the most recent data
-   battery_pub = n.advertise<dagny_driver::Battery>("battery", 1, true);
+   compass_pub.advertise<geometry_msgs::Vector3Stamped>(n, "magnetic", 10);
+   imu_pub.advertise<sensor_msgs::Imu>(n, "imu", 10);
+   fused_pub.advertise<sensor_msgs::Imu>(n, "imu_fused", 10);
 
    goal_input_pub = n.advertise<dagny_driver::Goal>("goal_input", 10);
+   goal_list_pub = n.advertise<dagny_driver::GoalList>("goals", 1, true);
+}
 
-   diagnostic_updater::Updater updater;
-   updater.setHardwareID("Dagny");
-   updater.add("AVR Load", idle_diagnostics);
-   updater.add("AVR Bandwidth", bandwidth_diagnostics);
-   updater.add("I2C Status", i2c_diagnostics);
-   updater.add("GPS Status", gps_diagnostics);
-
-   ROS_INFO("dagny_driver ready");
-
-   ros::Rate loop_rate(20);
-   ros::Time now;
-
-   int itr = 0;
-   int bw = 0;
-
-   while( ros::ok() ) {
-      cnt = read(serial, in_buffer + in_cnt, IN_BUFSZ - in_cnt - 1); 
-      if( cnt > 0 ) {
-         // append a null byte
-         in_buffer[cnt + in_cnt] = 0;
-         in_cnt += cnt;
-         // parse out newline-terminated strings and call appropriate functions
-         int start = 0;
-         int i = 0;
-         while( i < in_cnt ) {
-            for( ; i < in_cnt && in_buffer[i] != '\r' ; i++);
-
-            if( i < in_cnt && in_buffer[i] == '\r' ) {
-               // check that our string isn't just the terminating character
-               if( i - start > 1 ) {
-                  // we got a string. call the appropriate function
-                  Packet p((char*)(in_buffer+start), i-start);
-                  handlers[in_buffer[start]](p);
-               }
-               start = i+1;
-            }
-            i++;
-         }
+void links_clear() {
+   for( size_t i=0; i<links.size(); i++ ) {
+      links[i]->stop();
+      delete links[i];
+   }
+   links.clear();
+   primary = 0;
+}
 
-         // shift remaining data to front of buffer
-         for( i=start; i<in_cnt; i++ ) {
-            in_buffer[i-start] = in_buffer[i];
-         }
+bool driver_start(ros::NodeHandle & n) {
+   if( primary ) {
+      ROS_ERROR("dagny_driver is already running in this process");
+      return false;
+   }
 
-         in_cnt -= start;
+   // the main board, and any others, each with its own port, threads and
+   // diagnostics under its own name
+   std::vector<std::string> names;
+   n.getParam("links", names);
+   std::vector<ros::NodeHandle> link_n;
+   primary = new BoardLink("");
+   links.push_back(primary);
+   link_n.push_back(n);
+   handlers_setup(*primary, n);
+   for( size_t i=0; i<names.size(); i++ ) {
+      if( names[i].empty() ) {
+         ROS_ERROR("Empty link name");
+         links_clear();
+         return false;
       }
-      bw += cnt;
-      
-      ros::spinOnce();
-      now = ros::Time::now();
+      links.push_back(new BoardLink(names[i]));
+      link_n.push_back(ros::NodeHandle(n, names[i]));
+      board_setup(*links.back(), link_n.back());
+   }
 
-      if( laser_ready ) {
-         cnt = write(serial, "L", 1);
-         cnt = write(serial, laser_data, 512);
-         cnt = write(serial, "\r\r\r\r\r\r\r\r", 1);
-         laser_ready = 0;
+   for( size_t i=0; i<links.size(); i++ ) {
+      if( !links[i]->open(link_n[i]) ) {
+         links_clear();
+         return false;
       }
+   }
+   set_protocol_version(primary->protocol_version());
 
-      if( cmd_ready ) {
-         cnt = write(serial, cmd_packet.outbuf(), cmd_packet.outsz());
-         //ROS_INFO("cmd_vel sent");
-         if( cnt != cmd_packet.outsz() ) {
-            ROS_ERROR("Failed to send cmd_vel data");
-         }
-         cmd_ready = 0;
-      } else if( now - last_cmd_t > ros::Duration(1.0) ) {
-         last_cmd_t = now;
-         ROS_WARN("Command timeout; restting to 0");
-         // command timeout; send zero
-         cmd_packet.reset();
-         cmd_packet.append(uint16_t(0));
-         cmd_packet.append(int8_t(0));
-         cmd_packet.finish();
-
-         cnt = write(serial, cmd_packet.outbuf(), cmd_packet.outsz());
-         //ROS_INFO("cmd_vel sent");
-         if( cnt != cmd_packet.outsz() ) {
-            ROS_ERROR("Failed to send cmd_vel data");
-         }
-         cmd_ready = 0;
-      }
+   subscribers.push_back(n.subscribe("cmd_vel", 1, cmdCallback));
 
-      if( goal_ready ) {
-         cnt = write(serial, goal_packet.outbuf(), goal_packet.outsz());
-         if( cnt != goal_packet.outsz() ) {
-            ROS_ERROR("Failed to send goal update");
-         }
-         goal_ready = 0;
-      }
+   subscribers.push_back(n.subscribe("goal_updates", 10, goalUpdateCallback));
+   subscribers.push_back(n.subscribe("compass_cal", 2, compassCalCallback));
+   subscribers.push_back(n.subscribe("imu_cal", 2, imuCalCallback));
+   subscribers.push_back(n.subscribe("steering_offset", 2,
+            steeringOffsetCallback));
 
-      if( compass_cal_ready ) {
-         cnt = write(serial, compass_cal_packet.outbuf(), 
-               compass_cal_packet.outsz());
-         if( cnt != compass_cal_packet.outsz() ) {
-            ROS_ERROR("Failed to send compass update");
-         }
-         compass_cal_ready = 0;
-      }
+   bool laser_summary;
+   n.param("laser_summary", laser_summary, false);
+   if( laser_summary ) {
+      laser_setup(n);
+      subscribers.push_back(n.subscribe("scan", 2, laserCallback));
+   }
 
-      if( imu_cal_ready ) {
-         cnt = write(serial, imu_cal_packet.outbuf(), 
-               imu_cal_packet.outsz());
-         if( cnt != imu_cal_packet.outsz() ) {
-            ROS_ERROR("Failed to send imu update");
-         }
-         imu_cal_ready = 0;
+   publishers_setup(n);
+   for( size_t i=1; i<links.size(); i++ ) {
+      board_publishers_setup(*links[i], link_n[i]);
+   }
+   calibration_setup(n);
+
+   n.param("goal_sync", goal_sync_enabled, false);
+   if( goal_sync_enabled ) {
+      // whatever goals the AVR had are stale; the first sync replaces them
+      dagny_driver::GoalList::Ptr list;
+      {
+         boost::mutex::scoped_lock lock(goal_mutex);
+         goal_reset();
+         list = goal_list();
       }
+      goal_list_pub.publish(list);
+   }
 
-      if( steering_offset_ready ) {
-         cnt = write(serial, steering_offset_packet.outbuf(), 
-               steering_offset_packet.outsz());
-         if( cnt != steering_offset_packet.outsz() ) {
-            ROS_ERROR("Failed to send imu update");
-         }
-         steering_offset_ready = 0;
+   updater = new diagnostic_updater::Updater(n);
+   updater->setHardwareID("Dagny");
+   for( size_t i=0; i<links.size(); i++ ) {
+      BoardLink * l = links[i];
+      std::string prefix = l->name().empty() ? "" : l->name() + " ";
+      updater->add(prefix + "AVR Load", l, &BoardLink::idle_diagnostics);
+      updater->add(prefix + "I2C Status", l, &BoardLink::i2c_diagnostics);
+      updater->add(prefix + "Sonars", l, &BoardLink::sonar_diagnostics);
+      l->add_diagnostics(*updater);
+   }
+   updater->add("GPS Status", gps_diagnostics);
+   updater->add("Sensor Latency", latency_diagnostics);
+   if( laser_summary ) {
+      updater->add("Laser Summary", laser_diagnostics);
+   }
+   if( goal_sync_enabled ) {
+      updater->add("AVR Goals", goal_diagnostics);
+   }
+   updater->add("IMU Calibration", calibration_diagnostics);
+   updater->add("Heading Filter", heading_diagnostics);
+   updater->add("Command Watchdog", watchdog_diagnostics);
+
+   // housekeeping runs on its own timers, alongside the subscriber
+   // callbacks. These all hand their packets to the transmit thread
+   timers.push_back(n.createTimer(ros::Duration(0.25), diagnosticsCallback));
+   if( goal_sync_enabled ) {
+      timers.push_back(n.createTimer(ros::Duration(0.1), goalSyncCallback));
+   }
+
+   for( size_t i=0; i<links.size(); i++ ) {
+      if( !links[i]->run(link_n[i]) ) {
+         driver_stop();
+         return false;
       }
+   }
+   if( !watchdog_setup(n) ) {
+      driver_stop();
+      return false;
+   }
 
-      // send heartbeat
-      ++itr;
+   ROS_INFO("dagny_driver ready with %d links", (int)links.size());
+   return true;
+}
 
-      // heartbeat and bandwidth measurement every 0.5 sec
-      if( itr == 9 ) {
-         heartbeat_packet.reset();
-         heartbeat_packet.finish();
-         cnt = write(serial,heartbeat_packet.outbuf(),heartbeat_packet.outsz());
-         itr = 0;
-         bandwidth = bw * 2;
-         bw = 0;
-      }
+void driver_stop() {
+   if( !primary ) {
+      return;
+   }
+   // stop the threads before anything they use goes away
+   cmd_watchdog.stop();
+   for( size_t i=0; i<links.size(); i++ ) {
+      links[i]->stop();
+   }
 
-      updater.update();
+   subscribers.clear();
+   timers.clear();
+   delete updater;
+   updater = 0;
 
-      loop_rate.sleep();
+   links_clear();
+}
+
+bool driver_start_offline(ros::NodeHandle & n, int version) {
+   if( primary ) {
+      ROS_ERROR("dagny_driver is already running in this process");
+      return false;
+   }
+   primary = new BoardLink("");
+   links.push_back(primary);
+   handlers_setup(*primary, n);
+   if( !primary->open_offline(n, version) ) {
+      links_clear();
+      return false;
    }
+   set_protocol_version(version);
+   publishers_setup(n);
+   return true;
+}
+
+void driver_dispatch(char * data, int sz, double stamp) {
+   primary->dispatch(data, sz, stamp);
 }
@@ -0,0 +1,95 @@
+/*
+ * Implementation of the heading filter from heading_filter.h
+ */
+
+#include "heading_filter.h"
+
+#include <math.h>
+
+// longest gap between samples to integrate over; after one longer than
+// this, the filter just picks up from the new sample
+#define HEADING_MAX_DT 0.5
+// uncertainty in the bias when the filter starts, rad/s
+#define HEADING_BIAS_SD 0.01
+// compass headings rejected in a row before starting over
+#define HEADING_REJECT_MAX 50
+
+static double wrap(double a) {
+   return a - 2.0 * M_PI * floor((a + M_PI) / (2.0 * M_PI));
+}
+
+HeadingFilter::HeadingFilter() : gyro_var_(1e-6), bias_var_(1e-8),
+   compass_var_(1e-3), gate2_(25.0), rejected_(0) {
+   reset();
+}
+
+void HeadingFilter::configure(double gyro_var, double bias_var,
+      double compass_var, double gate) {
+   gyro_var_ = gyro_var;
+   bias_var_ = bias_var;
+   compass_var_ = compass_var;
+   gate2_ = gate * gate;
+   reset();
+}
+
+void HeadingFilter::reset() {
+   ready_ = false;
+   t_ = 0.0;
+   yaw_ = 0.0;
+   bias_ = 0.0;
+   p_[0][0] = p_[0][1] = p_[1][0] = p_[1][1] = 0.0;
+   rejected_run_ = 0;
+}
+
+void HeadingFilter::predict(double gz, double t) {
+   double dt = t - t_;
+   t_ = t;
+   if( !ready_ || dt <= 0.0 || dt > HEADING_MAX_DT ) {
+      return;
+   }
+   yaw_ = wrap(yaw_ + (gz - bias_) * dt);
+
+   // P = F P F' + Q, with F = [1 -dt; 0 1]
+   double p00 = p_[0][0] - dt * (p_[0][1] + p_[1][0]) + dt * dt * p_[1][1];
+   double p01 = p_[0][1] - dt * p_[1][1];
+   p_[0][0] = p00 + gyro_var_ * dt * dt;
+   p_[0][1] = p_[1][0] = p01;
+   p_[1][1] += bias_var_ * dt;
+}
+
+bool HeadingFilter::correct(double heading, double t) {
+   if( !ready_ ) {
+      // keep the bias from before a restart; it's still the best guess
+      ready_ = true;
+      t_ = t;
+      yaw_ = wrap(heading);
+      p_[0][0] = compass_var_;
+      p_[0][1] = p_[1][0] = 0.0;
+      p_[1][1] = HEADING_BIAS_SD * HEADING_BIAS_SD;
+      return true;
+   }
+
+   double y = wrap(heading - yaw_);
+   double s = p_[0][0] + compass_var_;
+   if( y * y > gate2_ * s ) {
+      ++rejected_;
+      if( ++rejected_run_ >= HEADING_REJECT_MAX ) {
+         ready_ = false;
+         correct(heading, t);
+      }
+      return false;
+   }
+   rejected_run_ = 0;
+
+   double k0 = p_[0][0] / s;
+   double k1 = p_[1][0] / s;
+   yaw_ = wrap(yaw_ + k0 * y);
+   bias_ += k1 * y;
+
+   // P = (I - K H) P, with H = [1 0]
+   double p00 = p_[0][0], p01 = p_[0][1], p11 = p_[1][1];
+   p_[0][0] = (1.0 - k0) * p00;
+   p_[0][1] = p_[1][0] = (1.0 - k0) * p01;
+   p_[1][1] = p11 - k1 * p01;
+   return true;
+}
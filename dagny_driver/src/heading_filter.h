@@ -0,0 +1,64 @@
+/*
+ * Heading estimate from the gyro and the compass: a two-state Kalman
+ * filter over yaw and the gyro's z bias.
+ *
+ * Every gyro sample integrates yaw forward; every compass heading corrects
+ * it, and over time pulls the bias in too. Headings that disagree with the
+ * estimate by more than the gate are taken as magnetic disturbances and
+ * ignored, but enough of them in a row start the filter over from the
+ * compass, in case it was the estimate that was wrong.
+ *
+ * Angles are in radians, times in seconds. Not thread-safe; meant to be
+ * fed from the publish thread only.
+ */
+
+#ifndef HEADING_FILTER_H
+#define HEADING_FILTER_H
+
+class HeadingFilter {
+   public:
+      HeadingFilter();
+
+      // gyro_var: gyro noise, (rad/s)^2
+      // bias_var: how fast the gyro bias wanders, (rad/s)^2 per second
+      // compass_var: compass heading noise, rad^2
+      // gate: largest believable compass innovation, in standard
+      //    deviations
+      void configure(double gyro_var, double bias_var, double compass_var,
+            double gate);
+
+      // forget everything; the next compass heading starts it over
+      void reset();
+
+      // gyro rate gz about z at time t
+      void predict(double gz, double t);
+
+      // compass heading at time t. Returns false if it was rejected
+      bool correct(double heading, double t);
+
+      // whether there's been a compass heading to start from
+      bool ready() const { return ready_; }
+
+      double yaw() const { return yaw_; }
+      double yaw_var() const { return p_[0][0]; }
+      double bias() const { return bias_; }
+      double bias_var() const { return p_[1][1]; }
+      unsigned long rejected() const { return rejected_; }
+
+   private:
+      double gyro_var_;
+      double bias_var_;
+      double compass_var_;
+      double gate2_;
+
+      bool ready_;
+      double t_;
+      double yaw_;
+      double bias_;
+      double p_[2][2];
+
+      int rejected_run_;
+      unsigned long rejected_;
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Implementation of the IMU and compass calibration from imu_calibration.h
+ */
+
+#include "imu_calibration.h"
+
+#include <math.h>
+#include <string.h>
+
+RunningStats::RunningStats() {
+   reset();
+}
+
+void RunningStats::reset() {
+   n_ = 0;
+   memset(mean_, 0, sizeof(mean_));
+   memset(m2_, 0, sizeof(m2_));
+}
+
+void RunningStats::add(const double x[3]) {
+   ++n_;
+   double before[3];
+   for( int i=0; i<3; i++ ) {
+      before[i] = x[i] - mean_[i];
+      mean_[i] += before[i] / n_;
+   }
+   for( int i=0; i<3; i++ ) {
+      for( int j=0; j<3; j++ ) {
+         m2_[i*3 + j] += before[i] * (x[j] - mean_[j]);
+      }
+   }
+}
+
+void RunningStats::covariance(double c[9]) const {
+   for( int i=0; i<9; i++ ) {
+      c[i] = n_ > 1 ? m2_[i] / (n_ - 1) : 0.0;
+   }
+}
+
+ImuCalibrator::ImuCalibrator() : samples_(1000), gyro_still2_(0.04),
+   windows_(0) {
+   memset(gyro_bias_, 0, sizeof(gyro_bias_));
+   memset(accel_mean_, 0, sizeof(accel_mean_));
+   memset(gyro_cov_, 0, sizeof(gyro_cov_));
+   memset(accel_cov_, 0, sizeof(accel_cov_));
+}
+
+void ImuCalibrator::configure(unsigned long samples, double gyro_still) {
+   samples_ = samples > 1 ? samples : 2;
+   gyro_still2_ = gyro_still * gyro_still;
+   gyro_.reset();
+   accel_.reset();
+}
+
+bool ImuCalibrator::update(const double gyro[3], const double accel[3],
+      bool stopped) {
+   double rate2 = gyro[0]*gyro[0] + gyro[1]*gyro[1] + gyro[2]*gyro[2];
+   if( !stopped || rate2 > gyro_still2_ ) {
+      gyro_.reset();
+      accel_.reset();
+      return false;
+   }
+   gyro_.add(gyro);
+   accel_.add(accel);
+   if( gyro_.samples() < samples_ ) {
+      return false;
+   }
+
+   memcpy(gyro_bias_, gyro_.mean(), sizeof(gyro_bias_));
+   memcpy(accel_mean_, accel_.mean(), sizeof(accel_mean_));
+   gyro_.covariance(gyro_cov_);
+   accel_.covariance(accel_cov_);
+   gyro_.reset();
+   accel_.reset();
+   ++windows_;
+   return true;
+}
+
+CompassCalibrator::CompassCalibrator() : min_samples_(200), min_bins_(12),
+   max_ratio_(2.0), cx_(0.0), cy_(0.0), radius_(0.0), ratio_(0.0) {
+   soft_[0] = soft_[3] = 1.0;
+   soft_[1] = soft_[2] = 0.0;
+   reset();
+}
+
+void CompassCalibrator::configure(unsigned long min_samples, int min_bins,
+      double max_ratio) {
+   min_samples_ = min_samples > 5 ? min_samples : 5;
+   min_bins_ = min_bins < COMPASS_BINS ? min_bins : COMPASS_BINS;
+   max_ratio_ = max_ratio;
+   reset(ref_x_, ref_y_);
+}
+
+void CompassCalibrator::reset(double cx, double cy) {
+   n_ = 0;
+   memset(ata_, 0, sizeof(ata_));
+   memset(atb_, 0, sizeof(atb_));
+   ref_x_ = cx;
+   ref_y_ = cy;
+   bins_ = 0;
+}
+
+void CompassCalibrator::update(double x, double y) {
+   double row[5] = { x*x, x*y, y*y, x, y };
+   for( int i=0; i<5; i++ ) {
+      for( int j=0; j<5; j++ ) {
+         ata_[i][j] += row[i] * row[j];
+      }
+      atb_[i] += row[i];
+   }
+   ++n_;
+
+   double a = atan2(y - ref_y_, x - ref_x_);
+   int bin = (int)floor((a + M_PI) * COMPASS_BINS / (2.0 * M_PI));
+   if( bin >= COMPASS_BINS ) {
+      bin = COMPASS_BINS - 1;
+   }
+   bins_ |= 1u << bin;
+}
+
+// solve the 5x5 system m x = b in place, by Gaussian elimination with
+// partial pivoting. False if it's singular
+static bool solve5(double m[5][5], double b[5], double x[5]) {
+   for( int c=0; c<5; c++ ) {
+      int p = c;
+      for( int r=c+1; r<5; r++ ) {
+         if( fabs(m[r][c]) > fabs(m[p][c]) ) {
+            p = r;
+         }
+      }
+      if( fabs(m[p][c]) < 1e-12 * (fabs(m[0][0]) + 1e-300) ) {
+         return false;
+      }
+      if( p != c ) {
+         for( int k=0; k<5; k++ ) {
+            double t = m[c][k];
+            m[c][k] = m[p][k];
+            m[p][k] = t;
+         }
+         double t = b[c];
+         b[c] = b[p];
+         b[p] = t;
+      }
+      for( int r=c+1; r<5; r++ ) {
+         double f = m[r][c] / m[c][c];
+         for( int k=c; k<5; k++ ) {
+            m[r][k] -= f * m[c][k];
+         }
+         b[r] -= f * b[c];
+      }
+   }
+   for( int r=4; r>=0; r-- ) {
+      double s = b[r];
+      for( int k=r+1; k<5; k++ ) {
+         s -= m[r][k] * x[k];
+      }
+      x[r] = s / m[r][r];
+   }
+   return true;
+}
+
+bool CompassCalibrator::solve() {
+   if( n_ < min_samples_ ) {
+      return false;
+   }
+   int covered = 0;
+   for( int i=0; i<COMPASS_BINS; i++ ) {
+      covered += (bins_ >> i) & 1;
+   }
+   if( covered < min_bins_ ) {
+      return false;
+   }
+
+   double m[5][5];
+   double b[5];
+   double p[5];
+   memcpy(m, ata_, sizeof(m));
+   memcpy(b, atb_, sizeof(b));
+   if( !solve5(m, b, p) ) {
+      return false;
+   }
+
+   // the conic as (x - c)' Q (x - c) = k
+   double qa = p[0], qb = p[1] / 2.0, qc = p[2];
+   double det = qa * qc - qb * qb;
+   if( det <= 0.0 ) {
+      // not an ellipse
+      return false;
+   }
+   double cx = -(qc * p[3] - qb * p[4]) / (2.0 * det);
+   double cy = -(qa * p[4] - qb * p[3]) / (2.0 * det);
+   double k = 1.0 + qa*cx*cx + 2.0*qb*cx*cy + qc*cy*cy;
+   if( k <= 0.0 ) {
+      return false;
+   }
+   qa /= k;
+   qb /= k;
+   qc /= k;
+   det /= k * k;
+   if( qa <= 0.0 ) {
+      return false;
+   }
+
+   // axes are 1/sqrt of the eigenvalues
+   double tr = qa + qc;
+   double d = sqrt((qa - qc) * (qa - qc) + 4.0 * qb * qb);
+   double l_max = (tr + d) / 2.0;
+   double l_min = (tr - d) / 2.0;
+   if( l_min <= 0.0 ) {
+      return false;
+   }
+   double ratio = sqrt(l_max / l_min);
+   if( ratio > max_ratio_ ) {
+      return false;
+   }
+
+   // sqrt(Q) for a 2x2 symmetric positive definite Q, scaled so that the
+   // ellipse maps onto the circle with the same area
+   double s = sqrt(det);
+   double t = sqrt(tr + 2.0 * s);
+   double r = 1.0 / sqrt(s);
+   soft_[0] = r * (qa + s) / t;
+   soft_[1] = soft_[2] = r * qb / t;
+   soft_[3] = r * (qc + s) / t;
+   cx_ = cx;
+   cy_ = cy;
+   radius_ = r;
+   ratio_ = ratio;
+   return true;
+}
@@ -0,0 +1,142 @@
+/*
+ * Online calibration of the IMU and compass, from the sample streams as
+ * they're decoded. Every update is O(1), so this can run on every packet.
+ *
+ * Gyro and accelerometer biases come from windows of samples taken while
+ * the robot is standing still. Each window keeps a running (Welford) mean
+ * and covariance; the mean is the bias, and the covariance is the sensor
+ * noise. A window that's interrupted by motion is thrown away.
+ *
+ * Hard and soft iron come from a least-squares ellipse fit to the compass
+ * x and y readings as the robot turns. The robot stays level, so z isn't
+ * observable and isn't fit. The fit keeps the normal equations of the
+ * conic
+ *
+ *   A x^2 + B xy + C y^2 + D x + E y = 1
+ *
+ * and solves the 5x5 system only when asked. The ellipse center is the
+ * hard iron offset; the matrix that turns the ellipse back into a circle
+ * of the same area is the soft iron correction.
+ *
+ * The AVR subtracts the offsets it's given from every sample, so samples
+ * here already have the previous offsets removed; the results are
+ * residuals to add to them.
+ *
+ * Not thread-safe; meant to be fed from the publish thread only.
+ */
+
+#ifndef IMU_CALIBRATION_H
+#define IMU_CALIBRATION_H
+
+#include <stdint.h>
+
+// running mean and covariance of a 3-vector
+class RunningStats {
+   public:
+      RunningStats();
+
+      void reset();
+      void add(const double x[3]);
+
+      unsigned long samples() const { return n_; }
+      const double * mean() const { return mean_; }
+      // sample covariance, row-major 3x3
+      void covariance(double c[9]) const;
+
+   private:
+      unsigned long n_;
+      double mean_[3];
+      double m2_[9];
+};
+
+class ImuCalibrator {
+   public:
+      ImuCalibrator();
+
+      // samples: samples in a window
+      // gyro_still: fastest rotation, in rad/s, that still counts as
+      //    standing still
+      void configure(unsigned long samples, double gyro_still);
+
+      // one sample: angular velocity in rad/s and acceleration in m/s^2.
+      // stopped is whether the wheels are. Returns true when this sample
+      // completes a window, and the results below are new
+      bool update(const double gyro[3], const double accel[3], bool stopped);
+
+      // results of the last complete window
+      unsigned long windows() const { return windows_; }
+      const double * gyro_bias() const { return gyro_bias_; }
+      const double * accel_mean() const { return accel_mean_; }
+      const double * gyro_covariance() const { return gyro_cov_; }
+      const double * accel_covariance() const { return accel_cov_; }
+
+   private:
+      unsigned long samples_;
+      double gyro_still2_;
+
+      RunningStats gyro_;
+      RunningStats accel_;
+
+      unsigned long windows_;
+      double gyro_bias_[3];
+      double accel_mean_[3];
+      double gyro_cov_[9];
+      double accel_cov_[9];
+};
+
+// bins of heading around the ellipse that the samples have to cover
+#define COMPASS_BINS 16
+
+class CompassCalibrator {
+   public:
+      CompassCalibrator();
+
+      // min_samples: samples needed before a fit
+      // min_bins: of the COMPASS_BINS directions around the center, how
+      //    many the samples have to cover
+      // max_ratio: largest ratio of the ellipse axes to believe
+      void configure(unsigned long min_samples, int min_bins,
+            double max_ratio);
+
+      // start a new fit. Directions are measured around (cx, cy), which
+      // should be near the middle of the readings
+      void reset(double cx = 0.0, double cy = 0.0);
+
+      void update(double x, double y);
+
+      unsigned long samples() const { return n_; }
+      // mean of the samples so far
+      double mean_x() const { return n_ ? atb_[3] / n_ : ref_x_; }
+      double mean_y() const { return n_ ? atb_[4] / n_ : ref_y_; }
+
+      // fit an ellipse to the samples so far. False if there aren't enough,
+      // they don't go far enough around, or they don't make a believable
+      // ellipse
+      bool solve();
+
+      // results of the last good fit
+      double center_x() const { return cx_; }
+      double center_y() const { return cy_; }
+      // soft iron correction, row-major 2x2; apply to (x - cx, y - cy)
+      const double * soft_iron() const { return soft_; }
+      double radius() const { return radius_; }
+      double axis_ratio() const { return ratio_; }
+
+   private:
+      unsigned long min_samples_;
+      int min_bins_;
+      double max_ratio_;
+
+      unsigned long n_;
+      double ata_[5][5];
+      double atb_[5];
+      double ref_x_, ref_y_;
+      uint32_t bins_;
+
+      double cx_, cy_;
+      double soft_[4];
+      double radius_;
+      double ratio_;
+};
+
+#endif
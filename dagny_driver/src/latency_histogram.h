@@ -0,0 +1,87 @@
+/*
+ * Fixed-bucket latency histogram; cheap enough to update on every packet.
+ *
+ * Buckets are 1, 2, 5, 10, 20, 50 and 100 units wide, in milliseconds by
+ * default; pass a different scale for shorter times, such as 1e6 and "us"
+ * for handler run times.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdio.h>
+#include <string>
+
+#define LATENCY_BUCKETS 8
+
+class LatencyHistogram {
+   public:
+      LatencyHistogram(double scale = 1000.0, const char * unit = "ms") :
+         scale(scale), unit(unit) {
+         reset();
+      }
+
+      // record one latency, in seconds
+      void record(double latency) {
+         double v = latency * scale;
+         int i;
+         for( i=0; i<LATENCY_BUCKETS-1 && v >= limits()[i]; i++ );
+         ++counts[i];
+         ++total;
+         sum += latency;
+         if( latency > max_ ) max_ = latency;
+      }
+
+      void reset() {
+         for( int i=0; i<LATENCY_BUCKETS; i++ ) {
+            counts[i] = 0;
+         }
+         total = 0;
+         sum = 0.0;
+         max_ = 0.0;
+      }
+
+      unsigned long samples() const { return total; }
+
+      // samples in bucket i
+      unsigned long count(int i) const { return counts[i]; }
+
+      // in seconds
+      double mean() const { return total ? sum / total : 0.0; }
+      double max() const { return max_; }
+
+      // human-readable summary, for diagnostics
+      std::string str() const {
+         std::string s;
+         char buf[32];
+         for( int i=0; i<LATENCY_BUCKETS; i++ ) {
+            if( i < LATENCY_BUCKETS-1 ) {
+               snprintf(buf, sizeof(buf), "<%g%s: %lu ", limits()[i], unit,
+                     counts[i]);
+            } else {
+               snprintf(buf, sizeof(buf), ">=%g%s: %lu",
+                     limits()[LATENCY_BUCKETS-2], unit, counts[i]);
+            }
+            s += buf;
+         }
+         return s;
+      }
+
+   private:
+      // upper bucket limits, in milliseconds
+      static const double * limits() {
+         static const double l[LATENCY_BUCKETS-1] = { 1, 2, 5, 10, 20, 50,
+            100 };
+         return l;
+      }
+
+      double scale;
+      const char * unit;
+
+      unsigned long counts[LATENCY_BUCKETS];
+      unsigned long total;
+      double sum;
+      double max_;
+};
+
+#endif
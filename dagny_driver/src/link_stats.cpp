@@ -0,0 +1,71 @@
+/*
+ * Implementation of the link statistics from link_stats.h
+ */
+
+#include "link_stats.h"
+
+LinkStats::LinkStats() : rx_bytes(0), tx_bytes(0), tx_timeouts(0),
+   tx_timeout_bytes(0), last_report(0.0),
+   last_rx_bytes(0), last_tx_bytes(0) {
+   for( int i=0; i<256; i++ ) {
+      packets[i] = 0;
+      last_packets[i] = 0;
+      handler_time[i] = LatencyHistogram(1e6, "us");
+   }
+}
+
+void LinkStats::rx(int n) {
+   boost::mutex::scoped_lock lock(mutex);
+   rx_bytes += n;
+}
+
+void LinkStats::tx(int n) {
+   boost::mutex::scoped_lock lock(mutex);
+   tx_bytes += n;
+}
+
+void LinkStats::tx_timeout(int n) {
+   boost::mutex::scoped_lock lock(mutex);
+   ++tx_timeouts;
+   tx_timeout_bytes += n;
+}
+
+void LinkStats::packet(uint8_t type, double handler, double l) {
+   boost::mutex::scoped_lock lock(mutex);
+   ++packets[type];
+   handler_time[type].record(handler);
+   latency.record(l);
+}
+
+void LinkStats::skipped(uint8_t type) {
+   boost::mutex::scoped_lock lock(mutex);
+   ++packets[type];
+}
+
+void LinkStats::report(double now, LinkReport & r) {
+   boost::mutex::scoped_lock lock(mutex);
+   // the first report covers everything since startup, so it has no rate
+   double period = last_report > 0.0 ? now - last_report : 0.0;
+   r.period = period;
+
+   r.rx_bytes = rx_bytes;
+   r.tx_bytes = tx_bytes;
+   r.rx_rate = period > 0.0 ? (rx_bytes - last_rx_bytes) / period : 0.0;
+   r.tx_rate = period > 0.0 ? (tx_bytes - last_tx_bytes) / period : 0.0;
+   r.tx_timeouts = tx_timeouts;
+   r.tx_timeout_bytes = tx_timeout_bytes;
+   for( int i=0; i<256; i++ ) {
+      r.packets[i] = packets[i];
+      r.packet_rate[i] = period > 0.0 ?
+         (packets[i] - last_packets[i]) / period : 0.0;
+      r.handler_time[i] = handler_time[i];
+      handler_time[i].reset();
+      last_packets[i] = packets[i];
+   }
+   r.latency = latency;
+   latency.reset();
+
+   last_report = now;
+   last_rx_bytes = rx_bytes;
+   last_tx_bytes = tx_bytes;
+}
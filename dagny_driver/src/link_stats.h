@@ -0,0 +1,90 @@
+/*
+ * Serial link statistics: bytes in and out, packets by type, how long each
+ * handler takes, and how long packets take from the serial port to their
+ * topics.
+ *
+ * The worker threads feed in counts as they go; report() turns the totals
+ * into rates over the time since the previous report, and hands out the
+ * handler times for that period before starting them over. Thread-safe.
+ */
+
+#ifndef LINK_STATS_H
+#define LINK_STATS_H
+
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include "latency_histogram.h"
+
+struct LinkReport {
+   // seconds since the previous report
+   double period;
+
+   // totals, and rates over the period in bytes per second
+   unsigned long rx_bytes;
+   unsigned long tx_bytes;
+   double rx_rate;
+   double tx_rate;
+
+   // writes dropped because the port stayed full, and the bytes in them
+   unsigned long tx_timeouts;
+   unsigned long tx_timeout_bytes;
+
+   // packets by type: totals, and rates over the period
+   unsigned long packets[256];
+   double packet_rate[256];
+
+   // handler run time by type over the period, in microseconds
+   LatencyHistogram handler_time[256];
+
+   // time from the receive thread reading a packet until its handler has
+   // finished publishing it, over the period
+   LatencyHistogram latency;
+};
+
+class LinkStats {
+   public:
+      LinkStats();
+
+      // receive thread: n bytes read from the port
+      void rx(int n);
+
+      // transmit thread: n bytes written to the port
+      void tx(int n);
+
+      // transmit thread: n bytes, a whole number of packets, dropped
+      // because the port stayed full
+      void tx_timeout(int n);
+
+      // publish thread: one packet of type, whose handler took
+      // handler_time seconds, published latency seconds after it arrived
+      void packet(uint8_t type, double handler_time, double latency);
+
+      // publish thread: one packet of type that nobody wanted, so it was
+      // never handled
+      void skipped(uint8_t type);
+
+      // fill r with the totals and the rates since the last report at
+      // host time now
+      void report(double now, LinkReport & r);
+
+   private:
+      boost::mutex mutex;
+
+      unsigned long rx_bytes;
+      unsigned long tx_bytes;
+      unsigned long tx_timeouts;
+      unsigned long tx_timeout_bytes;
+      unsigned long packets[256];
+      LatencyHistogram handler_time[256];
+      LatencyHistogram latency;
+
+      // totals at the previous report
+      double last_report;
+      unsigned long last_rx_bytes;
+      unsigned long last_tx_bytes;
+      unsigned long last_packets[256];
+};
+
+#endif
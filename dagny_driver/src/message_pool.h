@@ -0,0 +1,58 @@
+/*
+ * A small pool of preallocated ROS messages, for handlers that publish at
+ * high rate.
+ *
+ * Messages are published by shared pointer, so intraprocess subscribers
+ * get them without a copy. A message is only handed out again once nobody
+ * else holds a reference to it, so subscribers never see a message change
+ * underneath them. Fields that never change (frame_ids, static covariances)
+ * are copied in once from a prototype by init() and left alone after that.
+ */
+
+#ifndef MESSAGE_POOL_H
+#define MESSAGE_POOL_H
+
+#include <boost/shared_ptr.hpp>
+
+template<class M, int N = 16>
+class MessagePool {
+   public:
+      typedef boost::shared_ptr<M> Ptr;
+
+      MessagePool() : next(0), misses_(0) {
+         for( int i=0; i<N; i++ ) {
+            msgs[i].reset(new M());
+         }
+      }
+
+      // fill in the constant parts of every message in the pool
+      void init(const M & prototype) {
+         for( int i=0; i<N; i++ ) {
+            *msgs[i] = prototype;
+         }
+      }
+
+      // get a message that nobody else is using. If subscribers are still
+      // holding every message in the pool, fall back to allocating a copy
+      Ptr get() {
+         for( int i=0; i<N; i++ ) {
+            int idx = (next + i) % N;
+            if( msgs[idx].unique() ) {
+               next = (idx + 1) % N;
+               return msgs[idx];
+            }
+         }
+         ++misses_;
+         return Ptr(new M(*msgs[next]));
+      }
+
+      // number of times the pool was exhausted and we had to allocate
+      unsigned long misses() const { return misses_; }
+
+   private:
+      Ptr msgs[N];
+      int next;
+      unsigned long misses_;
+};
+
+#endif
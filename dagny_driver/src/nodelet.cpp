@@ -0,0 +1,31 @@
+/*
+ * dagny_driver as a nodelet, so that consumers in the same nodelet manager
+ * receive sensor messages without serialization.
+ */
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "driver.h"
+
+namespace dagny_driver {
+
+class DriverNodelet : public nodelet::Nodelet {
+   public:
+      virtual ~DriverNodelet() {
+         driver_stop();
+      }
+
+   private:
+      virtual void onInit() {
+         // use the single-threaded handle; the driver's callbacks assume
+         // they don't run concurrently
+         if( !driver_start(getNodeHandle()) ) {
+            NODELET_ERROR("Failed to start dagny_driver");
+         }
+      }
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(dagny_driver::DriverNodelet, nodelet::Nodelet)
@@ -0,0 +1,112 @@
+/*
+ * Implementation of the odometry integrator from odometry.h
+ */
+
+#include "odometry.h"
+#include "dagny_driver/steer.h"
+
+#include <math.h>
+#include <string.h>
+
+OdometryIntegrator::OdometryIntegrator() : scale_(0.08), distance_var_(0.01),
+   curvature_var_(0.01) {
+   reset();
+}
+
+void OdometryIntegrator::configure(double meters_per_count,
+      double distance_var, double curvature_var) {
+   scale_ = meters_per_count;
+   distance_var_ = distance_var;
+   curvature_var_ = curvature_var;
+}
+
+void OdometryIntegrator::reset() {
+   have_count_ = false;
+   last_count_ = 0;
+   last_t_ = 0.0;
+   x_ = y_ = yaw_ = 0.0;
+   v_ = w_ = 0.0;
+   v_var_ = w_var_ = 0.0;
+   memset(p_, 0, sizeof(p_));
+}
+
+void OdometryIntegrator::update(int16_t count, int8_t steer, double t) {
+   if( !have_count_ ) {
+      have_count_ = true;
+      last_count_ = count;
+      last_t_ = t;
+      return;
+   }
+
+   // the counter wraps at 16 bits; the difference is right as long as we
+   // don't miss 32k counts between packets
+   int16_t counts = (int16_t)(count - last_count_);
+   last_count_ = count;
+   double d = counts * scale_;
+
+   // negative steering turns left, which is positive yaw. The radius at
+   // steer 0 is only a stand-in for straight ahead
+   double k = 0.0;
+   if( steer != 0 ) {
+      k = (steer < 0 ? 1.0 : -1.0) / steer2radius(steer);
+   }
+   double dyaw = d * k;
+
+   // jacobians at the midpoint heading of the arc
+   double m = yaw_ + dyaw / 2.0;
+   double c = cos(m);
+   double s = sin(m);
+
+   // integrate along the arc; straight line when the arc is too flat to
+   // divide by its curvature
+   if( fabs(dyaw) > 1e-9 ) {
+      x_ += (sin(yaw_ + dyaw) - sin(yaw_)) / k;
+      y_ += (cos(yaw_) - cos(yaw_ + dyaw)) / k;
+   } else {
+      x_ += d * c;
+      y_ += d * s;
+   }
+   yaw_ = atan2(sin(yaw_ + dyaw), cos(yaw_ + dyaw));
+
+   // P = F P F' + G Q G', with F the jacobian over (x, y, yaw) and G the
+   // jacobian over (distance, curvature)
+   double f[9] = { 1.0, 0.0, -d * s,
+                   0.0, 1.0,  d * c,
+                   0.0, 0.0,  1.0 };
+   double g[6] = { c, -d * d * s / 2.0,
+                   s,  d * d * c / 2.0,
+                   k,  d };
+   double q[2] = { distance_var_ * fabs(d), curvature_var_ };
+
+   double fp[9];
+   for( int i=0; i<3; ++i ) {
+      for( int j=0; j<3; ++j ) {
+         fp[i*3 + j] = 0.0;
+         for( int l=0; l<3; ++l ) {
+            fp[i*3 + j] += f[i*3 + l] * p_[l*3 + j];
+         }
+      }
+   }
+   for( int i=0; i<3; ++i ) {
+      for( int j=0; j<3; ++j ) {
+         double sum = 0.0;
+         for( int l=0; l<3; ++l ) {
+            sum += fp[i*3 + l] * f[j*3 + l];
+         }
+         for( int l=0; l<2; ++l ) {
+            sum += g[i*2 + l] * q[l] * g[j*2 + l];
+         }
+         p_[i*3 + j] = sum;
+      }
+   }
+
+   // velocities over the time between packets
+   double dt = t - last_t_;
+   last_t_ = t;
+   if( dt > 0.0 ) {
+      v_ = d / dt;
+      w_ = dyaw / dt;
+      v_var_ = q[0] / (dt * dt);
+      w_var_ = (k * k * q[0] + d * d * q[1]) / (dt * dt);
+   }
+}
@@ -0,0 +1,63 @@
+/*
+ * Host-side dead reckoning from the raw encoder count and steering setting.
+ *
+ * Each odometry packet carries the AVR's cumulative 16-bit encoder count
+ * and the current steering setting. The distance since the last packet and
+ * the curvature from steer2radius() give a circular arc, which we
+ * integrate exactly in double precision. Pose covariance is propagated
+ * from a distance noise that grows with distance travelled and a fixed
+ * curvature noise.
+ *
+ * Not thread-safe; meant to be fed from the publish thread only.
+ */
+
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include <stdint.h>
+
+class OdometryIntegrator {
+   public:
+      OdometryIntegrator();
+
+      // meters_per_count: distance per encoder count
+      // distance_var: variance in distance, m^2 per meter travelled
+      // curvature_var: variance in curvature, (1/m)^2
+      void configure(double meters_per_count, double distance_var,
+            double curvature_var);
+
+      // start over at the origin, with zero covariance
+      void reset();
+
+      // new sample: cumulative encoder count and steering setting at time t
+      // (seconds). The first sample after a reset only sets the reference
+      // count
+      void update(int16_t count, int8_t steer, double t);
+
+      double x() const { return x_; }
+      double y() const { return y_; }
+      double yaw() const { return yaw_; }
+      double linear() const { return v_; }
+      double angular() const { return w_; }
+      double linear_var() const { return v_var_; }
+      double angular_var() const { return w_var_; }
+
+      // pose covariance over (x, y, yaw), row-major
+      const double * covariance() const { return p_; }
+
+   private:
+      double scale_;
+      double distance_var_;
+      double curvature_var_;
+
+      bool have_count_;
+      int16_t last_count_;
+      double last_t_;
+
+      double x_, y_, yaw_;
+      double v_, w_;
+      double v_var_, w_var_;
+      double p_[9];
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Declarative packet layouts.
+ *
+ * A packet schema is a list of (type, name) fields in wire order:
+ *
+ *   #define SONAR_FIELDS(F) \
+ *      F(uint8_t, index) \
+ *      F(uint8_t, range)
+ *   PACKET_SCHEMA(SonarPacket, SONAR_FIELDS);
+ *
+ * declares a plain struct SonarPacket with those members, and:
+ *   SIZE                    encoded payload size in bytes, without padding
+ *   unpack(const char * b)  decode SIZE raw little-endian bytes in one pass
+ *   read(P & p)             decode with P's readu8()/reads16()/... calls,
+ *                           for packet classes that can't hand out raw
+ *                           bytes (escaped framing)
+ *   write(P & p)            append every field to an outbound packet
+ *
+ * Only uses the C library, so that the same layouts can be shared with the
+ * AVR firmware. Like the rest of the protocol, assumes both ends are
+ * little-endian with 4-byte floats.
+ */
+
+#ifndef PACKET_SCHEMA_H
+#define PACKET_SCHEMA_H
+
+#include <stdint.h>
+#include <string.h>
+
+template<class P> inline void schema_get(P & p, uint8_t & v) {
+   v = p.readu8();
+}
+template<class P> inline void schema_get(P & p, int8_t & v) {
+   v = p.reads8();
+}
+template<class P> inline void schema_get(P & p, uint16_t & v) {
+   v = p.readu16();
+}
+template<class P> inline void schema_get(P & p, int16_t & v) {
+   v = p.reads16();
+}
+template<class P> inline void schema_get(P & p, uint32_t & v) {
+   v = p.readu32();
+}
+template<class P> inline void schema_get(P & p, int32_t & v) {
+   v = p.reads32();
+}
+template<class P> inline void schema_get(P & p, float & v) {
+   v = p.readfloat();
+}
+
+#define SCHEMA_MEMBER(type, name) type name;
+#define SCHEMA_SIZE(type, name) + (int)sizeof(type)
+#define SCHEMA_UNPACK(type, name) memcpy(&name, b, sizeof(type)); \
+   b += sizeof(type);
+#define SCHEMA_READ(type, name) schema_get(p, name);
+#define SCHEMA_WRITE(type, name) p.append(name);
+
+#define PACKET_SCHEMA(NAME, FIELDS) \
+   struct NAME { \
+      FIELDS(SCHEMA_MEMBER) \
+      enum { SIZE = 0 FIELDS(SCHEMA_SIZE) }; \
+      void unpack(const char * b) { FIELDS(SCHEMA_UNPACK) } \
+      template<class P> void read(P & p) { FIELDS(SCHEMA_READ) } \
+      template<class P> void write(P & p) const { FIELDS(SCHEMA_WRITE) } \
+   }
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Payload layouts of the packets the AVR sends, and of the larger ones
+ * sent to it, as packet schemas (see packet_schema.h). Packets stamped
+ * with an AVR tick carry it after the payload when time sync is on; it
+ * isn't part of the schema.
+ */
+
+#ifndef PACKETS_H
+#define PACKETS_H
+
+#include "packet_schema.h"
+
+// 'O': odometry
+#define ODOMETRY_FIELDS(F) \
+   F(float, linear) \
+   F(float, angular) \
+   F(float, x) \
+   F(float, y) \
+   F(float, yaw) \
+   F(uint8_t, bump) \
+   F(int16_t, qcount) \
+   F(int8_t, steer)
+PACKET_SCHEMA(OdometryPacket, ODOMETRY_FIELDS);
+
+// 'I': idle count and I2C state
+#define IDLE_FIELDS(F) \
+   F(uint16_t, idle) \
+   F(uint8_t, i2c_failures) \
+   F(uint8_t, i2c_resets)
+PACKET_SCHEMA(IdlePacket, IDLE_FIELDS);
+
+// 'G': GPS fix
+#define GPS_FIELDS(F) \
+   F(int32_t, lat)          /* millionths of a degree */ \
+   F(int32_t, lon)          /* millionths of a degree */ \
+   F(int32_t, altitude)     /* centimeters */ \
+   F(uint32_t, hdop_100)    /* HDOP * 100 */ \
+   F(uint32_t, speed_100)   /* hundredths of a knot */ \
+   F(uint32_t, course_100)  /* hundredths of a degree */
+PACKET_SCHEMA(GpsPacket, GPS_FIELDS);
+
+// 'S': one sonar reading
+#define SONAR_FIELDS(F) \
+   F(uint8_t, index) \
+   F(uint8_t, range)        /* inches */
+PACKET_SCHEMA(SonarPacket, SONAR_FIELDS);
+
+// 'U': orientation from the IMU
+#define HEADING_FIELDS(F) \
+   F(float, x) \
+   F(float, y) \
+   F(float, z)
+PACKET_SCHEMA(HeadingPacket, HEADING_FIELDS);
+
+// 'M': raw magnetometer
+#define COMPASS_FIELDS(F) \
+   F(float, x) \
+   F(float, y) \
+   F(float, z)
+PACKET_SCHEMA(CompassPacket, COMPASS_FIELDS);
+
+// 'V': one raw IMU sample
+#define RAW_IMU_FIELDS(F) \
+   F(float, gx) \
+   F(float, gy) \
+   F(float, gz) \
+   F(float, ax) \
+   F(float, ay) \
+   F(float, az)
+PACKET_SCHEMA(RawImuPacket, RAW_IMU_FIELDS);
+
+// 'W': batch of raw IMU samples; a header followed by n samples
+#define IMU_BATCH_FIELDS(F) \
+   F(uint8_t, n) \
+   F(uint32_t, tick)        /* base tick count */ \
+   F(float, gyro_scale)     /* rad/s per count */ \
+   F(float, accel_scale)    /* m/s^2 per count */
+PACKET_SCHEMA(ImuBatchPacket, IMU_BATCH_FIELDS);
+
+#define IMU_SAMPLE_FIELDS(F) \
+   F(uint8_t, dt)           /* ticks since the previous sample */ \
+   F(int16_t, gx) \
+   F(int16_t, gy) \
+   F(int16_t, gz) \
+   F(int16_t, ax) \
+   F(int16_t, ay) \
+   F(int16_t, az)
+PACKET_SCHEMA(ImuSample, IMU_SAMPLE_FIELDS);
+
+// 'H': heartbeat reply
+#define HEARTBEAT_FIELDS(F) \
+   F(uint32_t, tick)
+PACKET_SCHEMA(HeartbeatPacket, HEARTBEAT_FIELDS);
+
+// 'B': raw battery voltages
+#define BATTERY_FIELDS(F) \
+   F(uint8_t, main) \
+   F(uint8_t, motor)
+PACKET_SCHEMA(BatteryPacket, BATTERY_FIELDS);
+
+// 'L': goal input; an operation followed by its arguments
+#define GOAL_FIELDS(F) \
+   F(int8_t, operation)
+PACKET_SCHEMA(GoalPacket, GOAL_FIELDS);
+
+#define GOAL_APPEND_FIELDS(F) \
+   F(int32_t, lat)          /* millionths of a degree */ \
+   F(int32_t, lon)          /* millionths of a degree */
+PACKET_SCHEMA(GoalAppendPacket, GOAL_APPEND_FIELDS);
+
+#define GOAL_DELETE_FIELDS(F) \
+   F(int32_t, id)
+PACKET_SCHEMA(GoalDeletePacket, GOAL_DELETE_FIELDS);
+
+// 'L' operations for keeping the AVR's goal list in sync with the
+// driver's (see goal_store.h). The driver sends batches of changes; the
+// AVR applies a batch only if its base is the version it has, and acks
+// with the version it has afterwards. A batch with GOAL_RESET clears the
+// AVR's list and sets its version to the base first
+#define GOAL_BATCH 16
+#define GOAL_ACK 17
+
+#define GOAL_RESET 0x01
+// entries per batch, so that an escaped batch fits in a transmit frame
+#define GOAL_BATCH_MAX 7
+
+// to the AVR: a header followed by n entries
+#define GOAL_BATCH_FIELDS(F) \
+   F(uint8_t, flags) \
+   F(uint16_t, base)        /* version the changes apply to */ \
+   F(uint8_t, n)
+PACKET_SCHEMA(GoalBatchPacket, GOAL_BATCH_FIELDS);
+
+#define GOAL_ENTRY_FIELDS(F) \
+   F(int8_t, operation)     /* from Goal.msg */ \
+   F(int32_t, id) \
+   F(int32_t, before)       /* insert only */ \
+   F(int32_t, lat)          /* millionths of a degree */ \
+   F(int32_t, lon)          /* millionths of a degree */
+PACKET_SCHEMA(GoalEntryPacket, GOAL_ENTRY_FIELDS);
+
+// from the AVR: flags has GOAL_RESET if the batch acked was a reset
+#define GOAL_ACK_FIELDS(F) \
+   F(uint16_t, version) \
+   F(uint8_t, flags)
+PACKET_SCHEMA(GoalAckPacket, GOAL_ACK_FIELDS);
+
+// 'A', to the AVR: laser obstacle summary; a header followed by the
+// encoded sectors (see scan_summary.h)
+#define LASER_SUMMARY_FIELDS(F) \
+   F(uint8_t, sectors) \
+   F(uint8_t, resolution_cm) /* centimeters per count */ \
+   F(int16_t, angle_min)     /* start of the first sector, milliradians */ \
+   F(uint16_t, sector_width) /* milliradians */
+PACKET_SCHEMA(LaserSummaryPacket, LASER_SUMMARY_FIELDS);
+
+#endif
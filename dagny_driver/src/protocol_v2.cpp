@@ -0,0 +1,78 @@
+/*
+ * Implementation of the version 2 framing from protocol_v2.h
+ */
+
+#include "protocol_v2.h"
+
+// CRC lookup table, built during static initialization
+static struct CrcTable {
+   uint16_t t[256];
+   CrcTable() {
+      for( int i=0; i<256; i++ ) {
+         uint16_t c = i << 8;
+         for( int j=0; j<8; j++ ) {
+            c = (c & 0x8000) ? (c << 1) ^ 0x1021 : (c << 1);
+         }
+         t[i] = c;
+      }
+   }
+} crc_table;
+
+// how many bytes version 1 framing turns each byte into, from Packet's own
+// writer; also built during static initialization
+static struct EscapeTable {
+   uint8_t len[256];
+   EscapeTable() {
+      char buf[8];
+      for( int i=0; i<256; i++ ) {
+         Packet p('x', sizeof(buf), buf);
+         p.reset();
+         int start = p.outsz();
+         p.append((uint8_t)i);
+         len[i] = p.outsz() - start;
+      }
+   }
+} escape_table;
+
+int v1_unescape(char * in, int sz, char * out, int max) {
+   if( sz < 1 || max < 1 ) {
+      return 0;
+   }
+   Packet p(in, sz);
+   out[0] = in[0];
+   int n = 1;
+   int used = 1;
+   while( used < sz && n < max ) {
+      uint8_t c = p.readu8();
+      used += escape_table.len[c];
+      if( used > sz ) {
+         break;
+      }
+      out[n++] = c;
+   }
+   return n;
+}
+
+uint16_t crc16(const char * data, int len, uint16_t crc) {
+   const uint8_t * d = (const uint8_t*)data;
+   for( int i=0; i<len; i++ ) {
+      crc = (crc << 8) ^ crc_table.t[((crc >> 8) ^ d[i]) & 0xFF];
+   }
+   return crc;
+}
+
+void PacketV2::reset() {
+   buf[0] = V2_SYNC0;
+   buf[1] = V2_SYNC1;
+   buf[2] = PROTOCOL_V2;
+   buf[3] = 0;
+   buf[4] = type;
+   sz = V2_HEADER;
+}
+
+void PacketV2::finish() {
+   buf[3] = sz - V2_HEADER;
+   uint16_t crc = crc16(buf + 2, sz - 2);
+   buf[sz++] = crc & 0xFF;
+   buf[sz++] = crc >> 8;
+}
@@ -0,0 +1,179 @@
+/*
+ * Version 2 of the serial framing.
+ *
+ * Version 1 (protocol.h) terminates each packet with '\r' and escapes any
+ * payload bytes that look like framing, so the receiver has to look at
+ * every byte and there is no integrity check. Version 2 frames carry their
+ * length up front and a CRC at the end:
+ *
+ *   0xA5 0x5A            sync word
+ *   uint8_t version      PROTOCOL_V2
+ *   uint8_t len          payload length, not including the type
+ *   char type            same packet types as version 1
+ *   len bytes            payload; the same bytes version 1 would send,
+ *                        before escaping
+ *   uint16_t crc         CRC-16/CCITT of version through the payload,
+ *                        little-endian
+ *
+ * PacketV2 has the same interface as Packet, so the handlers and outbound
+ * packets work with either version. Multi-byte values are little-endian,
+ * as on the AVR.
+ */
+
+#ifndef PROTOCOL_V2_H
+#define PROTOCOL_V2_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define PROTOCOL_V2 2
+#define V2_SYNC0 0xA5
+#define V2_SYNC1 0x5A
+// sync, version, len and type
+#define V2_HEADER 5
+// header and CRC
+#define V2_OVERHEAD (V2_HEADER + 2)
+#define V2_PAYLOAD_MAX 255
+
+// table-driven CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF)
+uint16_t crc16(const char * data, int len, uint16_t crc = 0xFFFF);
+
+class PacketV2 {
+   public:
+      // input packet; in points at the type byte and sz counts the type and
+      // the payload. The framer has already checked the CRC
+      PacketV2(char * in, int sz) : buf(in), sz(sz), idx(1), max(sz) {}
+
+      // output packet of type t, built in b, which must have room for
+      // max bytes including the framing. Nothing is written to b until
+      // reset()
+      PacketV2(char t, int max, char * b) : buf(b), sz(V2_HEADER), idx(0),
+         max(max), type(t) {}
+
+      // input: the type and payload. output: the whole frame
+      int outsz() const { return sz; }
+      const char * outbuf() const { return buf; }
+
+      // bytes left to read in an input packet
+      int remaining() const { return sz - idx; }
+
+      // input: the next n bytes in one go, or 0 (and nothing consumed) if
+      // there aren't that many left
+      const char * take(int n) {
+         if( idx + n > sz ) {
+            return 0;
+         }
+         const char * r = buf + idx;
+         idx += n;
+         return r;
+      }
+
+      // output
+      void reset();
+      void finish();
+
+      void append(uint8_t c) { put(&c, 1); }
+      void append(int8_t c) { put(&c, 1); }
+      void append(uint16_t c) { put(&c, 2); }
+      void append(int16_t c) { put(&c, 2); }
+      void append(uint32_t c) { put(&c, 4); }
+      void append(int32_t c) { put(&c, 4); }
+      void append(float f) { put(&f, 4); }
+
+      // input; reads past the end return 0
+      uint8_t readu8() { uint8_t r = 0; get(&r, 1); return r; }
+      int8_t reads8() { int8_t r = 0; get(&r, 1); return r; }
+      uint16_t readu16() { uint16_t r = 0; get(&r, 2); return r; }
+      int16_t reads16() { int16_t r = 0; get(&r, 2); return r; }
+      uint32_t readu32() { uint32_t r = 0; get(&r, 4); return r; }
+      int32_t reads32() { int32_t r = 0; get(&r, 4); return r; }
+      float readfloat() { float r = 0; get(&r, 4); return r; }
+
+   private:
+      void put(const void * d, int n) {
+         if( sz + n + 2 <= max && sz + n - V2_HEADER <= V2_PAYLOAD_MAX ) {
+            memcpy(buf + sz, d, n);
+            sz += n;
+         }
+      }
+
+      void get(void * d, int n) {
+         if( idx + n <= sz ) {
+            memcpy(d, buf + idx, n);
+            idx += n;
+         } else {
+            idx = sz;
+         }
+      }
+
+      char * buf;
+      int sz;
+      int idx;
+      int max;
+      char type;
+};
+
+// unescape a version 1 frame, in starting at its type byte and sz bytes
+// long without the terminator, into out, so that it can be read as a
+// PacketV2 with exact length checks. Goes through Packet's own reader, so
+// it follows whatever escaping protocol.h uses. A trailing escape with
+// nothing after it is dropped. Returns the size of the unescaped frame
+int v1_unescape(char * in, int sz, char * out, int max);
+
+// the type of a finished frame in either version; version 2 frames start
+// with the sync word
+inline char frame_type(const char * buf, int version) {
+   return version == PROTOCOL_V2 ? buf[V2_HEADER - 1] : buf[0];
+}
+
+// an outbound packet in whichever protocol version the link is using
+class OutPacket {
+   public:
+      OutPacket(char t, int max, char * b) : v1(t, max, b), v2(t, max, b),
+         version(1) {}
+
+      // switch to version 2 framing. Only do this once, at startup
+      void set_version(int v) { version = v; }
+
+      void reset() {
+         if( version == PROTOCOL_V2 ) {
+            v2.reset();
+         } else {
+            v1.reset();
+         }
+      }
+
+      void finish() {
+         if( version == PROTOCOL_V2 ) {
+            v2.finish();
+         } else {
+            v1.finish();
+         }
+      }
+
+      template<class T> void append(T c) {
+         if( version == PROTOCOL_V2 ) {
+            v2.append(c);
+         } else {
+            v1.append(c);
+         }
+      }
+
+      const char * outbuf() {
+         return version == PROTOCOL_V2 ? v2.outbuf() : v1.outbuf();
+      }
+
+      int outsz() {
+         return version == PROTOCOL_V2 ? v2.outsz() : v1.outsz();
+      }
+
+   private:
+      // both write into the same buffer; only one is ever in use
+      Packet v1;
+      PacketV2 v2;
+      int version;
+};
+
+#endif
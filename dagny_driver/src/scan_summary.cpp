@@ -0,0 +1,145 @@
+/*
+ * Implementation of the laser scan summary from scan_summary.h
+ */
+
+#include "scan_summary.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define TOKEN_DELTA 0x00
+#define TOKEN_RUN 0x80
+#define TOKEN_LITERAL 0xC0
+#define DELTA_BIAS 64
+#define RUN_MAX 64
+
+ScanSummary::ScanSummary() : sectors_(0), resolution_(0.05f),
+   threshold_(2), keepalive_(1.0), angle_min_(0.0f), sector_width_(0.0f),
+   sent_angle_min_(0.0f), sent_width_(0.0f), sent_t_(0.0),
+   have_sent_(false) {
+   configure(32, 0.05f, 2, 1.0);
+}
+
+void ScanSummary::configure(int sectors, float resolution, int threshold,
+      double keepalive) {
+   if( sectors < 1 ) sectors = 1;
+   if( sectors > SCAN_SECTORS_MAX ) sectors = SCAN_SECTORS_MAX;
+   sectors_ = sectors;
+   resolution_ = resolution;
+   threshold_ = threshold;
+   keepalive_ = keepalive;
+   summary_.assign(sectors_, SCAN_FAR);
+   have_sent_ = false;
+}
+
+bool ScanSummary::update(const float * ranges, int n, float range_min,
+      float range_max, float angle_min, float angle_increment, double t) {
+   if( n < sectors_ ) {
+      return false;
+   }
+
+   // quantize every beam first, so that the per-sector minimum is a plain
+   // byte reduction. Both loops are simple enough for the compiler to
+   // vectorize
+   beams_.resize(n);
+   uint8_t * q = &beams_[0];
+   const float scale = 1.0f / resolution_;
+   for( int i=0; i<n; i++ ) {
+      float r = ranges[i];
+      float c = r * scale;
+      c = c < (float)SCAN_FAR ? c : (float)SCAN_FAR;
+      // false for NaN, too
+      bool valid = r >= range_min && r <= range_max;
+      q[i] = valid ? (uint8_t)c : SCAN_FAR;
+   }
+
+   for( int s=0; s<sectors_; s++ ) {
+      int start = s * n / sectors_;
+      int end = (s + 1) * n / sectors_;
+      uint8_t m = SCAN_FAR;
+      for( int i=start; i<end; i++ ) {
+         m = q[i] < m ? q[i] : m;
+      }
+      summary_[s] = m;
+   }
+   angle_min_ = angle_min;
+   sector_width_ = angle_increment * n / sectors_;
+
+   // send if any sector moved by the threshold or more, if the geometry
+   // changed, or if the AVR hasn't heard from us in a while
+   bool send = !have_sent_ || t - sent_t_ >= keepalive_ ||
+      angle_min_ != sent_angle_min_ || sector_width_ != sent_width_;
+   for( int s=0; !send && s<sectors_; s++ ) {
+      if( abs(summary_[s] - sent_[s]) >= threshold_ ) {
+         send = true;
+      }
+   }
+   if( send ) {
+      sent_ = summary_;
+      sent_angle_min_ = angle_min_;
+      sent_width_ = sector_width_;
+      sent_t_ = t;
+      have_sent_ = true;
+   }
+   return send;
+}
+
+int ScanSummary::encode(uint8_t * buf) const {
+   int len = 0;
+   int prev = SCAN_FAR;
+   int s = 0;
+   while( s < sectors_ ) {
+      int v = summary_[s];
+      if( v == prev ) {
+         int run = 1;
+         while( s + run < sectors_ && summary_[s + run] == prev &&
+               run < RUN_MAX ) {
+            ++run;
+         }
+         buf[len++] = TOKEN_RUN + run - 1;
+         s += run;
+         continue;
+      }
+      int d = v - prev;
+      if( d >= -DELTA_BIAS && d < DELTA_BIAS ) {
+         buf[len++] = TOKEN_DELTA + d + DELTA_BIAS;
+      } else {
+         buf[len++] = TOKEN_LITERAL;
+         buf[len++] = v;
+      }
+      prev = v;
+      ++s;
+   }
+   return len;
+}
+
+bool scan_decode(const uint8_t * buf, int len, uint8_t * out, int n) {
+   int prev = SCAN_FAR;
+   int s = 0;
+   int i = 0;
+   while( i < len ) {
+      uint8_t t = buf[i++];
+      if( t >= TOKEN_LITERAL ) {
+         if( i >= len || s >= n ) {
+            return false;
+         }
+         prev = buf[i++];
+         out[s++] = prev;
+      } else if( t >= TOKEN_RUN ) {
+         int run = t - TOKEN_RUN + 1;
+         if( s + run > n ) {
+            return false;
+         }
+         while( run-- ) {
+            out[s++] = prev;
+         }
+      } else {
+         if( s >= n ) {
+            return false;
+         }
+         prev += t - DELTA_BIAS;
+         out[s++] = prev;
+      }
+   }
+   return s == n;
+}
@@ -0,0 +1,96 @@
+/*
+ * Compact obstacle summary of a laser scan, for the AVR's reactive
+ * obstacle avoidance.
+ *
+ * The scan is split into equal sectors, and each sector is reduced to the
+ * nearest valid range in it, quantized to a byte; SCAN_FAR means nothing
+ * in range. The sectors are then run-length and delta encoded, so that
+ * open space and smooth walls take a byte or two:
+ *
+ *   0x00-0x7F  tt      the previous sector + (tt - 64), one sector
+ *   0x80-0xBF  nn      the previous sector repeated nn - 0x80 + 1 times
+ *   0xC0 vv            the literal value vv, one sector
+ *
+ * The "previous sector" starts out as SCAN_FAR. Encoding is only against
+ * neighbouring sectors in the same scan, never against an earlier scan, so
+ * a lost packet costs nothing but its own data.
+ *
+ * Summaries only need to go out when they change meaningfully, or every so
+ * often so that the AVR knows the data is fresh; update() decides.
+ *
+ * Not thread-safe.
+ */
+
+#ifndef SCAN_SUMMARY_H
+#define SCAN_SUMMARY_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// quantized value of an empty sector
+#define SCAN_FAR 255
+#define SCAN_SECTORS_MAX 64
+// longest encoding of a summary
+#define SCAN_ENCODED_MAX (2 * SCAN_SECTORS_MAX)
+
+class ScanSummary {
+   public:
+      ScanSummary();
+
+      // sectors: how many sectors to split each scan into, up to
+      //    SCAN_SECTORS_MAX
+      // resolution: meters per count of the quantized ranges
+      // threshold: smallest change in any sector worth sending, in counts
+      // keepalive: longest time between summaries, in seconds, even if
+      //    nothing changes
+      void configure(int sectors, float resolution, int threshold,
+            double keepalive);
+
+      // summarize a scan of n ranges that arrived at time t. Ranges
+      // outside [range_min, range_max], and NaNs, count as nothing in
+      // range. Returns true if the new summary should be sent, in which
+      // case it's taken as sent
+      bool update(const float * ranges, int n, float range_min,
+            float range_max, float angle_min, float angle_increment,
+            double t);
+
+      // the most recent summary
+      int n_sectors() const { return sectors_; }
+      const uint8_t * sectors() const { return &summary_[0]; }
+      float resolution() const { return resolution_; }
+      // angle of the start of the first sector, and the width of each
+      // sector, in radians
+      float angle_min() const { return angle_min_; }
+      float sector_width() const { return sector_width_; }
+
+      // encode the most recent summary into buf, which must have room for
+      // SCAN_ENCODED_MAX bytes. Returns the encoded length
+      int encode(uint8_t * buf) const;
+
+   private:
+      int sectors_;
+      float resolution_;
+      int threshold_;
+      double keepalive_;
+
+      float angle_min_;
+      float sector_width_;
+
+      // per-beam quantized ranges; kept to avoid reallocating every scan
+      std::vector<uint8_t> beams_;
+      std::vector<uint8_t> summary_;
+
+      // the last summary sent
+      std::vector<uint8_t> sent_;
+      float sent_angle_min_;
+      float sent_width_;
+      double sent_t_;
+      bool have_sent_;
+};
+
+// decode an encoded summary of n sectors into out. Returns false if it
+// doesn't decode to exactly n sectors
+bool scan_decode(const uint8_t * buf, int len, uint8_t * out, int n);
+
+#endif
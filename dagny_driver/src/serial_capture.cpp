@@ -0,0 +1,171 @@
+/*
+ * Implementation of the serial capture files from serial_capture.h
+ */
+
+#include "serial_capture.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CAPTURE_ALIGN 8
+
+static size_t padded(size_t len) {
+   return (len + CAPTURE_ALIGN - 1) & ~(size_t)(CAPTURE_ALIGN - 1);
+}
+
+CaptureWriter::CaptureWriter() : f(0), bytes(0), origin(0), last_end(0) {
+}
+
+CaptureWriter::~CaptureWriter() {
+   close();
+}
+
+bool CaptureWriter::open(const std::string & file, int protocol,
+      double now) {
+   close();
+   f = fopen(file.c_str(), "wb");
+   if( !f ) {
+      return false;
+   }
+   CaptureHeader h;
+   memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+   h.version = CAPTURE_VERSION;
+   h.protocol = protocol;
+   h.start = now;
+   if( fwrite(&h, sizeof(h), 1, f) != 1 ) {
+      fclose(f);
+      f = 0;
+      return false;
+   }
+   bytes = 0;
+   last_end = 0;
+   index.clear();
+   return true;
+}
+
+void CaptureWriter::data(const char * buf, int len, double now) {
+   if( !f || len <= 0 ) {
+      return;
+   }
+   CaptureRecord r;
+   r.stamp = now;
+   r.len = len;
+   r.reserved = 0;
+   static const char zeros[CAPTURE_ALIGN] = { 0 };
+   fwrite(&r, sizeof(r), 1, f);
+   fwrite(buf, 1, len, f);
+   fwrite(zeros, 1, padded(len) - len, f);
+   bytes += len;
+}
+
+void CaptureWriter::frame(uint32_t end) {
+   boost::mutex::scoped_lock lock(index_mutex);
+   // framer positions wrap at 32 bits; frames end in order, so unwrap
+   // against the last one
+   last_end += (uint32_t)(end - (uint32_t)(origin + last_end));
+   index.push_back(last_end);
+}
+
+void CaptureWriter::close() {
+   if( !f ) {
+      return;
+   }
+   boost::mutex::scoped_lock lock(index_mutex);
+   CaptureFooter footer;
+   footer.index = ftell(f);
+   footer.frames = index.size();
+   footer.bytes = bytes;
+   memcpy(footer.magic, CAPTURE_INDEX_MAGIC, sizeof(footer.magic));
+   if( !index.empty() ) {
+      fwrite(&index[0], sizeof(index[0]), index.size(), f);
+   }
+   fwrite(&footer, sizeof(footer), 1, f);
+   fclose(f);
+   f = 0;
+}
+
+CaptureReader::CaptureReader() : map(0), map_sz(0), header_(0), pos(0),
+   end(0), frame_index(0), n_frames(0) {
+}
+
+CaptureReader::~CaptureReader() {
+   close();
+}
+
+bool CaptureReader::open(const std::string & file) {
+   close();
+   int fd = ::open(file.c_str(), O_RDONLY);
+   if( fd < 0 ) {
+      return false;
+   }
+   struct stat st;
+   if( fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CaptureHeader) ) {
+      ::close(fd);
+      return false;
+   }
+   void * m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if( m == MAP_FAILED ) {
+      return false;
+   }
+   map = (char*)m;
+   map_sz = st.st_size;
+
+   header_ = (const CaptureHeader*)map;
+   if( memcmp(header_->magic, CAPTURE_MAGIC, sizeof(header_->magic)) != 0 ||
+         header_->version != CAPTURE_VERSION ) {
+      close();
+      return false;
+   }
+
+   // use the index if the capture was closed properly; otherwise the
+   // records run to the end of the file
+   end = map_sz;
+   if( map_sz >= sizeof(CaptureHeader) + sizeof(CaptureFooter) ) {
+      const CaptureFooter * footer =
+         (const CaptureFooter*)(map + map_sz - sizeof(CaptureFooter));
+      if( memcmp(footer->magic, CAPTURE_INDEX_MAGIC,
+               sizeof(footer->magic)) == 0 && footer->index <= map_sz &&
+            footer->frames <= (map_sz - footer->index) / sizeof(uint64_t) ) {
+         end = footer->index;
+         frame_index = (const uint64_t*)(map + footer->index);
+         n_frames = footer->frames;
+      }
+   }
+   rewind();
+   return true;
+}
+
+void CaptureReader::close() {
+   if( map ) {
+      munmap(map, map_sz);
+   }
+   map = 0;
+   map_sz = 0;
+   header_ = 0;
+   pos = end = 0;
+   frame_index = 0;
+   n_frames = 0;
+}
+
+void CaptureReader::rewind() {
+   pos = sizeof(CaptureHeader);
+}
+
+bool CaptureReader::next(const CaptureRecord *& r, const char *& data) {
+   if( pos + sizeof(CaptureRecord) > end ) {
+      return false;
+   }
+   const CaptureRecord * rec = (const CaptureRecord*)(map + pos);
+   if( rec->len > end - pos - sizeof(CaptureRecord) ) {
+      // truncated record at the end of an unclosed capture
+      return false;
+   }
+   r = rec;
+   data = map + pos + sizeof(CaptureRecord);
+   pos += sizeof(CaptureRecord) + padded(rec->len);
+   return true;
+}
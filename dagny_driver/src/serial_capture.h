@@ -0,0 +1,119 @@
+/*
+ * Capture files of the raw serial stream from the AVR, for replaying
+ * field data through the driver without the robot.
+ *
+ * The file is a header, then one record per read() from the serial port,
+ * then an index of where each frame ended. Everything is little-endian
+ * and 8-byte aligned, so a reader can mmap the file and use the records in
+ * place:
+ *
+ *   CaptureHeader
+ *   records:     CaptureRecord, then len bytes, padded to a multiple of 8
+ *   frame index: uint64_t per frame; stream offset just past the frame,
+ *                counting only record data
+ *   CaptureFooter
+ *
+ * A capture that was never closed has no index or footer; the records are
+ * still readable up to the last complete one.
+ */
+
+#ifndef SERIAL_CAPTURE_H
+#define SERIAL_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#define CAPTURE_MAGIC "DAGNYCAP"
+#define CAPTURE_INDEX_MAGIC "DAGNYIDX"
+#define CAPTURE_VERSION 1
+
+struct CaptureHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t protocol; // serial protocol version of the stream
+   double start;      // host time the capture started
+};
+
+struct CaptureRecord {
+   double stamp;      // host time of the read
+   uint32_t len;      // bytes of data following this record
+   uint32_t reserved;
+};
+
+struct CaptureFooter {
+   uint64_t index;    // file offset of the frame index
+   uint64_t frames;   // entries in the frame index
+   uint64_t bytes;    // total record data
+   char magic[8];
+};
+
+class CaptureWriter {
+   public:
+      CaptureWriter();
+      ~CaptureWriter();
+
+      // start a new capture; false if the file can't be created
+      bool open(const std::string & file, int protocol, double now);
+
+      bool is_open() const { return f != 0; }
+
+      // receive thread: len bytes read from the port at host time now
+      void data(const char * buf, int len, double now);
+
+      // publish thread: a frame ended at the given framer position. The
+      // framer position that corresponds to the start of the capture is
+      // given to set_origin()
+      void frame(uint32_t end);
+      void set_origin(uint32_t position) { origin = position; }
+
+      // write the frame index and footer, and close the file
+      void close();
+
+   private:
+      FILE * f;
+      uint64_t bytes;
+      uint32_t origin;
+
+      // frame ends, kept in memory until the capture is closed
+      boost::mutex index_mutex;
+      std::vector<uint64_t> index;
+      uint64_t last_end;
+};
+
+class CaptureReader {
+   public:
+      CaptureReader();
+      ~CaptureReader();
+
+      // map a capture file; false if it isn't one
+      bool open(const std::string & file);
+      void close();
+
+      const CaptureHeader & header() const { return *header_; }
+
+      // the next record in the file, or false at the end
+      bool next(const CaptureRecord *& r, const char *& data);
+
+      // start over from the first record
+      void rewind();
+
+      // frame index; empty if the capture was never closed
+      uint64_t frames() const { return n_frames; }
+      uint64_t frame_end(uint64_t i) const { return frame_index[i]; }
+
+   private:
+      char * map;
+      size_t map_sz;
+      const CaptureHeader * header_;
+      size_t pos;
+      size_t end; // end of the records
+      const uint64_t * frame_index;
+      uint64_t n_frames;
+};
+
+#endif
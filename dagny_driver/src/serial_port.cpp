@@ -0,0 +1,95 @@
+/*
+ * Implementation of the serial port setup from serial_port.h
+ */
+
+#include "serial_port.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <errno.h>
+
+struct BaudRate {
+   int baud;
+   speed_t speed;
+};
+
+static const BaudRate baud_rates[] = {
+   { 9600, B9600 },
+   { 19200, B19200 },
+   { 38400, B38400 },
+   { 57600, B57600 },
+   { 115200, B115200 },
+   { 230400, B230400 },
+   { 460800, B460800 },
+   { 500000, B500000 },
+   { 921600, B921600 },
+   { 1000000, B1000000 },
+};
+
+#define NUM_BAUD_RATES (sizeof(baud_rates) / sizeof(baud_rates[0]))
+
+static bool baud_to_speed(int baud, speed_t & speed) {
+   for( unsigned int i=0; i<NUM_BAUD_RATES; i++ ) {
+      if( baud_rates[i].baud == baud ) {
+         speed = baud_rates[i].speed;
+         return true;
+      }
+   }
+   return false;
+}
+
+bool serial_baud_supported(int baud) {
+   speed_t speed;
+   return baud_to_speed(baud, speed);
+}
+
+int serial_open(const std::string & port, int baud) {
+   speed_t speed;
+   if( !baud_to_speed(baud, speed) ) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   // non-blocking, so that the transmit thread can handle a full port
+   // without stalling
+   int fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if( fd < 0 ) {
+      return -1;
+   }
+
+   struct termios tio;
+   tcgetattr(fd, &tio);
+
+   // set non-blocking input mode; we wait for data with poll()
+   tio.c_lflag = 0; // raw input
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+
+   // no input options, just normal input
+   tio.c_iflag = 0;
+
+   // set baud rate
+   cfsetospeed(&tio, speed);
+   cfsetispeed(&tio, speed);
+
+   tcsetattr(fd, TCSANOW, &tio);
+   return fd;
+}
+
+bool serial_set_baud(int fd, int baud) {
+   speed_t speed;
+   if( !baud_to_speed(baud, speed) ) {
+      return false;
+   }
+   struct termios tio;
+   if( tcgetattr(fd, &tio) < 0 ) {
+      return false;
+   }
+   cfsetospeed(&tio, speed);
+   cfsetispeed(&tio, speed);
+   // TCSADRAIN: let anything we've already written go out at the old rate
+   return tcsetattr(fd, TCSADRAIN, &tio) == 0;
+}
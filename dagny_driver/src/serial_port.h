@@ -0,0 +1,21 @@
+/*
+ * Serial port setup for the link to the AVR.
+ */
+
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <string>
+
+// open port in raw, non-blocking mode at baud. Returns the file descriptor,
+// or -1 on failure with errno set
+int serial_open(const std::string & port, int baud);
+
+// change the baud rate of an open port, after any pending output has been
+// sent. Returns false if the rate isn't supported
+bool serial_set_baud(int fd, int baud);
+
+// true if we know how to set this baud rate
+bool serial_baud_supported(int baud);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Implementation of the sonar sweep aggregator from sonar_sweep.h
+ */
+
+#include "sonar_sweep.h"
+
+#include <math.h>
+#include <string.h>
+
+SonarSweep::SonarSweep() : n_(0), min_range_(0.0f), max_range_(0.0f),
+   timeout_(0.5), fresh_(0), swept_(0), start_(0.0), sweeps_(0),
+   timeouts_(0) {
+   memset(range_, 0, sizeof(range_));
+   memset(stamp_, 0, sizeof(stamp_));
+}
+
+void SonarSweep::configure(int n, const SonarMount * mounts,
+      float min_range, float max_range, double timeout) {
+   n_ = n < SONAR_MAX ? n : SONAR_MAX;
+   min_range_ = min_range;
+   max_range_ = max_range;
+   timeout_ = timeout;
+   for( int i=0; i<n_; i++ ) {
+      x_[i] = mounts[i].x;
+      y_[i] = mounts[i].y;
+      z_[i] = mounts[i].z;
+      cos_[i] = cosf(mounts[i].yaw);
+      sin_[i] = sinf(mounts[i].yaw);
+   }
+   fresh_ = 0;
+   swept_ = 0;
+}
+
+bool SonarSweep::update(int index, float range, double t) {
+   if( index < 0 || index >= n_ ) {
+      return false;
+   }
+   if( fresh_ == 0 ) {
+      start_ = t;
+   }
+   range_[index] = range;
+   stamp_[index] = t;
+   fresh_ |= 1u << index;
+
+   uint32_t all = (1u << n_) - 1;
+   if( fresh_ != all ) {
+      if( t - start_ < timeout_ ) {
+         return false;
+      }
+      ++timeouts_;
+   }
+   swept_ = fresh_;
+   fresh_ = 0;
+   ++sweeps_;
+   return true;
+}
+
+int SonarSweep::points(float * xyz) const {
+   int n = 0;
+   for( int i=0; i<n_; i++ ) {
+      float r = range_[i];
+      if( !(swept_ & (1u << i)) || r < min_range_ || r >= max_range_ ) {
+         continue;
+      }
+      xyz[0] = x_[i] + r * cos_[i];
+      xyz[1] = y_[i] + r * sin_[i];
+      xyz[2] = z_[i];
+      xyz += 3;
+      ++n;
+   }
+   return n;
+}
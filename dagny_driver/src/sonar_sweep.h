@@ -0,0 +1,88 @@
+/*
+ * Aggregates the readings from a ring of sonars into one sweep, so that
+ * consumers get a single consistent update instead of one message per
+ * sonar.
+ *
+ * The AVR fires the sonars one at a time, in turn. The latest reading from
+ * each is kept in a fixed array, and a sweep is complete once every sonar
+ * has reported since the last one. A sonar that stops reporting doesn't
+ * hold the others up: after the timeout, the sweep goes out with whatever
+ * it has, and the silent sonar is left out.
+ *
+ * Each sonar's mounting is turned into a unit bearing once, in
+ * configure(), so that a reading becomes a point in the robot frame with
+ * a multiply and an add.
+ *
+ * Not thread-safe.
+ */
+
+#ifndef SONAR_SWEEP_H
+#define SONAR_SWEEP_H
+
+#include <stdint.h>
+
+#define SONAR_MAX 8
+
+// where a sonar sits on the robot, and which way it points
+struct SonarMount {
+   float x, y, z;
+   float yaw;
+};
+
+class SonarSweep {
+   public:
+      SonarSweep();
+
+      // n: number of sonars, up to SONAR_MAX
+      // min_range, max_range: readings outside these, in meters, are
+      //    nothing in range and aren't turned into points
+      // timeout: longest a sweep waits for the slowest sonar, in seconds
+      void configure(int n, const SonarMount * mounts, float min_range,
+            float max_range, double timeout);
+
+      // a reading of range meters from sonar index at time t. Returns true
+      // if this completes a sweep; the sweep is then taken as done, and
+      // the next reading starts a new one
+      bool update(int index, float range, double t);
+
+      int n_sonars() const { return n_; }
+      unsigned long sweeps() const { return sweeps_; }
+      unsigned long timeouts() const { return timeouts_; }
+      // whether every sonar was in the last sweep
+      bool complete() const { return swept_ == (1u << n_) - 1; }
+
+      // latest reading from each sonar, and when it arrived
+      const float * ranges() const { return range_; }
+      const double * stamps() const { return stamp_; }
+
+      // the readings in the last sweep that hit something, as x, y, z
+      // points in the robot frame; xyz must have room for 3 * n_sonars()
+      // floats. Returns the number of points
+      int points(float * xyz) const;
+
+   private:
+      int n_;
+      float min_range_;
+      float max_range_;
+      double timeout_;
+
+      // mounting, with the bearing as a unit vector
+      float x_[SONAR_MAX];
+      float y_[SONAR_MAX];
+      float z_[SONAR_MAX];
+      float cos_[SONAR_MAX];
+      float sin_[SONAR_MAX];
+
+      float range_[SONAR_MAX];
+      double stamp_[SONAR_MAX];
+
+      // sonars heard from in the sweep in progress, and in the last one
+      uint32_t fresh_;
+      uint32_t swept_;
+      double start_;
+
+      unsigned long sweeps_;
+      unsigned long timeouts_;
+};
+
+#endif
@@ -3,49 +3,102 @@
  * to turning radius and back
  */
 
-#include "steer.h"
-
-#include <math.h>
+#include "dagny_driver/steer.h"
 
 
 // TODO: measure an appropriate value for radius[0]
 
 // radius table for steering settings in increments of 10
-// steer:              0     10,    20,    30,    40,    50,    60,    70,
-float radius[] = { 100.0, 5.550, 3.875, 2.900, 1.960, 1.560, 1.290, 1.025,
-//    80,    90,   100
-   0.905, 0.790, 0.695 };
+// steer:                                0     10,    20,    30,    40,
+static const float default_radius[] = { 100.0, 5.550, 3.875, 2.900, 1.960,
+//    50,    60,    70,    80,    90,   100
+   1.560, 1.290, 1.025, 0.905, 0.790, 0.695 };
+
+// largest steering setting we convert to; anything above is clamped
+#define STEER_MAX 127
+
+// resolution of the inverse table; bins are evenly spaced in curvature
+// (1/radius) from straight ahead to the curvature at STEER_MAX
+#define CURVATURE_BINS 2048
+
+// smallest radius we'll extrapolate to
+#define RADIUS_MIN 0.01
+
+// turning radius for each steering setting, indexed by |s|. One extra entry
+// so that |-128| is still in range
+static float radius_table[STEER_MAX + 2];
+
+// steering setting for each curvature bin
+static int8_t steer_table[CURVATURE_BINS];
+
+// curvature bins per 1/m
+static float curvature_scale;
 
 int8_t radius2steer(float r) {
    r = r<0?-r:r; // abs(r)
-   int8_t i = 1;
-   // find where this radius falls in our table
-   for( i=1; i<11 && r<radius[i]; ++i );
-   // radius[i-1] > r > radius[i]
-   float base = radius[i];
-   float inc = (radius[i-1] - base) / 10.0;
-   float diff = r - base; // diff may be negative if i==10
-   int8_t s = i*10 - round(diff / inc);
-   return s;
+   // bin = curvature * scale; written this way so that r == 0 lands past
+   // the end of the table instead of dividing by zero
+   float bin = curvature_scale / r;
+   if( !(bin < CURVATURE_BINS - 1) ) {
+      return steer_table[CURVATURE_BINS - 1];
+   }
+   return steer_table[(int)(bin + 0.5)];
 }
 
 float steer2radius(int8_t s) {
-   s = s<0?-s:s; // abs(s)
-   int8_t i = s / 10;
-   if( i > 10 ) i = 10;
-   float base = radius[i];
-   // if we aren't at a measured value, estimate
-   if( s - i*10 != 0 ) {
-      int8_t diff = s - i*10;
-      float inc;
-      // if we're within our measured curve, interpolate
-      if( i < 10 ) {
-         inc = (base - radius[i+1]) / 10.0;
+   int i = s<0?-s:s; // abs(s)
+   return radius_table[i];
+}
+
+bool steer_calibrate(const float * radii, int n, int step) {
+   if( n < 2 || step < 1 ) return false;
+   for( int i=0; i<n; ++i ) {
+      if( !(radii[i] > 0) ) return false;
+      if( i > 0 && !(radii[i] < radii[i-1]) ) return false;
+   }
+
+   // forward table: interpolate between measured points, and extrapolate
+   // from the top two points past the end of the measured curve
+   for( int s=0; s<STEER_MAX + 2; ++s ) {
+      int i = s / step;
+      if( i > n - 1 ) i = n - 1;
+      float base = radii[i];
+      int diff = s - i*step;
+      if( diff != 0 ) {
+         float inc;
+         if( i < n - 1 ) {
+            inc = (base - radii[i+1]) / step;
+         } else {
+            inc = (radii[i-1] - base) / step;
+         }
+         base -= inc * diff;
+      }
+      if( base < RADIUS_MIN ) base = RADIUS_MIN;
+      radius_table[s] = base;
+   }
+
+   // inverse table: for the radius at the center of each curvature bin,
+   // find the nearest steering setting by interpolating in the forward
+   // table. Radii decrease as the bins increase, so a single pass over the
+   // forward table covers every bin
+   curvature_scale = (CURVATURE_BINS - 1) * radius_table[STEER_MAX];
+   int s = 0;
+   steer_table[0] = 0;
+   for( int bin=1; bin<CURVATURE_BINS; ++bin ) {
+      float r = curvature_scale / bin;
+      while( s < STEER_MAX && radius_table[s+1] >= r ) ++s;
+      if( s == STEER_MAX || r >= radius_table[0] ) {
+         steer_table[bin] = s;
       } else {
-         // if we're above our measured curve, extrapolate from top two points
-         inc = (radius[i-1] - base) / 10.0;
+         float frac = (radius_table[s] - r) /
+            (radius_table[s] - radius_table[s+1]);
+         steer_table[bin] = s + (frac < 0.5 ? 0 : 1);
       }
-      base -= inc * diff;
    }
-   return base;
+   return true;
 }
+
+// build the tables from the compiled-in calibration before main(), so that
+// the conversions work even if steer_calibrate() is never called
+static bool default_calibration = steer_calibrate(default_radius,
+      sizeof(default_radius) / sizeof(default_radius[0]), 10);
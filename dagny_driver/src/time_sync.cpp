@@ -0,0 +1,148 @@
+/*
+ * Implementation of the AVR clock estimator from time_sync.h
+ */
+
+#include "time_sync.h"
+
+#include <math.h>
+
+TimeSync::TimeSync(double tick_hz) : tick_period(1.0 / tick_hz), sent(0.0),
+   last_rtt(0.0), have_tick(false), last_tick(0), count(0), next(0),
+   valid(false), base_tick(0), base_host(0.0), rate(1.0), residual_(0.0) {
+}
+
+void TimeSync::set_tick_rate(double tick_hz) {
+   boost::mutex::scoped_lock lock(mutex);
+   tick_period = 1.0 / tick_hz;
+   count = 0;
+   next = 0;
+   valid = false;
+}
+
+void TimeSync::heartbeat_sent(double t) {
+   boost::mutex::scoped_lock lock(mutex);
+   sent = t;
+}
+
+int64_t TimeSync::unwrap(uint32_t tick) {
+   // ticks close to the last one we've seen, in either direction, belong
+   // to the same epoch of the 32-bit counter
+   if( !have_tick ) {
+      have_tick = true;
+      last_tick = tick;
+      return last_tick;
+   }
+   int32_t diff = (int32_t)(tick - (uint32_t)last_tick);
+   int64_t t = last_tick + diff;
+   if( diff > 0 ) {
+      last_tick = t;
+   }
+   return t;
+}
+
+void TimeSync::heartbeat_reply(uint32_t tick, double t) {
+   boost::mutex::scoped_lock lock(mutex);
+   if( sent == 0.0 ) {
+      // a reply we weren't expecting; maybe the AVR reset
+      return;
+   }
+   double rtt = t - sent;
+   sent = 0.0;
+   if( rtt < 0.0 ) {
+      return;
+   }
+   last_rtt = rtt;
+
+   // round trips much slower than the best recent one were probably
+   // delayed on one leg only, and make the midpoint assumption wrong
+   double min_rtt = rtt;
+   for( int i=0; i<count; i++ ) {
+      if( rtts[i] < min_rtt ) min_rtt = rtts[i];
+   }
+   if( count >= TIME_SYNC_MIN_SAMPLES && rtt > 2.0 * min_rtt + 0.002 ) {
+      return;
+   }
+
+   ticks[next] = unwrap(tick);
+   hosts[next] = t - rtt / 2.0;
+   rtts[next] = rtt;
+   next = (next + 1) % TIME_SYNC_WINDOW;
+   if( count < TIME_SYNC_WINDOW ) ++count;
+
+   fit();
+}
+
+void TimeSync::fit() {
+   if( count < TIME_SYNC_MIN_SAMPLES ) {
+      valid = false;
+      return;
+   }
+   // center everything on the newest sample to keep the sums small
+   int newest = (next + TIME_SYNC_WINDOW - 1) % TIME_SYNC_WINDOW;
+   int64_t t0 = ticks[newest];
+   double h0 = hosts[newest];
+
+   double sx = 0, sy = 0, sxx = 0, sxy = 0;
+   for( int i=0; i<count; i++ ) {
+      double x = (ticks[i] - t0) * tick_period;
+      double y = hosts[i] - h0;
+      sx += x;
+      sy += y;
+      sxx += x*x;
+      sxy += x*y;
+   }
+   double n = count;
+   double d = n*sxx - sx*sx;
+   double b = 1.0;
+   if( fabs(d) > 1e-12 ) {
+      b = (n*sxy - sx*sy) / d;
+   }
+   // a sane crystal is within a few hundred ppm; anything else means the
+   // window is still mostly noise
+   if( fabs(b - 1.0) > 0.01 ) {
+      b = 1.0;
+   }
+   double a = (sy - b*sx) / n;
+
+   double r = 0;
+   for( int i=0; i<count; i++ ) {
+      double x = (ticks[i] - t0) * tick_period;
+      double e = (hosts[i] - h0) - (a + b*x);
+      r += e*e;
+   }
+
+   base_tick = t0;
+   base_host = h0 + a;
+   rate = b;
+   residual_ = sqrt(r / n);
+   valid = true;
+}
+
+double TimeSync::to_host(uint32_t tick, double fallback) {
+   boost::mutex::scoped_lock lock(mutex);
+   if( !valid ) {
+      return fallback;
+   }
+   int64_t t = unwrap(tick);
+   double h = base_host + rate * (t - base_tick) * tick_period;
+   // the data can't have been acquired after we received it
+   if( h > fallback ) {
+      h = fallback;
+   }
+   return h;
+}
+
+bool TimeSync::synced() {
+   boost::mutex::scoped_lock lock(mutex);
+   return valid;
+}
+
+void TimeSync::status(double & offset, double & drift_ppm, double & rtt,
+      double & residual, int & samples) {
+   boost::mutex::scoped_lock lock(mutex);
+   offset = base_host - base_tick * tick_period;
+   drift_ppm = (rate - 1.0) * 1e6;
+   rtt = last_rtt;
+   residual = residual_;
+   samples = count;
+}
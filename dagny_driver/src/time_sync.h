@@ -0,0 +1,82 @@
+/*
+ * Clock synchronization between the AVR and the host.
+ *
+ * The AVR stamps its sensor packets with a free-running tick counter, and
+ * answers each heartbeat with the tick count when it received it. Each
+ * heartbeat round trip gives us one (tick, host time) pair, assuming the
+ * AVR saw the heartbeat halfway through the round trip. A least-squares
+ * line through the most recent pairs gives the clock offset and drift,
+ * which we use to turn packet ticks back into the host time when the data
+ * was actually acquired.
+ *
+ * All times are in seconds. Thread-safe.
+ */
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+
+// number of round trips in the regression window
+#define TIME_SYNC_WINDOW 32
+// round trips needed before we trust the estimate
+#define TIME_SYNC_MIN_SAMPLES 4
+
+class TimeSync {
+   public:
+      // tick_hz: rate of the AVR tick counter
+      TimeSync(double tick_hz = 1000.0);
+
+      void set_tick_rate(double tick_hz);
+
+      // a heartbeat was sent at host time t
+      void heartbeat_sent(double t);
+
+      // the AVR answered the last heartbeat with tick; we got the answer at
+      // host time t
+      void heartbeat_reply(uint32_t tick, double t);
+
+      // host time at which the AVR read tick, or fallback if we aren't
+      // synchronized yet. Never later than fallback, which should be the
+      // time that the packet was received
+      double to_host(uint32_t tick, double fallback);
+
+      bool synced();
+
+      // current estimate, for diagnostics
+      void status(double & offset, double & drift_ppm, double & rtt,
+            double & residual, int & samples);
+
+   private:
+      int64_t unwrap(uint32_t tick);
+      void fit();
+
+      boost::mutex mutex;
+
+      double tick_period;
+
+      double sent;  // host time of the outstanding heartbeat, or 0
+      double last_rtt;
+
+      // unwrapped 64-bit tick count
+      bool have_tick;
+      int64_t last_tick;
+
+      // regression window
+      int64_t ticks[TIME_SYNC_WINDOW];
+      double hosts[TIME_SYNC_WINDOW];
+      double rtts[TIME_SYNC_WINDOW];
+      int count;
+      int next;
+
+      // fitted line: host = base_host + rate * (tick - base_tick) seconds
+      bool valid;
+      int64_t base_tick;
+      double base_host;
+      double rate;
+      double residual_;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Implementation of the rate-policed publisher from topic_publisher.h
+ */
+
+#include "topic_publisher.h"
+
+TopicPublisher::TopicPublisher() : n_outputs(1) {
+   for( int i=0; i<2; i++ ) {
+      outputs[i].policy = FULL;
+      outputs[i].decimate = 1;
+      outputs[i].count = 0;
+      outputs[i].period = 0.0;
+      outputs[i].take = false;
+   }
+}
+
+void TopicPublisher::configure(ros::NodeHandle & n,
+      const std::string & topic) {
+   std::string prefix = "publish/" + topic + "/";
+   std::string policy;
+   n.param<std::string>(prefix + "policy", policy, "full");
+   int decimate;
+   n.param(prefix + "decimate", decimate, 1);
+   double rate;
+   n.param(prefix + "rate", rate, 0.0);
+   double throttle_rate;
+   n.param(prefix + "throttle_rate", throttle_rate, 0.0);
+
+   Output & out = outputs[0];
+   out.policy = FULL;
+   if( policy == "decimate" ) {
+      if( decimate > 1 ) {
+         out.policy = DECIMATE;
+         out.decimate = decimate;
+      } else {
+         ROS_WARN("%s: decimate must be more than 1; publishing full rate",
+               topic.c_str());
+      }
+   } else if( policy == "rate" ) {
+      if( rate > 0.0 ) {
+         out.policy = RATE;
+         out.period = 1.0 / rate;
+      } else {
+         ROS_WARN("%s: rate must be positive; publishing full rate",
+               topic.c_str());
+      }
+   } else if( policy != "full" ) {
+      ROS_WARN("%s: unknown publish policy %s; publishing full rate",
+            topic.c_str(), policy.c_str());
+   }
+
+   n_outputs = 1;
+   if( throttle_rate > 0.0 ) {
+      outputs[1].policy = RATE;
+      outputs[1].period = 1.0 / throttle_rate;
+      n_outputs = 2;
+   }
+
+   for( int i=0; i<n_outputs; i++ ) {
+      outputs[i].count = 0;
+      outputs[i].last = ros::Time();
+      outputs[i].take = false;
+   }
+}
+
+bool TopicPublisher::wanted(const ros::Time & t) {
+   bool any = false;
+   for( int i=0; i<n_outputs; i++ ) {
+      Output & out = outputs[i];
+      out.take = false;
+      switch( out.policy ) {
+         case FULL:
+            out.take = true;
+            break;
+         case DECIMATE:
+            if( ++out.count >= out.decimate ) {
+               out.count = 0;
+               out.take = true;
+            }
+            break;
+         case RATE:
+            // the first message after a period has passed is the newest
+            // one we have
+            if( out.last.isZero() || (t - out.last).toSec() >= out.period ||
+                  t < out.last ) {
+               out.take = true;
+            }
+            break;
+      }
+      if( out.take && out.pub.getNumSubscribers() == 0 ) {
+         out.take = false;
+      }
+      if( out.take ) {
+         if( out.policy == RATE ) {
+            out.last = t;
+         }
+         any = true;
+      }
+   }
+   return any;
+}
+
+bool TopicPublisher::subscribed() const {
+   for( int i=0; i<n_outputs; i++ ) {
+      if( outputs[i].pub.getNumSubscribers() > 0 ) {
+         return true;
+      }
+   }
+   return false;
+}
+
+void TopicPublisher::shutdown() {
+   for( int i=0; i<n_outputs; i++ ) {
+      outputs[i].pub.shutdown();
+   }
+}
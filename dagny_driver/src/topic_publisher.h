@@ -0,0 +1,79 @@
+/*
+ * A publisher with a per-topic rate policy.
+ *
+ * The policy for a topic comes from parameters under publish/<topic>:
+ *   policy          full (default), decimate or rate
+ *   decimate        publish every Nth message (policy decimate)
+ *   rate            publish at most this many messages per second, always
+ *                   the newest available (policy rate)
+ *   throttle_rate   if set, also advertise <topic>_throttled, limited to
+ *                   this rate, so that remote subscribers can take a
+ *                   slower stream while local ones get the full one
+ *
+ * Handlers ask wanted() before building a message, and skip building it
+ * entirely when no output would take it, including when nobody is
+ * subscribed. The answer from wanted() applies to the next publish().
+ *
+ * Not thread-safe; each topic is only published from the publish thread.
+ */
+
+#ifndef TOPIC_PUBLISHER_H
+#define TOPIC_PUBLISHER_H
+
+#include <string>
+
+#include <ros/ros.h>
+
+class TopicPublisher {
+   public:
+      TopicPublisher();
+
+      template<class M>
+      void advertise(ros::NodeHandle & n, const std::string & topic,
+            int queue) {
+         configure(n, topic);
+         outputs[0].pub = n.advertise<M>(topic, queue);
+         if( n_outputs > 1 ) {
+            outputs[1].pub = n.advertise<M>(topic + "_throttled", queue);
+         }
+      }
+
+      // will a message at time t go anywhere? Advances the decimation and
+      // rate state, so call it exactly once per message
+      bool wanted(const ros::Time & t);
+
+      // does any output have subscribers? Doesn't change any state
+      bool subscribed() const;
+
+      // publish to the outputs that wanted the last message
+      template<class M>
+      void publish(const M & msg) {
+         for( int i=0; i<n_outputs; i++ ) {
+            if( outputs[i].take ) {
+               outputs[i].pub.publish(msg);
+            }
+         }
+      }
+
+      void shutdown();
+
+   private:
+      enum Policy { FULL, DECIMATE, RATE };
+
+      struct Output {
+         ros::Publisher pub;
+         Policy policy;
+         int decimate;
+         int count;
+         double period;
+         ros::Time last;
+         bool take;
+      };
+
+      void configure(ros::NodeHandle & n, const std::string & topic);
+
+      Output outputs[2];
+      int n_outputs;
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Implementation of the outbound packet scheduler from tx_queue.h
+ */
+
+#include "tx_queue.h"
+
+#include <string.h>
+#include <time.h>
+
+TxQueue::TxQueue() : total(0) {
+   for( int c=0; c<TX_CLASSES; c++ ) {
+      queues[c].head = 0;
+      queues[c].count = 0;
+      queues[c].limit = TX_SLOTS;
+      queues[c].dropped = 0;
+   }
+   // urgent traffic only ever has one packet of each type queued
+   queues[TX_URGENT].limit = 4;
+}
+
+double TxQueue::now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+bool TxQueue::push(TxClass c, char type, const char * buf, int sz) {
+   if( sz > TX_FRAME_MAX || sz < 1 ) {
+      return false;
+   }
+   {
+      boost::mutex::scoped_lock lock(mutex);
+      Queue & q = queues[c];
+      Slot * s = 0;
+      if( c == TX_URGENT ) {
+         // replace an older packet of the same type. It keeps its place in
+         // line, but takes the newer data
+         for( int i=0; i<q.count; i++ ) {
+            Slot & o = q.slots[(q.head + i) % TX_SLOTS];
+            if( o.type == type ) {
+               s = &o;
+               break;
+            }
+         }
+      }
+      if( !s ) {
+         if( q.count >= q.limit ) {
+            ++q.dropped;
+            return false;
+         }
+         s = &q.slots[(q.head + q.count) % TX_SLOTS];
+         s->type = type;
+         s->queued = now();
+         ++q.count;
+         ++total;
+      }
+      memcpy(s->data, buf, sz);
+      s->sz = sz;
+   }
+   cond.notify_one();
+   return true;
+}
+
+int TxQueue::drain(char * buf, int max,
+      const boost::posix_time::time_duration & timeout, char mark,
+      bool * marked) {
+   boost::mutex::scoped_lock lock(mutex);
+   if( marked ) {
+      *marked = false;
+   }
+   if( total == 0 ) {
+      cond.timed_wait(lock, timeout);
+      if( total == 0 ) {
+         return 0;
+      }
+   }
+   double t = now();
+   int sz = 0;
+   for( int c=0; c<TX_CLASSES; c++ ) {
+      Queue & q = queues[c];
+      while( q.count > 0 && sz + q.slots[q.head].sz <= max ) {
+         Slot & s = q.slots[q.head];
+         memcpy(buf + sz, s.data, s.sz);
+         sz += s.sz;
+         if( marked && s.type == mark ) {
+            *marked = true;
+         }
+         q.latency.record(t - s.queued);
+         q.head = (q.head + 1) % TX_SLOTS;
+         --q.count;
+         --total;
+      }
+   }
+   return sz;
+}
+
+int TxQueue::depth(TxClass c) {
+   boost::mutex::scoped_lock lock(mutex);
+   return queues[c].count;
+}
+
+unsigned long TxQueue::dropped(TxClass c) {
+   boost::mutex::scoped_lock lock(mutex);
+   return queues[c].dropped;
+}
+
+LatencyHistogram TxQueue::latency(TxClass c) {
+   boost::mutex::scoped_lock lock(mutex);
+   return queues[c].latency;
+}
@@ -0,0 +1,84 @@
+/*
+ * Outbound packet scheduler. Filled by the ROS callbacks and drained by the
+ * serial transmit thread, which is the only thread that writes to the port.
+ *
+ * Each class of traffic has its own bounded queue, and classes are sent in
+ * strict priority order, so a drive command never waits behind a goal
+ * update or laser summary that hasn't been written yet. Urgent packets only
+ * keep the newest packet of each type; there's no point sending a stale
+ * drive command after a new one.
+ */
+
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "latency_histogram.h"
+
+// big enough for the largest packet, a laser summary with every byte
+// escaped
+#define TX_FRAME_MAX 288
+// most packets waiting in any one class
+#define TX_SLOTS 16
+
+enum TxClass {
+   TX_URGENT = 0, // drive commands and heartbeats
+   TX_CONTROL,    // goal updates, laser summaries, calibration,
+                  // configuration
+   TX_CLASSES
+};
+
+class TxQueue {
+   public:
+      TxQueue();
+
+      // copy a finished packet of type into the queue for class c. The
+      // type is passed separately because the frame doesn't start with it
+      // in every protocol version. Returns false if the packet is too big
+      // or the queue is full
+      bool push(TxClass c, char type, const char * buf, int sz);
+
+      // wait up to timeout for packets, then copy as many whole packets as
+      // will fit into buf, highest priority first, so that they can go out
+      // in a single write. Returns the number of bytes copied, or 0 if nothing was ready. If
+      // marked is given, it's set to whether a packet of type mark was
+      // among them
+      int drain(char * buf, int max,
+            const boost::posix_time::time_duration & timeout,
+            char mark = 0, bool * marked = 0);
+
+      // statistics, for diagnostics
+      int depth(TxClass c);
+      unsigned long dropped(TxClass c);
+      LatencyHistogram latency(TxClass c);
+
+   private:
+      struct Slot {
+         int sz;
+         char type;
+         double queued; // time that the packet was queued
+         char data[TX_FRAME_MAX];
+      };
+
+      struct Queue {
+         Slot slots[TX_SLOTS];
+         int head;
+         int count;
+         int limit;
+         unsigned long dropped;
+         LatencyHistogram latency;
+      };
+
+      static double now();
+
+      Queue queues[TX_CLASSES];
+      int total;
+
+      boost::mutex mutex;
+      boost::condition_variable cond;
+};
+
+#endif
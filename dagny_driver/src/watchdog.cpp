@@ -0,0 +1,197 @@
+/*
+ * Implementation of the drive command watchdog from watchdog.h
+ */
+
+#include "watchdog.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <ros/ros.h>
+
+#include <boost/bind.hpp>
+
+#include "dagny_link.h"
+
+// how often the watchdog checks, as a fraction of the timeout, and the
+// limits on that
+#define WATCHDOG_CHECKS 4
+#define WATCHDOG_PERIOD_MIN 1000000LL   // 1 ms
+#define WATCHDOG_PERIOD_MAX 100000000LL // 100 ms
+
+static int64_t monotonic_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+CommandWatchdog::CommandWatchdog() : link_(0), stop_sz_(0),
+   timeout_ns_(1000000000LL), priority_(0), timer_(-1), last_feed_(0),
+   last_stop_(0), stale_(false), latched_(false), held_(false),
+   timeouts_(0), trips_(0), stops_(0),
+   realtime_(false), running_(false) {
+}
+
+CommandWatchdog::~CommandWatchdog() {
+   stop();
+}
+
+bool CommandWatchdog::start(DagnyLink & link, const char * stop, int sz,
+      double timeout, int priority) {
+   if( running_ ) {
+      return false;
+   }
+   if( sz > WATCHDOG_PACKET_MAX || timeout <= 0.0 ) {
+      ROS_ERROR("Bad watchdog stop packet or timeout");
+      return false;
+   }
+   link_ = &link;
+   memcpy(stop_, stop, sz);
+   stop_sz_ = sz;
+   timeout_ns_ = (int64_t)(timeout * 1e9);
+   priority_ = priority;
+
+   int64_t period = timeout_ns_ / WATCHDOG_CHECKS;
+   if( period < WATCHDOG_PERIOD_MIN ) {
+      period = WATCHDOG_PERIOD_MIN;
+   }
+   if( period > WATCHDOG_PERIOD_MAX ) {
+      period = WATCHDOG_PERIOD_MAX;
+   }
+   timer_ = timerfd_create(CLOCK_MONOTONIC, 0);
+   if( timer_ < 0 ) {
+      ROS_ERROR("Failed to create watchdog timer: %s", strerror(errno));
+      return false;
+   }
+   struct itimerspec spec;
+   spec.it_interval.tv_sec = period / 1000000000LL;
+   spec.it_interval.tv_nsec = period % 1000000000LL;
+   spec.it_value = spec.it_interval;
+   if( timerfd_settime(timer_, 0, &spec, 0) < 0 ) {
+      ROS_ERROR("Failed to start watchdog timer: %s", strerror(errno));
+      close(timer_);
+      timer_ = -1;
+      return false;
+   }
+
+   // the first stop goes out one timeout from now, if nothing is sent
+   int64_t now = monotonic_ns();
+   last_feed_ = now;
+   last_stop_ = now - timeout_ns_;
+   stale_ = false;
+   latched_ = false;
+   held_ = false;
+
+   running_ = true;
+   thread_ = boost::thread(boost::bind(&CommandWatchdog::run, this));
+
+   realtime_ = false;
+   if( priority_ > 0 ) {
+      struct sched_param sp;
+      memset(&sp, 0, sizeof(sp));
+      sp.sched_priority = priority_;
+      int r = pthread_setschedparam(thread_.native_handle(), SCHED_FIFO,
+            &sp);
+      if( r == 0 ) {
+         realtime_ = true;
+      } else {
+         ROS_WARN("Watchdog can't run at real-time priority %d: %s",
+               priority_, strerror(r));
+      }
+   }
+   return true;
+}
+
+void CommandWatchdog::stop() {
+   if( !running_ ) {
+      return;
+   }
+   running_ = false;
+   thread_.join();
+   close(timer_);
+   timer_ = -1;
+}
+
+bool CommandWatchdog::allow(bool stop) {
+   if( !latched_ ) {
+      return true;
+   }
+   if( !stop ) {
+      return false;
+   }
+   latched_ = false;
+   // hold() sets held_ before it trips, so a hold that came in since the
+   // check above is either seen here or sets the latch again after this
+   if( held_ ) {
+      latched_ = true;
+   }
+   return true;
+}
+
+void CommandWatchdog::feed() {
+   last_feed_ = monotonic_ns();
+   if( !latched_ ) {
+      stale_ = false;
+   }
+}
+
+void CommandWatchdog::trip() {
+   if( !running_ ) {
+      return;
+   }
+   int64_t now = monotonic_ns();
+   // anything sent before now is stale; keep stopping until a stop command
+   last_feed_ = now - timeout_ns_;
+   latched_ = true;
+   stale_ = true;
+   ++trips_;
+   send_stop(now);
+}
+
+void CommandWatchdog::hold(bool held) {
+   if( !held ) {
+      held_ = false;
+   } else if( !held_.exchange(true) ) {
+      trip();
+   }
+}
+
+double CommandWatchdog::since_feed() const {
+   return (monotonic_ns() - last_feed_) * 1e-9;
+}
+
+void CommandWatchdog::send_stop(int64_t now) {
+   last_stop_ = now;
+   if( link_->write(TX_URGENT, stop_, stop_sz_) ) {
+      ++stops_;
+   }
+}
+
+// watchdog thread: no ROS calls, no allocation; just the clock and the
+// transmit queue
+void CommandWatchdog::run() {
+   while( running_ ) {
+      uint64_t expirations;
+      if( read(timer_, &expirations, sizeof(expirations)) < 0 ) {
+         if( errno != EINTR ) {
+            break;
+         }
+         continue;
+      }
+      int64_t now = monotonic_ns();
+      if( !latched_ && now - last_feed_ < timeout_ns_ ) {
+         continue;
+      }
+      if( !stale_.exchange(true) ) {
+         ++timeouts_;
+      }
+      if( now - last_stop_ >= timeout_ns_ ) {
+         send_stop(now);
+      }
+   }
+}
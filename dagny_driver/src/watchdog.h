@@ -0,0 +1,106 @@
+/*
+ * Drive command watchdog: stops the robot when the command stream goes
+ * stale, without depending on the ROS callback queue.
+ *
+ * The watchdog runs on its own thread, woken by a timerfd several times
+ * per timeout, and at real-time priority if the process is allowed to.
+ * Its stop packet is framed once, when it starts, so the thread only
+ * checks a timestamp and queues the packet. Stops go out as urgent
+ * packets, so they replace any drive command still waiting for the
+ * transmit thread, and go out ahead of everything else.
+ *
+ * A trip, from the bump switch or any other safety input, latches: the
+ * robot is kept stopped until a stop command comes through allow(), so
+ * that it doesn't drive off again on whatever was last being sent. A
+ * hold keeps it latched for as long as the input is asserted.
+ *
+ * feed(), allow(), trip() and hold() may be called from any thread.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+class DagnyLink;
+
+// largest framed stop packet
+#define WATCHDOG_PACKET_MAX 32
+
+class CommandWatchdog {
+   public:
+      CommandWatchdog();
+      ~CommandWatchdog();
+
+      // start watching: stop is the framed packet to send to link when no
+      // command has been fed for timeout seconds. The stop is repeated
+      // every timeout until the next command. priority is the SCHED_FIFO
+      // priority for the thread, or 0 for the normal scheduler
+      bool start(DagnyLink & link, const char * stop, int sz,
+            double timeout, int priority);
+      void stop();
+
+      // whether a drive command may go out. After a trip, only stop
+      // commands (stop true) may, and the first one once the hold is
+      // released clears the latch
+      bool allow(bool stop);
+
+      // a drive command just went out
+      void feed();
+
+      // stop now, from a safety input, and stay stopped until allow()
+      // clears the latch
+      void trip();
+
+      // the state of a safety input, such as the bump switch; trips when
+      // it's asserted, and keeps the latch set until it's released
+      void hold(bool held);
+
+      // for diagnostics
+      unsigned long timeouts() const { return timeouts_; }
+      unsigned long trips() const { return trips_; }
+      unsigned long stops() const { return stops_; }
+      // whether the robot is being held stopped
+      bool stopped() const { return stale_; }
+      // whether a trip is keeping it stopped, and whether the safety
+      // input is still asserted
+      bool latched() const { return latched_; }
+      bool held() const { return held_; }
+      // whether the thread got real-time priority
+      bool realtime() const { return realtime_; }
+      double timeout() const { return timeout_ns_ * 1e-9; }
+      // seconds since the last command, or since the watchdog started
+      double since_feed() const;
+
+   private:
+      void run();
+      void send_stop(int64_t now);
+
+      DagnyLink * link_;
+      char stop_[WATCHDOG_PACKET_MAX];
+      int stop_sz_;
+      int64_t timeout_ns_;
+      int priority_;
+      int timer_;
+
+      // CLOCK_MONOTONIC nanoseconds of the last command, and of the last
+      // stop the watchdog sent
+      boost::atomic<int64_t> last_feed_;
+      boost::atomic<int64_t> last_stop_;
+      boost::atomic<bool> stale_;
+      boost::atomic<bool> latched_;
+      boost::atomic<bool> held_;
+
+      boost::atomic<unsigned long> timeouts_;
+      boost::atomic<unsigned long> trips_;
+      boost::atomic<unsigned long> stops_;
+      boost::atomic<bool> realtime_;
+
+      boost::atomic<bool> running_;
+      boost::thread thread_;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Tests for the ring-buffer packet framer from framer.h
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "framer.h"
+#include "protocol_v2.h"
+
+// a version 2 frame of type with the given payload
+static std::string frame_v2(char type, const std::string & payload) {
+   char buf[V2_OVERHEAD + V2_PAYLOAD_MAX];
+   PacketV2 p(type, sizeof(buf), buf);
+   p.reset();
+   for( size_t i=0; i<payload.size(); i++ ) {
+      p.append((uint8_t)payload[i]);
+   }
+   p.finish();
+   return std::string(p.outbuf(), p.outsz());
+}
+
+// feeds the framer through a pipe, the way the serial port does
+class FramerTest : public testing::Test {
+   protected:
+      virtual void SetUp() {
+         ASSERT_EQ(0, pipe(fds));
+         fcntl(fds[0], F_SETFL, O_NONBLOCK);
+         straddled = 0;
+      }
+
+      virtual void TearDown() {
+         close(fds[0]);
+         close(fds[1]);
+      }
+
+      // write data, read everything back into the framer, and return the
+      // frames it found, released again
+      std::vector<std::string> feed(const std::string & data) {
+         EXPECT_EQ((ssize_t)data.size(),
+               write(fds[1], data.data(), data.size()));
+         int n;
+         while( framer.fill(fds[0], n, 0.0) > 0 );
+         std::vector<std::string> out;
+         Framer::Frame f;
+         while( framer.pop(f) ) {
+            out.push_back(std::string(f.data, f.sz));
+            // where the frame started in the ring, if it had a v2 header
+            uint32_t begin = f.end - f.sz - (V2_OVERHEAD - 1);
+            if( (begin % FRAMER_RING_SIZE) + f.sz + V2_OVERHEAD - 1 >
+                  FRAMER_RING_SIZE ) {
+               ++straddled;
+            }
+            framer.release(f);
+         }
+         return out;
+      }
+
+      Framer framer;
+      int fds[2];
+      int straddled; // v2 frames that wrapped around the end of the ring
+};
+
+TEST_F(FramerTest, V2Frames) {
+   framer.set_version(PROTOCOL_V2);
+   std::vector<std::string> f = feed(frame_v2('O', "abc") +
+         frame_v2('H', ""));
+   ASSERT_EQ(2u, f.size());
+   EXPECT_EQ("Oabc", f[0]);
+   EXPECT_EQ("H", f[1]);
+   EXPECT_EQ(0u, framer.crc_errors());
+}
+
+// a frame split across reads comes out once it's complete
+TEST_F(FramerTest, V2Partial) {
+   framer.set_version(PROTOCOL_V2);
+   std::string a = frame_v2('O', "abcdef");
+   EXPECT_EQ(0u, feed(a.substr(0, 6)).size());
+   std::vector<std::string> f = feed(a.substr(6));
+   ASSERT_EQ(1u, f.size());
+   EXPECT_EQ("Oabcdef", f[0]);
+}
+
+// a bad CRC drops that frame, and the framer picks up at the next one
+TEST_F(FramerTest, V2ResyncAfterBadCrc) {
+   framer.set_version(PROTOCOL_V2);
+   std::string bad = frame_v2('O', "abc");
+   bad[bad.size() - 1] ^= 0x40;
+   std::vector<std::string> f = feed(bad + frame_v2('G', "xy"));
+   ASSERT_EQ(1u, f.size());
+   EXPECT_EQ("Gxy", f[0]);
+   EXPECT_EQ(1u, framer.crc_errors());
+}
+
+// a length that's too long makes the framer wait for bytes that belong to
+// the next frames; once it has them the CRC fails, and it finds them anyway
+TEST_F(FramerTest, V2ResyncAfterLongLength) {
+   framer.set_version(PROTOCOL_V2);
+   std::string bad = frame_v2('O', "abc");
+   bad[3] = 20;
+   std::string good = frame_v2('G', "0123456789") +
+      frame_v2('B', "0123456789");
+   std::vector<std::string> f = feed(bad + good);
+   ASSERT_EQ(2u, f.size());
+   EXPECT_EQ("G0123456789", f[0]);
+   EXPECT_EQ("B0123456789", f[1]);
+   EXPECT_LE(1u, framer.crc_errors());
+}
+
+// a length that's too short puts the CRC in the middle of the payload
+TEST_F(FramerTest, V2ResyncAfterShortLength) {
+   framer.set_version(PROTOCOL_V2);
+   std::string bad = frame_v2('O', "abcdef");
+   bad[3] = 1;
+   std::vector<std::string> f = feed(bad + frame_v2('G', "xy"));
+   ASSERT_EQ(1u, f.size());
+   EXPECT_EQ("Gxy", f[0]);
+   EXPECT_LE(1u, framer.crc_errors());
+}
+
+// sync bytes in the noise before a frame don't hide it
+TEST_F(FramerTest, V2ResyncAfterNoise) {
+   framer.set_version(PROTOCOL_V2);
+   std::string noise("\xA5\x00\xA5\x5A\x07\xA5\x5A", 7);
+   std::vector<std::string> f = feed(noise + frame_v2('G', "xy"));
+   ASSERT_EQ(1u, f.size());
+   EXPECT_EQ("Gxy", f[0]);
+}
+
+// frames that wrap around the end of the ring come out whole, thanks to
+// the mirror of its start
+TEST_F(FramerTest, V2Wraparound) {
+   framer.set_version(PROTOCOL_V2);
+   for( int i=0; i<3 * FRAMER_RING_SIZE / 100; i++ ) {
+      std::string payload;
+      for( int j=0; j<93; j++ ) {
+         payload += (char)(i + j);
+      }
+      std::vector<std::string> f = feed(frame_v2('O', payload));
+      ASSERT_EQ(1u, f.size()) << "frame " << i;
+      EXPECT_EQ('O' + payload, f[0]) << "frame " << i;
+   }
+   EXPECT_LT(0, straddled);
+   EXPECT_EQ(0u, framer.crc_errors());
+}
+
+TEST_F(FramerTest, V1Wraparound) {
+   std::string payload;
+   for( int j=0; j<97; j++ ) {
+      payload += (char)('a' + j % 26);
+   }
+   for( int i=0; i<3 * FRAMER_RING_SIZE / 100; i++ ) {
+      std::vector<std::string> f = feed("O" + payload + "\r");
+      ASSERT_EQ(1u, f.size()) << "frame " << i;
+      EXPECT_EQ("O" + payload, f[0]) << "frame " << i;
+   }
+   EXPECT_EQ(0u, framer.dropped());
+}
+
+int main(int argc, char ** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
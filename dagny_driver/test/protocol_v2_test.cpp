@@ -0,0 +1,52 @@
+/*
+ * Tests for the version 2 framing helpers from protocol_v2.h
+ */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "protocol_v2.h"
+
+// bit at a time CRC-16/CCITT, to check the table against
+static uint16_t crc16_bitwise(const char * data, int len, uint16_t crc) {
+   for( int i=0; i<len; i++ ) {
+      crc ^= (uint8_t)data[i] << 8;
+      for( int b=0; b<8; b++ ) {
+         crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+   }
+   return crc;
+}
+
+// the standard check value for CRC-16/CCITT-FALSE
+TEST(Crc16, CheckValue) {
+   const char * s = "123456789";
+   EXPECT_EQ(0x29B1, crc16(s, strlen(s)));
+}
+
+TEST(Crc16, TableMatchesBitwise) {
+   char b;
+   for( int i=0; i<256; i++ ) {
+      b = (char)i;
+      EXPECT_EQ(crc16_bitwise(&b, 1, 0xFFFF), crc16(&b, 1)) << "byte " << i;
+      EXPECT_EQ(crc16_bitwise(&b, 1, 0), crc16(&b, 1, 0)) << "byte " << i;
+   }
+   char buf[300];
+   for( int i=0; i<(int)sizeof(buf); i++ ) {
+      buf[i] = (char)(i * 37 + 11);
+   }
+   EXPECT_EQ(crc16_bitwise(buf, sizeof(buf), 0xFFFF),
+         crc16(buf, sizeof(buf)));
+}
+
+// a CRC can be carried on from one piece of a frame to the next
+TEST(Crc16, Incremental) {
+   const char * s = "123456789";
+   EXPECT_EQ(crc16(s, 9), crc16(s + 4, 5, crc16(s, 4)));
+}
+
+int main(int argc, char ** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
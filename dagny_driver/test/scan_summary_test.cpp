@@ -0,0 +1,125 @@
+/*
+ * Tests for the laser scan summary encoding from scan_summary.h
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "scan_summary.h"
+
+// summarize one beam per sector with the given quantized values, then
+// encode it
+static std::vector<uint8_t> encode(const std::vector<int> & v) {
+   ScanSummary s;
+   s.configure(v.size(), 1.0f, 0, 1.0);
+   std::vector<float> ranges(v.size());
+   for( size_t i=0; i<v.size(); i++ ) {
+      ranges[i] = v[i] + 0.5f;
+   }
+   s.update(&ranges[0], ranges.size(), 0.0f, 1000.0f, 0.0f, 0.01f, 0.0);
+   EXPECT_EQ((int)v.size(), s.n_sectors());
+   for( size_t i=0; i<v.size(); i++ ) {
+      EXPECT_EQ(v[i], s.sectors()[i]) << "sector " << i;
+   }
+   uint8_t buf[SCAN_ENCODED_MAX];
+   int len = s.encode(buf);
+   EXPECT_GE(SCAN_ENCODED_MAX, len);
+   return std::vector<uint8_t>(buf, buf + len);
+}
+
+// encode v, check that it decodes back to v, and return the encoding
+static std::vector<uint8_t> round_trip(const std::vector<int> & v) {
+   std::vector<uint8_t> e = encode(v);
+   uint8_t out[SCAN_SECTORS_MAX];
+   EXPECT_TRUE(scan_decode(&e[0], e.size(), out, v.size()));
+   for( size_t i=0; i<v.size(); i++ ) {
+      EXPECT_EQ(v[i], out[i]) << "sector " << i;
+   }
+   return e;
+}
+
+// open space is one run token for the whole scan, up to the longest run
+TEST(ScanSummary, AllFar) {
+   std::vector<uint8_t> e = round_trip(std::vector<int>(SCAN_SECTORS_MAX,
+            SCAN_FAR));
+   ASSERT_EQ(1u, e.size());
+   EXPECT_EQ(0xBF, e[0]);
+}
+
+TEST(ScanSummary, Runs) {
+   std::vector<int> v(SCAN_SECTORS_MAX, 40);
+   for( int i=20; i<30; i++ ) {
+      v[i] = 41;
+   }
+   std::vector<uint8_t> e = round_trip(v);
+   // literal 40, run of 19, delta +1, run of 9, delta -1, run of 33
+   EXPECT_EQ(7u, e.size());
+}
+
+// deltas reach -64 but stop short of +64, which has to be a literal
+TEST(ScanSummary, DeltaLimits) {
+   int a[] = { 191, 127, 191, 254, 190, 127, 126 };
+   std::vector<int> v(a, a + sizeof(a) / sizeof(a[0]));
+   std::vector<uint8_t> e = round_trip(v);
+   ASSERT_EQ(8u, e.size());
+   EXPECT_EQ(0x00, e[0]);  // -64
+   EXPECT_EQ(0x00, e[1]);  // -64
+   EXPECT_EQ(0xC0, e[2]);  // +64, literal
+   EXPECT_EQ(191, e[3]);
+   EXPECT_EQ(0x7F, e[4]);  // +63
+   EXPECT_EQ(0x00, e[5]);  // -64
+   EXPECT_EQ(0x01, e[6]);  // -63
+   EXPECT_EQ(0x3F, e[7]);  // -1
+}
+
+TEST(ScanSummary, Literals) {
+   int a[] = { 0, 255, 0, 128, 0, 200 };
+   std::vector<int> v(a, a + sizeof(a) / sizeof(a[0]));
+   std::vector<uint8_t> e = round_trip(v);
+   EXPECT_EQ(2 * v.size(), e.size());
+   for( size_t i=0; i<v.size(); i++ ) {
+      EXPECT_EQ(0xC0, e[2 * i]);
+      EXPECT_EQ(v[i], e[2 * i + 1]);
+   }
+}
+
+// every sector a literal; the encoding still fits in SCAN_ENCODED_MAX
+TEST(ScanSummary, WorstCase) {
+   std::vector<int> v(SCAN_SECTORS_MAX);
+   for( int i=0; i<SCAN_SECTORS_MAX; i++ ) {
+      v[i] = (i & 1) ? 200 : 0;
+   }
+   std::vector<uint8_t> e = round_trip(v);
+   EXPECT_EQ((size_t)SCAN_ENCODED_MAX, e.size());
+}
+
+// no summary is longer than one run, but the decoder takes back to back
+// runs anyway
+TEST(ScanDecode, LongRun) {
+   uint8_t e[] = { 0xC0, 7, 0xBF, 0x89 };
+   uint8_t out[1 + 64 + 10];
+   ASSERT_TRUE(scan_decode(e, sizeof(e), out, sizeof(out)));
+   for( size_t i=0; i<sizeof(out); i++ ) {
+      EXPECT_EQ(7, out[i]) << "sector " << i;
+   }
+}
+
+TEST(ScanDecode, Malformed) {
+   uint8_t out[SCAN_SECTORS_MAX];
+   // literal with no value
+   uint8_t truncated[] = { 0x40, 0xC0 };
+   EXPECT_FALSE(scan_decode(truncated, sizeof(truncated), out, 2));
+   // too few sectors
+   uint8_t short_run[] = { 0x81 };
+   EXPECT_FALSE(scan_decode(short_run, sizeof(short_run), out, 3));
+   // too many sectors
+   EXPECT_FALSE(scan_decode(short_run, sizeof(short_run), out, 1));
+   uint8_t deltas[] = { 0x40, 0x40, 0x40 };
+   EXPECT_FALSE(scan_decode(deltas, sizeof(deltas), out, 2));
+}
+
+int main(int argc, char ** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,95 @@
+/*
+ * Tests for the outbound packet scheduler from tx_queue.h
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "protocol_v2.h"
+#include "tx_queue.h"
+
+// push one empty-payload urgent packet of type, framed as version does
+static bool push(TxQueue & q, char type, int version) {
+   char buf[16];
+   OutPacket p(type, sizeof(buf), buf);
+   p.set_version(version);
+   p.reset();
+   p.finish();
+   return q.push(TX_URGENT, frame_type(p.outbuf(), version), p.outbuf(),
+         p.outsz());
+}
+
+// types of the frames in buf, in order
+static std::string types(const char * buf, int sz, int version) {
+   std::string t;
+   int i = 0;
+   while( i < sz ) {
+      t += frame_type(buf + i, version);
+      if( version == PROTOCOL_V2 ) {
+         i += V2_OVERHEAD + (uint8_t)buf[i + 3];
+      } else {
+         while( i < sz && buf[i] != '\r' ) {
+            ++i;
+         }
+         ++i;
+      }
+   }
+   return t;
+}
+
+static std::string drain(TxQueue & q, int version) {
+   char buf[TX_FRAME_MAX * 4];
+   int sz = q.drain(buf, sizeof(buf),
+         boost::posix_time::milliseconds(10));
+   return types(buf, sz, version);
+}
+
+// every version 2 frame starts with the sync word, so the type has to come
+// from after the header
+TEST(TxQueue, UrgentTypesV2) {
+   TxQueue q;
+   ASSERT_TRUE(push(q, 'C', PROTOCOL_V2));
+   ASSERT_TRUE(push(q, 'H', PROTOCOL_V2));
+   EXPECT_EQ(2, q.depth(TX_URGENT));
+   EXPECT_EQ("CH", drain(q, PROTOCOL_V2));
+}
+
+TEST(TxQueue, UrgentTypesV1) {
+   TxQueue q;
+   ASSERT_TRUE(push(q, 'C', 1));
+   ASSERT_TRUE(push(q, 'H', 1));
+   EXPECT_EQ("CH", drain(q, 1));
+}
+
+// a newer packet of the same type replaces the queued one in place
+TEST(TxQueue, UrgentReplace) {
+   TxQueue q;
+   ASSERT_TRUE(push(q, 'C', PROTOCOL_V2));
+   ASSERT_TRUE(push(q, 'H', PROTOCOL_V2));
+   ASSERT_TRUE(push(q, 'C', PROTOCOL_V2));
+   EXPECT_EQ(2, q.depth(TX_URGENT));
+   EXPECT_EQ("CH", drain(q, PROTOCOL_V2));
+}
+
+// the transmit thread stamps heartbeats by whether one was drained
+TEST(TxQueue, DrainMarked) {
+   TxQueue q;
+   char buf[TX_FRAME_MAX * 4];
+   bool marked = true;
+   ASSERT_TRUE(push(q, 'C', PROTOCOL_V2));
+   EXPECT_LT(0, q.drain(buf, sizeof(buf),
+            boost::posix_time::milliseconds(10), 'H', &marked));
+   EXPECT_FALSE(marked);
+
+   ASSERT_TRUE(push(q, 'C', PROTOCOL_V2));
+   ASSERT_TRUE(push(q, 'H', PROTOCOL_V2));
+   EXPECT_LT(0, q.drain(buf, sizeof(buf),
+            boost::posix_time::milliseconds(10), 'H', &marked));
+   EXPECT_TRUE(marked);
+}
+
+int main(int argc, char ** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,208 @@
+/*
+ * binary_log.cpp
+ *
+ * Binary log writer and reader; see binary_log.h
+ */
+
+#include "binary_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// size of each of the writer's pages
+#define LOG_PAGE (64 * 1024)
+
+bool log_schema(LogSchema & s, uint8_t type, const std::string & name,
+      const std::string & topic, const std::vector<std::string> & fields) {
+   if( fields.size() > LOG_MAX_FIELDS || name.size() >= LOG_NAME ||
+         topic.size() >= LOG_TOPIC ) {
+      return false;
+   }
+   memset(&s, 0, sizeof(s));
+   s.type = type;
+   s.fields = fields.size();
+   s.size = sizeof(LogRecordHeader) + fields.size() * sizeof(double);
+   strcpy(s.name, name.c_str());
+   strcpy(s.topic, topic.c_str());
+   for( size_t i=0; i<fields.size(); i++ ) {
+      if( fields[i].size() >= LOG_NAME ) {
+         return false;
+      }
+      strcpy(s.field[i], fields[i].c_str());
+   }
+   return true;
+}
+
+LogWriter::LogWriter() : fd(-1), running(false), active(0), pending(false),
+   dropped_(0), failed_(false) {
+   for( int i=0; i<2; i++ ) {
+      pages[i].data.resize(LOG_PAGE);
+      pages[i].used = 0;
+   }
+}
+
+LogWriter::~LogWriter() {
+   close();
+}
+
+bool LogWriter::open(const std::string & file) {
+   close();
+   fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if( fd < 0 ) {
+      return false;
+   }
+   running = true;
+   thread = boost::thread(&LogWriter::run, this);
+   return true;
+}
+
+bool LogWriter::write(const void * data, size_t len) {
+   boost::mutex::scoped_lock lock(mutex);
+   if( fd < 0 || len > LOG_PAGE ) {
+      ++dropped_;
+      return false;
+   }
+   if( pages[active].used + len > LOG_PAGE ) {
+      if( pending ) {
+         // the thread is still writing the other page
+         ++dropped_;
+         return false;
+      }
+      active ^= 1;
+      pending = true;
+      full_cond.notify_one();
+   }
+   Page & p = pages[active];
+   memcpy(&p.data[p.used], data, len);
+   p.used += len;
+   return true;
+}
+
+void LogWriter::close() {
+   {
+      boost::mutex::scoped_lock lock(mutex);
+      if( fd < 0 ) {
+         return;
+      }
+      running = false;
+      full_cond.notify_one();
+   }
+   thread.join();
+   ::close(fd);
+   fd = -1;
+}
+
+// write all of a page out
+static bool write_all(int fd, const char * buf, size_t len) {
+   while( len > 0 ) {
+      ssize_t r = ::write(fd, buf, len);
+      if( r < 0 ) {
+         if( errno == EINTR ) {
+            continue;
+         }
+         return false;
+      }
+      buf += r;
+      len -= r;
+   }
+   return true;
+}
+
+void LogWriter::run() {
+   boost::mutex::scoped_lock lock(mutex);
+   for(;;) {
+      if( !pending && running ) {
+         full_cond.timed_wait(lock, boost::posix_time::seconds(1));
+      }
+      // when there's no full page, write out the partial one, so that a
+      // quiet log still reaches the disk. At the end this writes out
+      // everything that's left
+      if( !pending && pages[active].used > 0 ) {
+         active ^= 1;
+         pending = true;
+      }
+      if( pending ) {
+         Page & p = pages[active ^ 1];
+         lock.unlock();
+         bool ok = write_all(fd, &p.data[0], p.used);
+         lock.lock();
+         if( !ok ) {
+            failed_ = true;
+         }
+         p.used = 0;
+         pending = false;
+      } else if( !running ) {
+         break;
+      }
+   }
+}
+
+LogReader::LogReader() : f(0) {
+}
+
+LogReader::~LogReader() {
+   if( f ) {
+      fclose(f);
+   }
+}
+
+bool LogReader::open(const std::string & file) {
+   if( f ) {
+      fclose(f);
+      f = 0;
+   }
+   schemas_.clear();
+   by_type.clear();
+   f = fopen(file.c_str(), "rb");
+   if( !f ) {
+      return false;
+   }
+   if( fread(&header_, sizeof(header_), 1, f) != 1 ||
+         memcmp(header_.magic, LOG_MAGIC, sizeof(header_.magic)) != 0 ||
+         header_.version != LOG_VERSION ) {
+      fclose(f);
+      f = 0;
+      return false;
+   }
+   for( uint32_t i=0; i<header_.schemas; i++ ) {
+      LogSchema s;
+      if( fread(&s, sizeof(s), 1, f) != 1 || s.fields > LOG_MAX_FIELDS ||
+            s.size != sizeof(LogRecordHeader) + s.fields * sizeof(double) ) {
+         fclose(f);
+         f = 0;
+         schemas_.clear();
+         by_type.clear();
+         return false;
+      }
+      s.name[LOG_NAME - 1] = 0;
+      s.topic[LOG_TOPIC - 1] = 0;
+      for( int j=0; j<s.fields; j++ ) {
+         s.field[j][LOG_NAME - 1] = 0;
+      }
+      by_type[s.type] = schemas_.size();
+      schemas_.push_back(s);
+   }
+   return true;
+}
+
+const LogSchema * LogReader::schema(uint8_t type) const {
+   std::map<uint8_t, size_t>::const_iterator i = by_type.find(type);
+   if( i == by_type.end() ) {
+      return 0;
+   }
+   return &schemas_[i->second];
+}
+
+bool LogReader::next(LogRecordHeader & r, double * fields) {
+   if( !f || fread(&r, sizeof(r), 1, f) != 1 ) {
+      return false;
+   }
+   const LogSchema * s = schema(r.type);
+   if( !s ) {
+      return false;
+   }
+   // a log that wasn't closed can end part way through a record
+   return fread(fields, sizeof(double), s->fields, f) == s->fields;
+}
@@ -0,0 +1,137 @@
+/*
+ * binary_log.h
+ *
+ * Fixed-record binary log files, and a paged background writer for them.
+ *
+ * A log is a header, a schema table describing each record type, and then
+ * records. Every record is a LogRecordHeader followed by the fields of its
+ * type, all doubles; so every record of a type is the same size, and the
+ * whole file is 8-byte aligned. Everything is little-endian.
+ *
+ *   LogHeader
+ *   LogSchema * header.schemas
+ *   records:  LogRecordHeader, then schema.fields doubles
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#define LOG_MAGIC "DAGNYLOG"
+#define LOG_VERSION 1
+#define LOG_NAME 16
+#define LOG_TOPIC 64
+#define LOG_MAX_FIELDS 16
+
+struct LogHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t schemas; // entries in the schema table
+   double start;     // ROS time the log was started
+};
+
+// one record type
+struct LogSchema {
+   uint8_t type;     // record type, as in LogRecordHeader
+   uint8_t fields;
+   uint16_t reserved;
+   uint32_t size;    // whole record, including the header
+   char name[LOG_NAME];
+   char topic[LOG_TOPIC];
+   char field[LOG_MAX_FIELDS][LOG_NAME];
+};
+
+struct LogRecordHeader {
+   uint8_t type;
+   uint8_t reserved[7];
+   double stamp;     // ROS time the message arrived
+};
+
+// turn a schema into the table entry for the file; false if it has too
+// many fields or its names don't fit
+bool log_schema(LogSchema & s, uint8_t type, const std::string & name,
+      const std::string & topic, const std::vector<std::string> & fields);
+
+// Appends to a file through two pages: callers fill one page while a
+// background thread writes the other out, so callers never wait on the
+// disk. If the disk falls so far behind that both pages are full, writes
+// are dropped and counted rather than blocking. Partial pages are written
+// out at least once a second. Thread-safe
+class LogWriter {
+   public:
+      LogWriter();
+      ~LogWriter();
+
+      // create file and start the writer thread
+      bool open(const std::string & file);
+
+      // append len bytes as a unit; they are never split across pages.
+      // Returns false if they were dropped
+      bool write(const void * data, size_t len);
+
+      // write whatever is buffered, stop the thread and close the file
+      void close();
+
+      unsigned long dropped() const { return dropped_; }
+
+      // has writing to the file failed?
+      bool failed() const { return failed_; }
+
+   private:
+      struct Page {
+         std::vector<char> data;
+         size_t used;
+      };
+
+      void run();
+
+      int fd;
+      bool running;
+      boost::thread thread;
+      boost::mutex mutex;
+      boost::condition_variable full_cond;
+
+      Page pages[2];
+      int active;   // page the callers are filling
+      bool pending; // the other page is waiting to be written
+      unsigned long dropped_;
+      bool failed_;
+};
+
+// Reads a log file back, record by record
+class LogReader {
+   public:
+      LogReader();
+      ~LogReader();
+
+      // open a log and read its schema table; false if it isn't a log
+      bool open(const std::string & file);
+
+      const LogHeader & header() const { return header_; }
+      const std::vector<LogSchema> & schemas() const { return schemas_; }
+
+      // the schema for a record type, or 0 if there isn't one
+      const LogSchema * schema(uint8_t type) const;
+
+      // the next record; fields has room for LOG_MAX_FIELDS. Returns false
+      // at the end of the file, or at a record it can't make sense of
+      bool next(LogRecordHeader & r, double * fields);
+
+   private:
+      FILE * f;
+      LogHeader header_;
+      std::vector<LogSchema> schemas_;
+      std::map<uint8_t, size_t> by_type;
+};
+
+#endif
@@ -1,30 +1,116 @@
+/*
+ * laser.cpp
+ *
+ * Obstacle proximity from the laser, for the safety monitor: the nearest
+ * return, the nearest return in each sector, returns inside the stop
+ * radius, and the free distance along the arc the robot is currently
+ * steering. See scan_analysis.h
+ *
+ * The turning arc comes from the steering setting on encoder, through the
+ * same steering calibration the driver uses.
+ *
+ * Parameters:
+ *   ~sectors      number of sectors; default 8
+ *   ~stop_radius  meters; default 0.5
+ *   ~half_width   half the width of the swept path, meters; default 0.3
+ *   ~laser_x      distance from the rear axle forward to the laser,
+ *                 meters; default 0
+ *
+ * Author: Austin Hendrix
+ */
+
+#include <vector>
 
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
+#include <dagny_driver/Encoder.h>
+#include <dagny_driver/steer.h>
+#include <dagny_test/ScanProximity.h>
 
-#include <math.h>
+#include "scan_analysis.h"
 
 using namespace std;
 
+ScanAnalysis analysis;
+ScanResult result;
+ros::Publisher proximity_pub;
+
+// curvature of the current steering setting; positive to the left
+float curvature = 0.0f;
+
+void encoderCallback(const dagny_driver::Encoder::ConstPtr & msg) {
+   // negative steering turns left. The radius at steer 0 is only a
+   // stand-in for straight ahead
+   if( msg->steer == 0 ) {
+      curvature = 0.0f;
+   } else {
+      curvature = (msg->steer < 0 ? 1.0f : -1.0f) / steer2radius(msg->steer);
+   }
+}
+
 void laserCallback(const sensor_msgs::LaserScan::ConstPtr & msg) {
-   double min_range = 10000.0; // some big value
-   int min_pos = -1;
-   unsigned int i;
-   for( i=0; i < msg->ranges.size(); i++ ) {
-      if( msg->ranges[i] != 0.0 && msg->ranges[i] < min_range ) {
-         min_range = msg->ranges[i];
-         min_pos = i;
-      }
+   if( msg->ranges.empty() ) {
+      return;
+   }
+   analysis.analyze(&msg->ranges[0], msg->ranges.size(), msg->range_min,
+         msg->range_max, msg->angle_min, msg->angle_increment, curvature,
+         result);
+
+   dagny_test::ScanProximity p;
+   p.header = msg->header;
+   p.min_range = result.min_range;
+   p.min_angle = result.min_index < 0 ? 0.0f :
+      msg->angle_min + result.min_index * msg->angle_increment;
+   p.sector_angle_min = msg->angle_min;
+   p.sector_width = msg->angle_increment * msg->ranges.size() /
+      analysis.sectors();
+   p.sector_min = result.sector_min;
+   p.stop_radius = analysis.stop_radius();
+   p.stop_count = result.stop_count;
+   p.curvature = curvature;
+   p.half_width = analysis.half_width();
+   p.free_distance = result.free_distance;
+   proximity_pub.publish(p);
+
+   ROS_DEBUG("Minimum laser scan distance of %f at %d", result.min_range,
+         result.min_index);
+}
+
+// the driver's steering calibration, if there is one
+void steering_setup(ros::NodeHandle & n) {
+   std::vector<double> radius;
+   if( !n.getParam("steering_radius", radius) ) {
+      return;
+   }
+   int step;
+   n.param("steering_step", step, 10);
+   std::vector<float> r(radius.begin(), radius.end());
+   if( r.empty() || !steer_calibrate(&r[0], r.size(), step) ) {
+      ROS_ERROR("Bad steering calibration; using built-in table");
    }
-   printf("Minimum laser scan distance of %lf at %d\n", min_range, min_pos);
 }
 
 int main(int argc, char ** argv) {
    ros::init(argc, argv, "laser");
 
    ros::NodeHandle n;
+   ros::NodeHandle pn("~");
+
+   int sectors;
+   double stop_radius, half_width, laser_x;
+   pn.param("sectors", sectors, 8);
+   pn.param("stop_radius", stop_radius, 0.5);
+   pn.param("half_width", half_width, 0.3);
+   pn.param("laser_x", laser_x, 0.0);
+   analysis.configure(sectors, stop_radius, half_width, laser_x);
+
+   steering_setup(n);
+
+   proximity_pub = n.advertise<dagny_test::ScanProximity>("scan_proximity",
+         10);
 
    ros::Subscriber laser_sub = n.subscribe("scan", 2, laserCallback);
+   ros::Subscriber encoder_sub = n.subscribe("encoder", 10, encoderCallback);
 
    ros::spin();
 
@@ -1,61 +1,162 @@
 /*
- * drive.cpp
+ * log.cpp
  *
- * Drive the robot in a straight line
+ * Log odometry, GPS, compass and position estimates to a file, for
+ * looking at runs afterwards.
+ *
+ * Logs are binary by default (see binary_log.h); log_convert turns them
+ * into CSV or a bag. The old text format is still available.
+ *
+ * Parameters:
+ *   ~directory  where to put logs; default ~/log
+ *   ~format     binary (default) or text
+ *   ~topics     which streams to log: any of odometry, gps, compass and
+ *               position. Default all of them. Remap the topics to log
+ *               something else
  *
  * Author: Austin Hendrix
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include <string>
+#include <vector>
+
 #include <ros/ros.h>
 
 #include <nav_msgs/Odometry.h>
 #include <sensor_msgs/NavSatFix.h>
 #include <std_msgs/Float32.h>
 
+#include "binary_log.h"
+
 double dist = 0.0;
 
 double x = 0.0;
 double y = 0.0;
 double theta = 0.0;
 
-FILE * logp;
+// the streams we know how to log. theta is orientation.x, as the
+// odometry and position estimates carry it
+struct Stream {
+   uint8_t type;
+   const char * name;
+   const char * topic;
+   const char * fields;
+};
+
+Stream streams[] = {
+   { 'O', "odometry", "base_odometry", "x y theta" },
+   { 'G', "gps", "extended_fix", "latitude longitude" },
+   { 'C', "compass", "compass", "heading" },
+   { 'P', "position", "position", "x y xx xy yx yy theta theta_var" },
+};
+
+#define N_STREAMS (int)(sizeof(streams) / sizeof(streams[0]))
+
+LogWriter logw;
+bool text = false;
+
+// log one record of type
+void record(uint8_t type, const double * fields, int n) {
+   if( text ) {
+      char line[512];
+      int l = snprintf(line, sizeof(line), "%c", type);
+      for( int i=0; i<n; i++ ) {
+         l += snprintf(line + l, sizeof(line) - l, " %lf", fields[i]);
+      }
+      l += snprintf(line + l, sizeof(line) - l, "\n");
+      logw.write(line, l);
+   } else {
+      char buf[sizeof(LogRecordHeader) + LOG_MAX_FIELDS * sizeof(double)];
+      LogRecordHeader h;
+      memset(&h, 0, sizeof(h));
+      h.type = type;
+      h.stamp = ros::Time::now().toSec();
+      memcpy(buf, &h, sizeof(h));
+      memcpy(buf + sizeof(h), fields, n * sizeof(double));
+      logw.write(buf, sizeof(h) + n * sizeof(double));
+   }
+}
 
 void odoCallback(const nav_msgs::Odometry::ConstPtr & msg) {
    x += msg->pose.pose.position.x;
    y += msg->pose.pose.position.y;
    theta += msg->pose.pose.orientation.x;
 
-   fprintf(logp, "O %lf %lf %lf\n", msg->pose.pose.position.x,
-         msg->pose.pose.position.y, msg->pose.pose.orientation.x);
-   ROS_INFO("Odometry position (%lf, %lf, %lf)", x, y, theta);
+   double f[] = { msg->pose.pose.position.x, msg->pose.pose.position.y,
+      msg->pose.pose.orientation.x };
+   record('O', f, 3);
+   ROS_DEBUG("Odometry position (%lf, %lf, %lf)", x, y, theta);
 }
 
 void gpsCallback(const sensor_msgs::NavSatFix::ConstPtr & msg) {
-   fprintf(logp, "G %lf %lf\n", msg->latitude, msg->longitude);
+   double f[] = { msg->latitude, msg->longitude };
+   record('G', f, 2);
 }
 
 void compassCallback(const std_msgs::Float32::ConstPtr & msg) {
-   fprintf(logp, "C %lf\n", msg->data);
+   double f[] = { msg->data };
+   record('C', f, 1);
 }
 
 void positionCallback(const nav_msgs::Odometry::ConstPtr & msg) {
-   fprintf(logp, "P %lf %lf %lf %lf %lf %lf %lf %lf\n",
-         msg->pose.pose.position.x,
-         msg->pose.pose.position.y,
-         msg->pose.covariance[6*0 + 0], //xx
-         msg->pose.covariance[6*0 + 1], //xy
-         msg->pose.covariance[6*1 + 0], //yx
-         msg->pose.covariance[6*1 + 1], //yy
-         msg->pose.pose.orientation.x,
-         msg->pose.covariance[6*0 + 0]);
+   double f[] = {
+      msg->pose.pose.position.x,
+      msg->pose.pose.position.y,
+      msg->pose.covariance[6*0 + 0], //xx
+      msg->pose.covariance[6*0 + 1], //xy
+      msg->pose.covariance[6*1 + 0], //yx
+      msg->pose.covariance[6*1 + 1], //yy
+      msg->pose.pose.orientation.x,
+      msg->pose.covariance[6*5 + 5], //yaw
+   };
+   record('P', f, 8);
+}
+
+ros::Subscriber subscribe(ros::NodeHandle & n, const Stream & s) {
+   switch( s.type ) {
+      case 'O':
+         return n.subscribe(s.topic, 10, odoCallback);
+      case 'G':
+         return n.subscribe(s.topic, 10, gpsCallback);
+      case 'C':
+         return n.subscribe(s.topic, 10, compassCallback);
+      case 'P':
+         return n.subscribe(s.topic, 10, positionCallback);
+   }
+   return ros::Subscriber();
 }
 
 int main(int argc, char ** argv) {
    ros::init(argc, argv, "count");
 
+   ros::NodeHandle n;
+   ros::NodeHandle pn("~");
+
+   std::string directory;
+   const char * home = getenv("HOME");
+   pn.param<std::string>("directory", directory,
+         std::string(home ? home : ".") + "/log");
+
+   std::string format;
+   pn.param<std::string>("format", format, "binary");
+   if( format != "binary" && format != "text" ) {
+      ROS_FATAL("Unknown log format %s", format.c_str());
+      return 1;
+   }
+   text = format == "text";
+
+   std::vector<std::string> topics;
+   if( !pn.getParam("topics", topics) ) {
+      for( int i=0; i<N_STREAMS; i++ ) {
+         topics.push_back(streams[i].name);
+      }
+   }
+
    char logfile[1024];
    char date[256];
    struct tm * timeptr;
@@ -64,21 +165,66 @@ int main(int argc, char ** argv) {
    timeptr = localtime(&now);
 
    strftime(date, 256, "%F-%T", timeptr);
-   snprintf(logfile, 1024, "/home/hendrix/log/run-%s.log", date);
-
-   logp = fopen(logfile, "w");
-
-   ROS_INFO("Counting");
-
-   ros::NodeHandle n;
-
-   ros::Subscriber s = n.subscribe("base_odometry", 10, odoCallback);
-   ros::Subscriber s2 = n.subscribe("extended_fix", 10, gpsCallback);
-   ros::Subscriber s3 = n.subscribe("compass", 10, compassCallback);
-   ros::Subscriber s4 = n.subscribe("position", 10, positionCallback);
+   snprintf(logfile, 1024, "%s/run-%s.%s", directory.c_str(), date,
+         text ? "log" : "dlog");
+
+   if( !logw.open(logfile) ) {
+      ROS_FATAL("Failed to open log file %s", logfile);
+      return 1;
+   }
+
+   std::vector<ros::Subscriber> subs;
+   std::vector<LogSchema> schemas;
+   for( size_t t=0; t<topics.size(); t++ ) {
+      int i;
+      for( i=0; i<N_STREAMS; i++ ) {
+         if( topics[t] == streams[i].name ) break;
+      }
+      if( i == N_STREAMS ) {
+         ROS_ERROR("Don't know how to log %s", topics[t].c_str());
+         continue;
+      }
+      std::vector<std::string> fields;
+      char buf[256];
+      strncpy(buf, streams[i].fields, sizeof(buf));
+      buf[sizeof(buf) - 1] = 0;
+      for( char * f = strtok(buf, " "); f; f = strtok(0, " ") ) {
+         fields.push_back(f);
+      }
+      LogSchema s;
+      std::string topic = n.resolveName(streams[i].topic);
+      if( !log_schema(s, streams[i].type, streams[i].name, topic, fields) ) {
+         ROS_ERROR("Can't describe %s on %s in the log; not logging it",
+               streams[i].name, topic.c_str());
+         continue;
+      }
+      schemas.push_back(s);
+      subs.push_back(subscribe(n, streams[i]));
+   }
+
+   if( !text ) {
+      LogHeader h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, LOG_MAGIC, sizeof(h.magic));
+      h.version = LOG_VERSION;
+      h.schemas = schemas.size();
+      h.start = ros::Time::now().toSec();
+      logw.write(&h, sizeof(h));
+      for( size_t i=0; i<schemas.size(); i++ ) {
+         logw.write(&schemas[i], sizeof(schemas[i]));
+      }
+   }
+
+   ROS_INFO("Logging to %s", logfile);
 
    ros::spin();
 
-   fclose(logp);
+   logw.close();
+   if( logw.dropped() ) {
+      ROS_WARN("Dropped %lu log records", logw.dropped());
+   }
+   if( logw.failed() ) {
+      ROS_ERROR("Failed to write some of %s", logfile);
+   }
    return 0;
 }
@@ -0,0 +1,162 @@
+/*
+ * log_convert.cpp
+ *
+ * Convert a binary log from log into CSV or a bag.
+ *
+ *   log_convert <log> csv [prefix]
+ *      one CSV file per record type, <prefix>_<type>.csv, with a header
+ *      line. The prefix defaults to the log's name without its extension
+ *   log_convert <log> bag <bag>
+ *      the records as messages on the topics they were logged from
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+
+#include <nav_msgs/Odometry.h>
+#include <sensor_msgs/NavSatFix.h>
+#include <std_msgs/Float32.h>
+
+#include "binary_log.h"
+
+int to_csv(LogReader & log, const std::string & prefix) {
+   std::map<uint8_t, FILE*> files;
+   for( size_t i=0; i<log.schemas().size(); i++ ) {
+      const LogSchema & s = log.schemas()[i];
+      std::string name = prefix + "_" + s.name + ".csv";
+      FILE * f = fopen(name.c_str(), "w");
+      if( !f ) {
+         fprintf(stderr, "Failed to create %s\n", name.c_str());
+         return 1;
+      }
+      fprintf(f, "stamp");
+      for( int j=0; j<s.fields; j++ ) {
+         fprintf(f, ",%s", s.field[j]);
+      }
+      fprintf(f, "\n");
+      files[s.type] = f;
+   }
+
+   LogRecordHeader r;
+   double fields[LOG_MAX_FIELDS];
+   unsigned long records = 0;
+   while( log.next(r, fields) ) {
+      FILE * f = files[r.type];
+      fprintf(f, "%.6lf", r.stamp);
+      for( int j=0; j<log.schema(r.type)->fields; j++ ) {
+         fprintf(f, ",%.9g", fields[j]);
+      }
+      fprintf(f, "\n");
+      ++records;
+   }
+
+   for( std::map<uint8_t, FILE*>::iterator i = files.begin();
+         i != files.end(); ++i ) {
+      fclose(i->second);
+   }
+   printf("Wrote %lu records\n", records);
+   return 0;
+}
+
+// rebuild the messages the way log took them apart
+nav_msgs::Odometry odometry(const ros::Time & t, const double * f) {
+   nav_msgs::Odometry o;
+   o.header.stamp = t;
+   o.pose.pose.position.x = f[0];
+   o.pose.pose.position.y = f[1];
+   o.pose.pose.orientation.x = f[2];
+   return o;
+}
+
+nav_msgs::Odometry position(const ros::Time & t, const double * f) {
+   nav_msgs::Odometry o;
+   o.header.stamp = t;
+   o.pose.pose.position.x = f[0];
+   o.pose.pose.position.y = f[1];
+   o.pose.covariance[6*0 + 0] = f[2];
+   o.pose.covariance[6*0 + 1] = f[3];
+   o.pose.covariance[6*1 + 0] = f[4];
+   o.pose.covariance[6*1 + 1] = f[5];
+   o.pose.pose.orientation.x = f[6];
+   o.pose.covariance[6*5 + 5] = f[7];
+   return o;
+}
+
+int to_bag(LogReader & log, const std::string & file) {
+   rosbag::Bag bag;
+   try {
+      bag.open(file, rosbag::bagmode::Write);
+   } catch( rosbag::BagException & e ) {
+      fprintf(stderr, "Failed to create %s: %s\n", file.c_str(), e.what());
+      return 1;
+   }
+
+   LogRecordHeader r;
+   double f[LOG_MAX_FIELDS];
+   unsigned long records = 0;
+   while( log.next(r, f) ) {
+      const LogSchema * s = log.schema(r.type);
+      ros::Time t(r.stamp);
+      const char * name = s->name;
+      if( strcmp(name, "odometry") == 0 ) {
+         bag.write(s->topic, t, odometry(t, f));
+      } else if( strcmp(name, "position") == 0 ) {
+         bag.write(s->topic, t, position(t, f));
+      } else if( strcmp(name, "gps") == 0 ) {
+         sensor_msgs::NavSatFix fix;
+         fix.header.stamp = t;
+         fix.latitude = f[0];
+         fix.longitude = f[1];
+         bag.write(s->topic, t, fix);
+      } else if( strcmp(name, "compass") == 0 ) {
+         std_msgs::Float32 heading;
+         heading.data = f[0];
+         bag.write(s->topic, t, heading);
+      } else {
+         continue;
+      }
+      ++records;
+   }
+   bag.close();
+   printf("Wrote %lu messages\n", records);
+   return 0;
+}
+
+int main(int argc, char ** argv) {
+   if( argc < 3 || (strcmp(argv[2], "csv") != 0 &&
+            strcmp(argv[2], "bag") != 0) ||
+         (strcmp(argv[2], "bag") == 0 && argc < 4) ) {
+      fprintf(stderr, "Usage: %s <log> csv [prefix]\n", argv[0]);
+      fprintf(stderr, "       %s <log> bag <bag>\n", argv[0]);
+      return 1;
+   }
+
+   LogReader log;
+   if( !log.open(argv[1]) ) {
+      fprintf(stderr, "%s isn't a binary log\n", argv[1]);
+      return 1;
+   }
+
+   if( strcmp(argv[2], "bag") == 0 ) {
+      return to_bag(log, argv[3]);
+   }
+
+   std::string prefix;
+   if( argc > 3 ) {
+      prefix = argv[3];
+   } else {
+      prefix = argv[1];
+      size_t dot = prefix.rfind('.');
+      if( dot != std::string::npos && prefix.find('/', dot) ==
+            std::string::npos ) {
+         prefix = prefix.substr(0, dot);
+      }
+   }
+   return to_csv(log, prefix);
+}
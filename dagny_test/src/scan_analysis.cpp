@@ -0,0 +1,123 @@
+/*
+ * scan_analysis.cpp
+ *
+ * Single-pass laser scan analysis; see scan_analysis.h
+ */
+
+#include "scan_analysis.h"
+
+#include <math.h>
+#include <stdint.h>
+
+ScanAnalysis::ScanAnalysis() : sectors_(8), stop_radius_(0.5f),
+   half_width_(0.3f), laser_x_(0.0f), n_(0), angle_min_(0.0f),
+   angle_increment_(0.0f) {
+}
+
+void ScanAnalysis::configure(int sectors, float stop_radius,
+      float half_width, float laser_x) {
+   sectors_ = sectors < 1 ? 1 : sectors;
+   stop_radius_ = stop_radius;
+   half_width_ = half_width;
+   laser_x_ = laser_x;
+}
+
+void ScanAnalysis::geometry(int n, float angle_min, float angle_increment) {
+   if( n == n_ && angle_min == angle_min_ &&
+         angle_increment == angle_increment_ ) {
+      return;
+   }
+   n_ = n;
+   angle_min_ = angle_min;
+   angle_increment_ = angle_increment;
+   cos_.resize(n);
+   sin_.resize(n);
+   for( int i=0; i<n; i++ ) {
+      float a = angle_min + i * angle_increment;
+      cos_[i] = cosf(a);
+      sin_[i] = sinf(a);
+   }
+}
+
+void ScanAnalysis::analyze(const float * ranges, int n, float range_min,
+      float range_max, float angle_min, float angle_increment,
+      float curvature, ScanResult & r) {
+   r.sector_min.assign(sectors_, range_max);
+   r.min_range = range_max;
+   r.min_index = -1;
+   r.stop_count = 0;
+   r.free_distance = range_max;
+   if( n < sectors_ ) {
+      return;
+   }
+   geometry(n, angle_min, angle_increment);
+
+   // everything is in whole millimeters, so that the reductions are all
+   // integer min and sum reductions, which vectorize without relaxing any
+   // floating point rules. Invalid returns become far, which is never
+   // closer than anything else
+   const float far_f = floorf(range_max * 1000.0f);
+   const int32_t far = far_f;
+   const int32_t stop_mm = stop_radius_ * 1000.0f;
+   const float k = curvature;
+   const float w = half_width_;
+   const float w2 = w * w;
+   const float lx = laser_x_;
+   const float * c = &cos_[0];
+   const float * s = &sin_[0];
+
+   int32_t nearest = far;
+   int nearest_sector = -1;
+   int32_t stop = 0;
+   int32_t free = far;
+   for( int sec=0; sec<sectors_; sec++ ) {
+      int start = sec * n / sectors_;
+      int end = (sec + 1) * n / sectors_;
+      int32_t m = far;
+      for( int i=start; i<end; i++ ) {
+         float v = ranges[i];
+         // false for NaN, too. Bitwise ands keep the loop branch-free
+         int32_t ok = (v >= range_min) & (v <= range_max);
+         // clamping first keeps the conversion in range, and lets the
+         // compiler turn both selects into vector blends
+         float mm = v * 1000.0f;
+         mm = mm < far_f ? mm : far_f;
+         mm = ok ? mm : far_f;
+         int32_t q = mm;
+         m = q < m ? q : m;
+         stop += q < stop_mm ? 1 : 0;
+
+         // the return in the rear axle frame. It's within w of the arc
+         // of curvature k through the origin when
+         // |k (x^2 + y^2 - w^2) / 2 - y| < w, which also holds for k = 0
+         float x = lx + v * c[i];
+         float y = v * s[i];
+         float off = k * (x * x + y * y - w2) * 0.5f - y;
+         int32_t hit = (x > 0.0f) & (off < w) & (off > -w);
+         int32_t fq = hit ? q : far;
+         free = fq < free ? fq : free;
+      }
+      r.sector_min[sec] = m / 1000.0f;
+      if( m < nearest ) {
+         nearest = m;
+         nearest_sector = sec;
+      }
+   }
+   r.stop_count = stop;
+   r.free_distance = free / 1000.0f;
+
+   // find which beam was nearest, only looking in its sector
+   if( nearest_sector >= 0 ) {
+      r.min_range = nearest / 1000.0f;
+      int start = nearest_sector * n / sectors_;
+      int end = (nearest_sector + 1) * n / sectors_;
+      for( int i=start; i<end; i++ ) {
+         float v = ranges[i];
+         if( v >= range_min && v <= range_max &&
+               (int32_t)(v * 1000.0f) == nearest ) {
+            r.min_index = i;
+            break;
+         }
+      }
+   }
+}
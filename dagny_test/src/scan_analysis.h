@@ -0,0 +1,77 @@
+/*
+ * scan_analysis.h
+ *
+ * Obstacle proximity from a laser scan, computed in a single pass over the
+ * ranges: the nearest return, the nearest return in each sector, how many
+ * returns are inside a stop radius, and how far the robot can drive along
+ * its current turning arc before it would hit something.
+ *
+ * Distances are from the laser. The free distance uses the straight-line
+ * distance to the first obstruction rather than the arc length to it,
+ * which is always a little short, so it errs on the safe side.
+ *
+ * The inner loop is branch-free and works on whole-millimeter integers, so
+ * that the compiler can vectorize it; build with -ftree-vectorize.
+ */
+
+#ifndef SCAN_ANALYSIS_H
+#define SCAN_ANALYSIS_H
+
+#include <vector>
+
+struct ScanResult {
+   // nearest valid return, and its beam; -1 if there are none
+   float min_range;
+   int min_index;
+
+   // nearest return in each sector; range_max for empty sectors
+   std::vector<float> sector_min;
+
+   // returns inside the stop radius
+   int stop_count;
+
+   // distance along the current arc to the first obstruction; range_max
+   // if there are none
+   float free_distance;
+};
+
+class ScanAnalysis {
+   public:
+      ScanAnalysis();
+
+      // sectors: how many equal sectors to split the scan into
+      // stop_radius: meters; returns inside it are counted
+      // half_width: meters; half the width of the swept path
+      // laser_x: meters; how far ahead of the rear axle the laser is
+      void configure(int sectors, float stop_radius, float half_width,
+            float laser_x);
+
+      // analyze a scan of n ranges; ranges outside [range_min, range_max]
+      // and NaNs don't count. curvature is 1/turning radius, positive to
+      // the left; 0 is straight ahead
+      void analyze(const float * ranges, int n, float range_min,
+            float range_max, float angle_min, float angle_increment,
+            float curvature, ScanResult & r);
+
+      int sectors() const { return sectors_; }
+      float stop_radius() const { return stop_radius_; }
+      float half_width() const { return half_width_; }
+
+   private:
+      // rebuild the beam direction tables if the scan geometry changed
+      void geometry(int n, float angle_min, float angle_increment);
+
+      int sectors_;
+      float stop_radius_;
+      float half_width_;
+      float laser_x_;
+
+      // beam directions for the current scan geometry
+      int n_;
+      float angle_min_;
+      float angle_increment_;
+      std::vector<float> cos_;
+      std::vector<float> sin_;
+};
+
+#endif